@@ -4,15 +4,23 @@ TARGET_DIR := ./
 SUBMAKEFILES := \
     src/common.mk \
     src/glasgow_subgraph_solver.mk \
+    src/glasgow_subgraph_server.mk \
     src/glasgow_clique_solver.mk \
     src/glasgow_common_subgraph_solver.mk \
     src/sip_to_opb.mk \
     src/sip_to_lad.mk \
+    src/sip_to_binary.mk \
     src/plot_glasgow_solver_outputs.mk \
     src/plot_glasgow_solver_proofs.mk \
     src/create_random_graph.mk
 
-override CXXFLAGS += -O3 -march=native -std=c++17 -Isrc/ -W -Wall -g -ggdb3 -pthread
+override CXXFLAGS += -O3 -std=c++17 -Isrc/ -W -Wall -g -ggdb3 -pthread
+
+# The vector kernels are picked at runtime, so by default we build a binary
+# that runs on any CPU. Use 'make NATIVE=1' to tune for the build machine.
+ifeq ($(NATIVE), 1)
+override CXXFLAGS += -march=native
+endif
 
 ifeq ($(shell uname -s), Linux)
 override LDFLAGS += -pthread -lstdc++fs
@@ -27,5 +27,128 @@ if ! grep '^solution_count = 6$' <(./glasgow_subgraph_solver --count-solutions -
     exit 1
 fi
 
+if ! grep '^solution_count = 6$' <(./glasgow_subgraph_solver --count-solutions --target-representation sparse --format lad test-instances/small test-instances/large ) ; then
+    echo "sparse target enumerate test failed" 1>&1
+    exit 1
+fi
+
+if ! grep '^solution_count = 6$' <(./glasgow_subgraph_solver --count-solutions --lazy-supplementals --distance3 --k4 --format lad test-instances/small test-instances/large ) ; then
+    echo "lazy supplementals enumerate test failed" 1>&1
+    exit 1
+fi
+
+target_cache=$(mktemp -d)
+for run in first second ; do
+    if ! grep '^solution_count = 6$' <(./glasgow_subgraph_solver --count-solutions --target-cache $target_cache --format lad test-instances/small test-instances/large ) ; then
+        echo "target cache $run enumerate test failed" 1>&1
+        rm -fr $target_cache
+        exit 1
+    fi
+done
+rm -fr $target_cache
+
+target_cache=$(mktemp -d)
+for run in trident:2 longtrident:12 ; do
+    if ! grep "^solution_count = ${run#*:}\$" <(./glasgow_subgraph_solver --count-solutions --target-cache $target_cache --format csv test-instances/trident.csv <(cat test-instances/${run%:*}.csv) ) ; then
+        echo "target cache piped ${run%:*} enumerate test failed" 1>&1
+        rm -fr $target_cache
+        exit 1
+    fi
+done
+rm -fr $target_cache
+
+large_target=$(mktemp)
+./create_random_graph --seed 3 1100 0.02 > $large_target
+if ! grep '^solution_count = 10962$' <(./glasgow_subgraph_solver --count-solutions --target-representation dense --format csv <(printf "a,b\nb,c\nc,a\n") $large_target ) ; then
+    echo "large dense target enumerate test failed" 1>&1
+    rm -f $large_target
+    exit 1
+fi
+
+target_cache=$(mktemp -d)
+for run in false true ; do
+    large_output=$(./glasgow_subgraph_solver --count-solutions --target-cache $target_cache --format csv <(printf "a,b\nb,c\nc,a\n") $large_target )
+    if ! grep "^target_cache_hit = $run\$" <<< "$large_output" || ! grep '^solution_count = 10962$' <<< "$large_output" ; then
+        echo "large target cache hit=$run enumerate test failed" 1>&1
+        rm -fr $target_cache $large_target
+        exit 1
+    fi
+done
+rm -fr $target_cache $large_target
+
+binary_target=$(mktemp)
+if ! ./sip_to_binary --format lad test-instances/large $binary_target || ! grep '^solution_count = 6$' <(./glasgow_subgraph_solver --count-solutions --pattern-format lad test-instances/small $binary_target ) ; then
+    echo "binary target enumerate test failed" 1>&1
+    rm -f $binary_target
+    exit 1
+fi
+rm -f $binary_target
+
+if ! grep '^solution_count = 6$' <(./glasgow_subgraph_solver --count-solutions --format lad test-instances/small <(gzip -c test-instances/large) ) ; then
+    echo "compressed target enumerate test failed" 1>&1
+    exit 1
+fi
+
+if ! grep '^solution_count = 12$' <(./glasgow_subgraph_solver --threads 3 --count-solutions --format csv test-instances/trident.csv test-instances/longtrident.csv ) ; then
+    echo "work stealing enumerate test failed" 1>&1
+    exit 1
+fi
+
+if ! grep '^solution_count = 12$' <(./glasgow_subgraph_solver --threads 3 --deterministic --count-solutions --format csv test-instances/trident.csv test-instances/longtrident.csv ) ; then
+    echo "deterministic enumerate test failed" 1>&1
+    exit 1
+fi
+
+random_pattern=$(mktemp)
+random_target=$(mktemp)
+for instance in "--count-solutions:1 8 0.4:2 1500 0.01" "--induced:24 15 0.4:124 100 0.3" ; do
+    IFS=: read -r mode pattern_args target_args <<< "$instance"
+    ./create_random_graph --seed $pattern_args > $random_pattern
+    ./create_random_graph --seed $target_args > $random_target
+    one_thread=$(./glasgow_subgraph_solver $mode --deterministic --threads 1 --format csv $random_pattern $random_target | grep -E '^(status|nodes|solution_count|mapping|subtrees) =' )
+    three_threads=$(./glasgow_subgraph_solver $mode --deterministic --threads 3 --format csv $random_pattern $random_target | grep -E '^(status|nodes|solution_count|mapping|subtrees) =' )
+    if ! grep -E '^subtrees = ([2-9]|[1-9][0-9]+)$' <<< "$one_thread" || [[ "$one_thread" != "$three_threads" ]] ; then
+        echo "deterministic split $mode test failed" 1>&1
+        rm -f $random_pattern $random_target
+        exit 1
+    fi
+done
+rm -f $random_pattern $random_target
+
+if ! test 2 = $(grep -c '^solution_count = 6$' <(printf "test-instances/small\ntest-instances/small\n" | ./glasgow_subgraph_solver --batch - --batch-threads 2 --count-solutions --format lad test-instances/large ) ) ; then
+    echo "batch enumerate test failed" 1>&1
+    exit 1
+fi
+
+server_dir=$(mktemp -d)
+./glasgow_subgraph_server --format lad $server_dir/socket test-instances/large > $server_dir/output &
+server_pid=$!
+for attempt in $(seq 100) ; do
+    grep -q '^listening = ' $server_dir/output && break
+    sleep 0.1
+done
+server_reply=$(python3 -c '
+import socket, sys
+s = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+s.connect(sys.argv[1])
+s.sendall((sys.argv[2] + "\n").encode())
+reply = b""
+while not reply.endswith(b"\n\n"):
+    data = s.recv(4096)
+    if not data:
+        break
+    reply += data
+sys.stdout.write(reply.decode())
+' $server_dir/socket "--format lad --count-solutions test-instances/small" )
+kill -TERM $server_pid
+wait $server_pid
+server_status=$?
+if ! grep '^solution_count = 6$' <<< "$server_reply" || ! test 0 = $server_status || ! grep '^stopping = true$' $server_dir/output || test -e $server_dir/socket ; then
+    echo "server enumerate test failed" 1>&1
+    rm -fr $server_dir
+    exit 1
+fi
+rm -fr $server_dir
+
 true
 
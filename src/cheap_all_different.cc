@@ -25,7 +25,7 @@ namespace
         // int the "count==domains.size()" bucket.
         // The "first" array is sized to be able to hold domains.size()+1
         // elements
-        vector<int> first(target_size + 1, -1), next(target_size, -1);
+        vector<int> first(domains.size() + 1, -1), next(domains.size(), -1);
 
         [[ maybe_unused ]] conditional_t<proof_, vector<int>, tuple<> > lhs, hall_lhs, hall_rhs;
 
@@ -42,6 +42,7 @@ namespace
         // counting all-different
         SVOBitset domains_so_far{ target_size, 0 }, hall{ target_size, 0 };
         unsigned neighbours_so_far = 0;
+        bool hall_is_empty = true;
 
         [[ maybe_unused ]] conditional_t<proof_, unsigned, tuple<> > last_outputted_hall_size{};
 
@@ -58,8 +59,9 @@ namespace
                 if constexpr (proof_)
                     old_d_values_count = d.values.count();
 
-                d.values.intersect_with_complement(hall);
-                d.count = d.values.count();
+                // nothing to remove until we've found a hall set
+                if (! hall_is_empty)
+                    d.count = d.values.intersect_with_complement_and_count(hall);
 
                 if constexpr (proof_)
                     if (last_outputted_hall_size != hall.count() && d.count != old_d_values_count) {
@@ -70,20 +72,16 @@ namespace
                 if (0 == d.count)
                     return false;
 
-                domains_so_far |= d.values;
+                unsigned domains_so_far_popcount = domains_so_far.unite_and_count(d.values);
                 ++neighbours_so_far;
 
-                unsigned domains_so_far_popcount = domains_so_far.count();
-
                 if (domains_so_far_popcount < neighbours_so_far) {
                     // hall violator, so we fail (after outputting a proof)
                     if constexpr (proof_) {
                         vector<int> rhs;
-                        auto d = domains_so_far;
-                        for (auto v = d.find_first() ; v != decltype(d)::npos ; v = d.find_first()) {
-                            d.reset(v);
+                        domains_so_far.for_each_set_bit([&] (unsigned v) {
                             rhs.push_back(v);
-                        }
+                        });
                         proof->emit_hall_set_or_violator(lhs, rhs);
                     }
                     return false;
@@ -91,14 +89,13 @@ namespace
                 else if (domains_so_far_popcount == neighbours_so_far) {
                     // equivalent to hall=domains_so_far
                     hall |= domains_so_far;
+                    hall_is_empty = false;
                     if constexpr (proof_) {
                         hall_lhs = lhs;
                         hall_rhs.clear();
-                        auto d = domains_so_far;
-                        for (auto v = d.find_first() ; v != decltype(d)::npos ; v = d.find_first()) {
-                            d.reset(v);
+                        domains_so_far.for_each_set_bit([&] (unsigned v) {
                             hall_rhs.push_back(v);
-                        }
+                        });
                     }
                 }
                 domain_index = next[domain_index];
@@ -1,8 +1,10 @@
 TARGET := libcommon.a
 
 SOURCES := \
+    formats/binary.cc \
     formats/csv.cc \
     formats/dimacs.cc \
+    formats/graph_file_contents.cc \
     formats/graph_file_error.cc \
     formats/input_graph.cc \
     formats/lad.cc \
@@ -12,6 +14,7 @@ SOURCES := \
     clique.cc \
     common_subgraph.cc \
     configuration.cc \
+    cpu_features.cc \
     graph_traits.cc \
     homomorphism.cc \
     homomorphism_domain.cc \
@@ -19,10 +22,12 @@ SOURCES := \
     homomorphism_searcher.cc \
     homomorphism_traits.cc \
     lackey.cc \
+    prepared_target.cc \
     proof.cc \
     restarts.cc \
     svo_bitset.cc \
     sip_decomposer.cc \
+    supplemental_graphs.cc \
     symmetries.cc \
     thread_utils.cc \
     timeout.cc \
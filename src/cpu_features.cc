@@ -0,0 +1,40 @@
+/* vim: set sw=4 sts=4 et foldmethod=syntax : */
+
+#include "cpu_features.hh"
+
+namespace
+{
+#if defined(GLASGOW_SUBGRAPH_SOLVER_X86_KERNELS)
+    auto init_cpu_features() -> bool
+    {
+        __builtin_cpu_init();
+        return true;
+    }
+
+    auto ensure_cpu_features() -> void
+    {
+        static const bool initialised = init_cpu_features();
+        (void) initialised;
+    }
+#endif
+}
+
+auto cpu_has_avx2() -> bool
+{
+#if defined(GLASGOW_SUBGRAPH_SOLVER_X86_KERNELS)
+    ensure_cpu_features();
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+auto cpu_has_avx512_popcount() -> bool
+{
+#if defined(GLASGOW_SUBGRAPH_SOLVER_X86_KERNELS)
+    ensure_cpu_features();
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vpopcntdq");
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,24 @@
+/* vim: set sw=4 sts=4 et foldmethod=syntax : */
+
+#ifndef GLASGOW_SUBGRAPH_SOLVER_GUARD_SRC_CPU_FEATURES_HH
+#define GLASGOW_SUBGRAPH_SOLVER_GUARD_SRC_CPU_FEATURES_HH 1
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#  define GLASGOW_SUBGRAPH_SOLVER_X86_KERNELS 1
+#  include <immintrin.h>
+#endif
+
+/**
+ * Can the CPU we are running on execute AVX2 instructions? Always false if
+ * we were not built with GLASGOW_SUBGRAPH_SOLVER_X86_KERNELS.
+ */
+auto cpu_has_avx2() -> bool;
+
+/**
+ * Can the CPU we are running on execute AVX-512F and AVX-512 VPOPCNTDQ
+ * instructions? Always false if we were not built with
+ * GLASGOW_SUBGRAPH_SOLVER_X86_KERNELS.
+ */
+auto cpu_has_avx512_popcount() -> bool;
+
+#endif
@@ -0,0 +1,314 @@
+/* vim: set sw=4 sts=4 et foldmethod=syntax : */
+
+#include "formats/binary.hh"
+#include "formats/input_graph.hh"
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using std::map;
+using std::move;
+using std::numeric_limits;
+using std::ostream;
+using std::string;
+using std::string_view;
+using std::uint32_t;
+using std::uint64_t;
+using std::unordered_map;
+using std::vector;
+
+namespace
+{
+    // Every file starts with these eight bytes. The first is not ASCII, so
+    // that no text format can be mistaken for a binary file.
+    constexpr char binary_magic[8] = { '\x89', 'G', 'S', 'S', 'B', 'I', 'N', '\n' };
+
+    // Numbers are written in the byte order of the machine doing the
+    // writing, and the version tells us if that isn't ours.
+    constexpr uint64_t binary_version = 1;
+    constexpr uint64_t binary_version_other_byte_order = binary_version << 56;
+
+    constexpr uint64_t has_vertex_labels_flag = 1, has_edge_labels_flag = 2, directed_flag = 4;
+
+    constexpr uint32_t no_vertex_name = numeric_limits<uint32_t>::max();
+
+    /* The header is followed by, each padded to a multiple of eight bytes:
+     * - row starts, as vertices + 1 uint64s;
+     * - neighbours, as edges uint32s;
+     * - edge label ids, as edges uint32s, only if there are edge labels
+     *   other than the empty one;
+     * - vertex name ids, as vertices uint32s, or no_vertex_name;
+     * - vertex label ids, as vertices uint32s;
+     * - the edge label table, whose first entry is empty;
+     * - the string table, for vertex names and labels.
+     * A table is count + 1 uint64 offsets, and then the characters. */
+    struct Header
+    {
+        char magic[8];
+        uint64_t version;
+        uint64_t flags;
+        uint64_t vertices;
+        uint64_t edges;
+        uint64_t edge_labels;
+        uint64_t strings;
+    };
+
+    static_assert(sizeof(Header) == 56, "Header must not have padding");
+
+    auto padding_for(uint64_t size) -> uint64_t
+    {
+        return (8 - size % 8) % 8;
+    }
+
+    class BinaryReader
+    {
+        private:
+            string_view _text;
+            const string & _filename;
+
+        public:
+            BinaryReader(string_view text, const string & filename) :
+                _text(text),
+                _filename(filename)
+            {
+            }
+
+            auto fail(const string & message) const -> GraphFileError
+            {
+                return GraphFileError{ _filename, message, true };
+            }
+
+            template <typename T_>
+            auto array(uint64_t count) -> const char *
+            {
+                if (count > _text.size() / sizeof(T_))
+                    throw fail("file is truncated");
+                uint64_t size = count * sizeof(T_);
+                size += padding_for(size);
+                if (size > _text.size())
+                    throw fail("file is truncated");
+                auto result = _text.data();
+                _text.remove_prefix(size);
+                return result;
+            }
+
+            template <typename T_>
+            static auto at(const char * data, uint64_t i) -> T_
+            {
+                // the data needn't be aligned if we aren't reading from a mapping
+                T_ result;
+                std::memcpy(&result, data + i * sizeof(T_), sizeof(T_));
+                return result;
+            }
+
+            auto table(uint64_t count, const char * const what) -> vector<string_view>
+            {
+                auto offsets = array<uint64_t>(count + 1);
+                auto characters_size = at<uint64_t>(offsets, count);
+                auto characters = array<char>(characters_size);
+
+                vector<string_view> result;
+                result.reserve(count);
+                uint64_t previous = 0;
+                if (0 != at<uint64_t>(offsets, 0))
+                    throw fail(string{ what } + " table is corrupt");
+                for (uint64_t i = 0 ; i < count ; ++i) {
+                    auto next = at<uint64_t>(offsets, i + 1);
+                    if (next < previous)
+                        throw fail(string{ what } + " table is corrupt");
+                    result.emplace_back(characters + previous, next - previous);
+                    previous = next;
+                }
+                return result;
+            }
+
+            auto at_end() const -> bool
+            {
+                return _text.empty();
+            }
+    };
+
+    class BinaryWriter
+    {
+        private:
+            ostream & _stream;
+
+        public:
+            explicit BinaryWriter(ostream & stream) :
+                _stream(stream)
+            {
+            }
+
+            auto bytes(const void * data, uint64_t size) -> void
+            {
+                static const char zeroes[8] = { 0 };
+                _stream.write(static_cast<const char *>(data), size);
+                _stream.write(zeroes, padding_for(size));
+            }
+
+            template <typename T_>
+            auto array(const vector<T_> & values) -> void
+            {
+                bytes(values.data(), values.size() * sizeof(T_));
+            }
+
+            auto table(const vector<string> & entries) -> void
+            {
+                vector<uint64_t> offsets{ 0 };
+                string characters;
+                for (auto & e : entries) {
+                    characters.append(e);
+                    offsets.push_back(characters.size());
+                }
+                array(offsets);
+                bytes(characters.data(), characters.size());
+            }
+    };
+}
+
+auto is_binary_graph(string_view text) -> bool
+{
+    return text.size() >= sizeof(binary_magic) && 0 == text.compare(0, sizeof(binary_magic), string_view{ binary_magic, sizeof(binary_magic) });
+}
+
+auto read_binary(string_view text, const string & filename) -> InputGraph
+{
+    if (! is_binary_graph(text))
+        throw GraphFileError{ filename, "not a binary graph file", true };
+
+    BinaryReader reader{ text, filename };
+    auto header = BinaryReader::at<Header>(reader.array<Header>(1), 0);
+
+    if (binary_version_other_byte_order == header.version)
+        throw reader.fail("binary graph file was written on a machine with a different byte order");
+    else if (binary_version != header.version)
+        throw reader.fail("unsupported binary graph file version " + std::to_string(header.version));
+
+    if (header.vertices >= uint64_t(numeric_limits<int>::max()) || header.edges > uint64_t(numeric_limits<int>::max())
+            || header.edge_labels == 0 || header.edge_labels > no_vertex_name || header.strings > no_vertex_name)
+        throw reader.fail("binary graph file header is corrupt");
+
+    auto row_starts_data = reader.array<uint64_t>(header.vertices + 1);
+    auto neighbours_data = reader.array<uint32_t>(header.edges);
+    auto edge_label_ids_data = header.edge_labels > 1 ? reader.array<uint32_t>(header.edges) : nullptr;
+    auto vertex_name_ids_data = reader.array<uint32_t>(header.vertices);
+    auto vertex_label_ids_data = reader.array<uint32_t>(header.vertices);
+    auto edge_labels = reader.table(header.edge_labels, "edge label");
+    auto strings = reader.table(header.strings, "string");
+    if (! reader.at_end())
+        throw reader.fail("unexpected data at the end of the binary graph file");
+    if (! edge_labels.front().empty())
+        throw reader.fail("edge label table is corrupt");
+
+    int size = header.vertices;
+    InputGraph result{ size, 0 != (header.flags & has_vertex_labels_flag), 0 != (header.flags & has_edge_labels_flag) };
+
+    vector<std::size_t> row_starts(size + 1);
+    vector<int> neighbours(header.edges);
+    vector<unsigned> labels(header.edges, 0);
+    for (int v = 0 ; v <= size ; ++v) {
+        row_starts[v] = BinaryReader::at<uint64_t>(row_starts_data, v);
+        if (v == 0 ? row_starts[v] != 0 : row_starts[v] < row_starts[v - 1])
+            throw reader.fail("adjacency rows are corrupt");
+    }
+    if (row_starts[size] != header.edges)
+        throw reader.fail("adjacency rows are corrupt");
+
+    for (int v = 0 ; v < size ; ++v)
+        for (auto e = row_starts[v] ; e != row_starts[v + 1] ; ++e) {
+            auto w = BinaryReader::at<uint32_t>(neighbours_data, e);
+            if (w >= header.vertices || (e != row_starts[v] && int(w) <= neighbours[e - 1]))
+                throw reader.fail("adjacency rows are corrupt");
+            neighbours[e] = w;
+        }
+
+    if (edge_label_ids_data)
+        for (uint64_t e = 0 ; e < header.edges ; ++e) {
+            labels[e] = BinaryReader::at<uint32_t>(edge_label_ids_data, e);
+            if (labels[e] >= header.edge_labels)
+                throw reader.fail("edge label index out of bounds");
+        }
+
+    result.set_adjacency_rows(move(row_starts), move(neighbours), move(labels),
+            vector<string>(edge_labels.begin(), edge_labels.end()), 0 != (header.flags & directed_flag));
+
+    for (int v = 0 ; v < size ; ++v) {
+        auto name = BinaryReader::at<uint32_t>(vertex_name_ids_data, v);
+        auto label = BinaryReader::at<uint32_t>(vertex_label_ids_data, v);
+        if ((name != no_vertex_name && name >= header.strings) || label >= header.strings)
+            throw reader.fail("string index out of bounds");
+        if (name != no_vertex_name)
+            result.set_vertex_name(v, strings[name]);
+        result.set_vertex_label(v, strings[label]);
+    }
+
+    return result;
+}
+
+auto write_binary_graph(ostream & stream, const InputGraph & graph) -> void
+{
+    int size = graph.size();
+
+    vector<uint64_t> row_starts(size + 1, 0);
+    vector<uint32_t> neighbours, edge_label_ids;
+    vector<string> edge_labels{ "" };
+    map<string, uint32_t, std::less<> > edge_label_lookup{ { "", 0 } };
+    graph.for_each_edge([&] (int a, int b, string_view l) {
+            ++row_starts[a + 1];
+            neighbours.push_back(b);
+            auto i = edge_label_lookup.find(l);
+            if (i == edge_label_lookup.end()) {
+                i = edge_label_lookup.emplace(l, edge_labels.size()).first;
+                edge_labels.emplace_back(l);
+            }
+            edge_label_ids.push_back(i->second);
+            });
+    for (int v = 0 ; v < size ; ++v)
+        row_starts[v + 1] += row_starts[v];
+
+    vector<string> strings;
+    unordered_map<string, uint32_t> string_lookup;
+    auto intern = [&] (const string & s) -> uint32_t {
+        auto [ i, inserted ] = string_lookup.emplace(s, strings.size());
+        if (inserted)
+            strings.push_back(s);
+        return i->second;
+    };
+
+    vector<uint32_t> vertex_name_ids(size), vertex_label_ids(size);
+    for (int v = 0 ; v < size ; ++v) {
+        // an unnamed vertex reports its number as its name, but can't be
+        // looked up by it
+        auto name = graph.vertex_name(v);
+        vertex_name_ids[v] = graph.vertex_from_name(name) == v ? intern(name) : no_vertex_name;
+        vertex_label_ids[v] = intern(string{ graph.vertex_label(v) });
+    }
+
+    Header header{ };
+    std::memcpy(header.magic, binary_magic, sizeof(binary_magic));
+    header.version = binary_version;
+    header.flags = (graph.has_vertex_labels() ? has_vertex_labels_flag : 0)
+        | (graph.has_edge_labels() ? has_edge_labels_flag : 0)
+        | (graph.directed() ? directed_flag : 0);
+    header.vertices = size;
+    header.edges = neighbours.size();
+    header.edge_labels = edge_labels.size();
+    header.strings = strings.size();
+
+    BinaryWriter writer{ stream };
+    writer.bytes(&header, sizeof(header));
+    writer.array(row_starts);
+    writer.array(neighbours);
+    if (edge_labels.size() > 1)
+        writer.array(edge_label_ids);
+    writer.array(vertex_name_ids);
+    writer.array(vertex_label_ids);
+    writer.table(edge_labels);
+    writer.table(strings);
+}
@@ -0,0 +1,34 @@
+/* vim: set sw=4 sts=4 et foldmethod=syntax : */
+
+#ifndef GLASGOW_SUBGRAPH_SOLVER_SOLVER_FORMATS_BINARY_HH
+#define GLASGOW_SUBGRAPH_SOLVER_SOLVER_FORMATS_BINARY_HH 1
+
+#include "formats/input_graph.hh"
+#include "formats/graph_file_error.hh"
+
+#include <ostream>
+#include <string>
+#include <string_view>
+
+/**
+ * Does this look like one of our binary graph files?
+ */
+auto is_binary_graph(std::string_view text) -> bool;
+
+/**
+ * Read a binary graph file, as written by write_binary_graph, into an
+ * InputGraph.
+ *
+ * \throw GraphFileError
+ */
+auto read_binary(std::string_view text, const std::string & filename) -> InputGraph;
+
+/**
+ * Write a graph in our binary format. This is a fixed header, followed by the
+ * sorted adjacency rows, and then tables of the vertex names and the
+ * (interned) vertex and edge labels, so reading it back in is mostly
+ * copying.
+ */
+auto write_binary_graph(std::ostream &, const InputGraph &) -> void;
+
+#endif
@@ -2,74 +2,135 @@
 
 #include "formats/csv.hh"
 #include "formats/input_graph.hh"
+#include "formats/graph_file_contents.hh"
+#include "thread_utils.hh"
 
-#include <fstream>
 #include <optional>
+#include <string>
+#include <string_view>
 #include <tuple>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
-using std::ifstream;
 using std::nullopt;
 using std::optional;
+using std::pair;
 using std::string;
+using std::string_view;
 using std::tuple;
 using std::unordered_map;
 using std::vector;
 
 namespace
 {
-    auto read_csv(ifstream && infile, const string & filename, const optional<unordered_map<string, string> > & rename_map) -> InputGraph
+    /* A piece of the file, with its names interned locally in order of first
+     * appearance, so that pieces can be parsed in parallel and then merged. */
+    struct CSVChunk
     {
-        if (! infile)
-            throw GraphFileError{ filename, "error opening file", false };
-
-        unordered_map<string, int> vertices;
-        unordered_map<string, string> vertex_labels;
-        vector<tuple<int, int, string> > edges;
+        unordered_map<string_view, int> vertices;
+        vector<string_view> names;
+        vector<pair<int, string_view> > vertex_labels;
+        vector<tuple<int, int, string_view> > edges;
         bool seen_vertex_label = false, seen_edge_label = false, seen_directed_edge = false;
+        bool missing_comma = false;
+
+        auto intern(string_view name) -> int
+        {
+            auto [ v, inserted ] = vertices.emplace(name, names.size());
+            if (inserted)
+                names.push_back(name);
+            return v->second;
+        }
+    };
 
-        string line;
+    auto read_csv_chunk(string_view text, CSVChunk & chunk) -> void
+    {
+        GraphFileScanner scanner{ text };
+        string_view line;
 
-        while (getline(infile, line)) {
+        while (scanner.next_line(line)) {
             auto pos = line.find_first_of(",>");
-            if (string::npos == pos)
-                throw GraphFileError{ filename, "expected a comma but didn't get one", true };
+            if (string_view::npos == pos) {
+                chunk.missing_comma = true;
+                return;
+            }
 
-            string left = line.substr(0, pos), right = line.substr(pos + 1), label;
+            string_view left = line.substr(0, pos), right = line.substr(pos + 1), label;
             char delim = line.at(pos);
 
             auto pos2 = right.find(',');
-            if (string::npos != pos2) {
+            if (string_view::npos != pos2) {
                 label = right.substr(pos2 + 1);
                 right = right.substr(0, pos2);
             }
 
             if (right.empty() && ! left.empty()) {
+                int left_idx = chunk.intern(left);
                 if (! label.empty()) {
-                    seen_vertex_label = true;
-                    vertex_labels.emplace(left, label);
+                    chunk.seen_vertex_label = true;
+                    chunk.vertex_labels.emplace_back(left_idx, label);
                 }
-
-                vertices.emplace(left, vertices.size());
             }
             else {
-                int left_idx = vertices.emplace(left, vertices.size()).first->second;
-                int right_idx = vertices.emplace(right, vertices.size()).first->second;
+                int left_idx = chunk.intern(left);
+                int right_idx = chunk.intern(right);
 
                 if (! label.empty())
-                    seen_edge_label = true;
+                    chunk.seen_edge_label = true;
 
                 if (delim == '>') {
-                    seen_directed_edge = true;
-                    edges.emplace_back(left_idx, right_idx, label);
+                    chunk.seen_directed_edge = true;
+                    chunk.edges.emplace_back(left_idx, right_idx, label);
                 }
                 else {
-                    edges.emplace_back(left_idx, right_idx, label);
-                    edges.emplace_back(right_idx, left_idx, label);
+                    chunk.edges.emplace_back(left_idx, right_idx, label);
+                    chunk.edges.emplace_back(right_idx, left_idx, label);
                 }
             }
         }
+    }
+
+    auto read_csv(string_view text, const string & filename, const optional<unordered_map<string, string> > & rename_map) -> InputGraph
+    {
+        auto pieces = split_at_lines(text, how_many_parse_chunks(text));
+        vector<CSVChunk> chunks(pieces.size());
+        parallel_for_each_block(0, pieces.size(), 1, [&] (unsigned, unsigned first, unsigned last) {
+                for (unsigned c = first ; c != last ; ++c)
+                    read_csv_chunk(pieces[c], chunks[c]);
+                });
+
+        // names and labels are views into the file's contents, which are
+        // only copied once they are stored in the graph. Merging chunks in
+        // order numbers vertices by their first appearance in the file.
+        unordered_map<string_view, int> vertices;
+        unordered_map<int, string_view> vertex_labels;
+        vector<tuple<int, int, string_view> > edges;
+        bool seen_vertex_label = false, seen_edge_label = false, seen_directed_edge = false;
+
+        for (auto & chunk : chunks)
+            if (chunk.missing_comma)
+                throw GraphFileError{ filename, "expected a comma but didn't get one", true };
+
+        vector<int> global_ids;
+        for (auto & chunk : chunks) {
+            global_ids.clear();
+            for (auto & name : chunk.names)
+                global_ids.push_back(vertices.emplace(name, vertices.size()).first->second);
+
+            for (auto & [ v, l ] : chunk.vertex_labels)
+                vertex_labels.emplace(global_ids[v], l);
+
+            edges.reserve(edges.size() + chunk.edges.size());
+            for (auto & [ f, t, l ] : chunk.edges)
+                edges.emplace_back(global_ids[f], global_ids[t], l);
+
+            seen_vertex_label = seen_vertex_label || chunk.seen_vertex_label;
+            seen_edge_label = seen_edge_label || chunk.seen_edge_label;
+            seen_directed_edge = seen_directed_edge || chunk.seen_directed_edge;
+
+            chunk = CSVChunk{ };
+        }
 
         InputGraph result{ int(vertices.size()), seen_vertex_label, seen_edge_label };
 
@@ -83,11 +144,11 @@ namespace
             else
                 result.add_edge(f, t);
 
-        auto rename = [&] (const string & s) -> string {
+        auto rename = [&] (string_view s) -> string_view {
             if (rename_map) {
-                auto r = rename_map->find(s);
+                auto r = rename_map->find(string{ s });
                 if (r == rename_map->end())
-                    throw GraphFileError{ filename, "did not find a name for vertex '" + s + "'", true };
+                    throw GraphFileError{ filename, "did not find a name for vertex '" + string{ s } + "'", true };
                 return r->second;
             }
             else
@@ -99,35 +160,39 @@ namespace
 
         if (seen_vertex_label)
             for (auto & [v, l] : vertices)
-                result.set_vertex_label(l, vertex_labels[v]);
+                result.set_vertex_label(l, vertex_labels[l]);
 
         return result;
     }
 }
 
-auto read_csv(ifstream && infile, const string & filename) -> InputGraph
+auto read_csv(string_view text, const string & filename) -> InputGraph
 {
-    return read_csv(move(infile), filename, nullopt);
+    return read_csv(text, filename, nullopt);
 }
 
-auto read_csv_name(std::ifstream && infile, const std::string & filename, const std::string & name_map_filename) -> InputGraph
+auto read_csv_name(string_view text, const string & filename, const string & name_map_filename) -> InputGraph
 {
-    ifstream name_map_file{ name_map_filename };
-    if (! name_map_file)
+    optional<GraphFileContents> name_map_file;
+    try {
+        name_map_file.emplace(name_map_filename);
+    }
+    catch (const GraphFileError &) {
         throw GraphFileError{ name_map_filename, "could not open rename map file", false };
+    }
 
     optional<unordered_map<string, string> > rename_map{ unordered_map<string, string>{ } };
 
-    string line;
-    while (getline(name_map_file, line)) {
+    GraphFileScanner scanner{ name_map_file->text() };
+    string_view line;
+    while (scanner.next_line(line)) {
         auto pos = line.find(',');
-        if (string::npos == pos)
+        if (string_view::npos == pos)
             throw GraphFileError{ filename, "expected a comma but didn't get one", true };
-        string left = line.substr(0, pos), right = line.substr(pos + 1);
-        rename_map->emplace(left, right);
+        rename_map->emplace(line.substr(0, pos), line.substr(pos + 1));
     }
 
-    return read_csv(move(infile), filename, rename_map);
+    return read_csv(text, filename, rename_map);
 }
 
 
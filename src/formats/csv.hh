@@ -6,16 +6,16 @@
 #include "formats/input_graph.hh"
 #include "formats/graph_file_error.hh"
 
-#include <iosfwd>
 #include <string>
+#include <string_view>
 
 /**
  * Read a CSV format file into an InputGraph.
  *
  * \throw GraphFileError
  */
-auto read_csv(std::ifstream && infile, const std::string & filename) -> InputGraph;
+auto read_csv(std::string_view text, const std::string & filename) -> InputGraph;
 
-auto read_csv_name(std::ifstream && infile, const std::string & filename, const std::string & name_map_filename) -> InputGraph;
+auto read_csv_name(std::string_view text, const std::string & filename, const std::string & name_map_filename) -> InputGraph;
 
 #endif
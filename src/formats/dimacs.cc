@@ -2,64 +2,156 @@
 
 #include "formats/dimacs.hh"
 #include "formats/input_graph.hh"
+#include "formats/graph_file_contents.hh"
 #include "formats/graph_file_error.hh"
+#include "thread_utils.hh"
 
-#include <fstream>
-#include <regex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
 
-using std::getline;
-using std::ifstream;
-using std::regex;
-using std::smatch;
-using std::stoi;
+using std::optional;
+using std::pair;
 using std::string;
+using std::string_view;
 using std::to_string;
+using std::vector;
 
-auto read_dimacs(ifstream && infile, const string & filename) -> InputGraph
+auto is_dimacs_comment_line(string_view line) -> bool
 {
-    InputGraph result{ 0, false, false };
+    // c(\s.*)?
+    return (! line.empty()) && line[0] == 'c' && (1 == line.size() || is_graph_file_space(line[1]));
+}
+
+auto is_dimacs_problem_line(string_view line, string_view & size) -> bool
+{
+    // p\s+(edge|col)\s+(\d+)\s+(\d+)?\s*
+    GraphFileScanner scanner{ line };
+    if (! scanner.skip_literal("p") || ! scanner.skip_whitespace())
+        return false;
+    if (! scanner.skip_literal("edge") && ! scanner.skip_literal("col"))
+        return false;
+    if (! scanner.skip_whitespace())
+        return false;
+    size = scanner.digits();
+    if (size.empty() || ! scanner.skip_whitespace())
+        return false;
+    scanner.digits();
+    scanner.skip_whitespace();
+    return scanner.at_end();
+}
 
-    string line;
-    while (getline(infile, line)) {
-        if (line.empty())
-            continue;
+namespace
+{
+    auto is_dimacs_edge_line(string_view line, string_view & a, string_view & b) -> bool
+    {
+        // e\s+(\d+)\s+(\d+)\s*
+        GraphFileScanner scanner{ line };
+        if (! scanner.skip_literal("e") || ! scanner.skip_whitespace())
+            return false;
+        a = scanner.digits();
+        if (a.empty() || ! scanner.skip_whitespace())
+            return false;
+        b = scanner.digits();
+        if (b.empty())
+            return false;
+        scanner.skip_whitespace();
+        return scanner.at_end();
+    }
+}
 
-        /* Lines are comments, a problem description (contains the number of
-         * vertices), or an edge. */
-        static const regex
-            comment{ R"(c(\s.*)?)" },
-            problem{ R"(p\s+(edge|col)\s+(\d+)\s+(\d+)?\s*)" },
-            edge{ R"(e\s+(\d+)\s+(\d+)\s*)" };
+namespace
+{
+    struct DimacsChunk
+    {
+        vector<pair<int, int> > edges;
+        optional<string> error;
+    };
 
-        smatch match;
-        if (regex_match(line, match, comment)) {
+    auto read_dimacs_edges(string_view text, int size, DimacsChunk & chunk) -> void
+    {
+        GraphFileScanner scanner{ text };
+        string_view line;
+        while (scanner.next_line(line)) {
+            string_view size_digits, a_digits, b_digits;
+            if (line.empty() || is_dimacs_comment_line(line)) {
+                /* Comment, ignore */
+            }
+            else if (is_dimacs_problem_line(line, size_digits)) {
+                chunk.error = "multiple 'p' lines encountered";
+                return;
+            }
+            else if (is_dimacs_edge_line(line, a_digits, b_digits)) {
+                /* An edge. DIMACS files are 1-indexed. We assume we've already had
+                 * a problem line (if not our size will be 0, so we'll throw). */
+                int a, b;
+                if (! parse_graph_file_int(a_digits, a) || ! parse_graph_file_int(b_digits, b)
+                        || 0 == a || 0 == b || a > size || b > size) {
+                    chunk.error = "line '" + string{ line } + "' edge index out of bounds";
+                    return;
+                }
+                chunk.edges.emplace_back(a - 1, b - 1);
+            }
+            else {
+                chunk.error = "cannot parse line '" + string{ line } + "'";
+                return;
+            }
+        }
+    }
+}
+
+auto read_dimacs(string_view text, const string & filename) -> InputGraph
+{
+    InputGraph result{ 0, false, false };
+    GraphFileScanner scanner{ text };
+
+    /* Lines are comments, a problem description (contains the number of
+     * vertices), or an edge. The problem description comes before any edges,
+     * so we read up to it here, and then the edges can be split into chunks
+     * and parsed in parallel. */
+    string_view line, rest;
+    while (scanner.next_line(line)) {
+        string_view size;
+        if (line.empty() || is_dimacs_comment_line(line)) {
             /* Comment, ignore */
         }
-        else if (regex_match(line, match, problem)) {
+        else if (is_dimacs_problem_line(line, size)) {
             /* Problem. Specifies the size of the graph. Must happen exactly
              * once. */
             if (0 != result.size())
                 throw GraphFileError{ filename, "multiple 'p' lines encountered", true };
-            result.resize(stoi(match.str(2)));
+            int n;
+            if (! parse_graph_file_int(size, n))
+                throw GraphFileError{ filename, "line '" + string{ line } + "' has too many vertices", true };
+            result.resize(n);
         }
-        else if (regex_match(line, match, edge)) {
-            /* An edge. DIMACS files are 1-indexed. We assume we've already had
-             * a problem line (if not our size will be 0, so we'll throw). */
-            int a{ stoi(match.str(1)) }, b{ stoi(match.str(2)) };
-            if (0 == a || 0 == b || a > result.size() || b > result.size())
-                throw GraphFileError{ filename, "line '" + line + "' edge index out of bounds", true };
-            result.add_edge(a - 1, b - 1);
+        else {
+            rest = text.substr(line.data() - text.data());
+            break;
         }
-        else
-            throw GraphFileError{ filename, "cannot parse line '" + line + "'", true };
     }
 
-    if (! infile.eof())
-        throw GraphFileError{ filename, "error reading file", true };
+    auto pieces = split_at_lines(rest, how_many_parse_chunks(rest));
+    vector<DimacsChunk> chunks(pieces.size());
+    parallel_for_each_block(0, pieces.size(), 1, [&] (unsigned, unsigned first, unsigned last) {
+            for (unsigned c = first ; c != last ; ++c)
+                read_dimacs_edges(pieces[c], result.size(), chunks[c]);
+            });
+
+    /* The earliest error in the file is the one a sequential read would have
+     * given. */
+    for (auto & chunk : chunks)
+        if (chunk.error)
+            throw GraphFileError{ filename, *chunk.error, true };
+
+    for (auto & chunk : chunks)
+        for (auto & [ a, b ] : chunk.edges)
+            result.add_edge(a, b);
 
     for (int v = 0 ; v < result.size() ; ++v)
         result.set_vertex_name(v, to_string(v + 1));
 
     return result;
 }
-
@@ -6,14 +6,25 @@
 #include "formats/input_graph.hh"
 #include "formats/graph_file_error.hh"
 
-#include <iosfwd>
 #include <string>
+#include <string_view>
 
 /**
  * Read a DIMACS format file into an InputGraph.
  *
  * \throw GraphFileError
  */
-auto read_dimacs(std::ifstream && infile, const std::string & filename) -> InputGraph;
+auto read_dimacs(std::string_view text, const std::string & filename) -> InputGraph;
+
+/**
+ * Is this line a DIMACS comment?
+ */
+auto is_dimacs_comment_line(std::string_view line) -> bool;
+
+/**
+ * Is this line a DIMACS problem line? If so, size is set to the digits
+ * giving the number of vertices.
+ */
+auto is_dimacs_problem_line(std::string_view line, std::string_view & size) -> bool;
 
 #endif
@@ -0,0 +1,315 @@
+/* vim: set sw=4 sts=4 et foldmethod=syntax : */
+
+#include "formats/graph_file_contents.hh"
+#include "formats/graph_file_error.hh"
+#include "thread_utils.hh"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/filter/bzip2.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filter/zstd.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+
+using std::condition_variable;
+using std::deque;
+using std::exception;
+using std::max;
+using std::min;
+using std::move;
+using std::mutex;
+using std::streamsize;
+using std::string;
+using std::string_view;
+using std::thread;
+using std::unique_lock;
+using std::vector;
+
+using boost::iostreams::array_source;
+using boost::iostreams::bzip2_decompressor;
+using boost::iostreams::filtering_istream;
+using boost::iostreams::gzip_decompressor;
+using boost::iostreams::zstd_decompressor;
+
+namespace
+{
+    // Below this, splitting a file up costs more than it saves.
+    constexpr string_view::size_type minimum_parse_chunk_size = 1 << 20;
+
+    constexpr std::size_t read_block_size = 65536;
+
+    enum class Compression
+    {
+        None,
+        Gzip,
+        Bzip2,
+        Zstd
+    };
+
+    // How much of the start of a file do we need to recognise compression?
+    constexpr string_view::size_type compression_magic_size = 10;
+
+    auto detect_compression(string_view start) -> Compression
+    {
+        using namespace std::literals;
+        if (0 == start.compare(0, 2, "\x1f\x8b"sv))
+            return Compression::Gzip;
+        else if (0 == start.compare(0, 4, "\x28\xb5\x2f\xfd"sv))
+            return Compression::Zstd;
+        else if (start.size() >= 10 && 0 == start.compare(0, 3, "BZh"sv) && start[3] >= '1' && start[3] <= '9'
+                && (0 == start.compare(4, 6, "\x31\x41\x59\x26\x53\x59"sv) || 0 == start.compare(4, 6, "\x17\x72\x45\x38\x50\x90"sv)))
+            // "BZh" could start a CSV file, so we also check for the block or
+            // end of stream magic number
+            return Compression::Bzip2;
+        else
+            return Compression::None;
+    }
+
+    template <typename Source_>
+    auto decompress(Compression compression, const Source_ & source, const string & filename) -> string
+    {
+        try {
+            filtering_istream in;
+            switch (compression) {
+                case Compression::Gzip:  in.push(gzip_decompressor{ });  break;
+                case Compression::Bzip2: in.push(bzip2_decompressor{ }); break;
+                case Compression::Zstd:  in.push(zstd_decompressor{ });  break;
+                case Compression::None:  break;
+            }
+            in.push(source);
+            in.exceptions(std::ios::badbit);
+
+            string result;
+            char data[read_block_size];
+            while (true) {
+                in.read(data, sizeof(data));
+                if (0 == in.gcount())
+                    break;
+                result.append(data, in.gcount());
+            }
+            return result;
+        }
+        catch (const exception &) {
+            throw GraphFileError{ filename, "error decompressing file", true };
+        }
+    }
+
+    /* Blocks of a file that can't be mapped, such as a pipe, read by a
+     * separate thread so that decompression can proceed as data arrives. */
+    struct BlockQueue
+    {
+        mutex lock;
+        condition_variable changed;
+        deque<string> blocks;
+        bool finished = false, failed = false, abandoned = false;
+
+        // the block currently being consumed
+        string block;
+        std::size_t block_pos = 0;
+
+        auto read_from(int fd) -> void
+        {
+            while (true) {
+                string data(read_block_size, '\0');
+                auto n = ::read(fd, data.data(), data.size());
+                if (n < 0 && EINTR == errno)
+                    continue;
+
+                unique_lock<mutex> guard{ lock };
+                if (n <= 0) {
+                    finished = true;
+                    failed = n < 0;
+                    changed.notify_all();
+                    return;
+                }
+
+                // don't let the reader get too far ahead
+                changed.wait(guard, [&] { return abandoned || blocks.size() < 64; });
+                if (abandoned)
+                    return;
+
+                data.resize(n);
+                blocks.push_back(move(data));
+                changed.notify_all();
+            }
+        }
+
+        auto abandon() -> void
+        {
+            unique_lock<mutex> guard{ lock };
+            abandoned = true;
+            changed.notify_all();
+        }
+
+        // wait until we can see at least size bytes, or the end of the file
+        auto peek(std::size_t size) -> string
+        {
+            unique_lock<mutex> guard{ lock };
+            string result;
+            changed.wait(guard, [&] {
+                    result.clear();
+                    for (auto & b : blocks) {
+                        result.append(b);
+                        if (result.size() >= size)
+                            break;
+                    }
+                    return finished || result.size() >= size;
+                    });
+            return result;
+        }
+
+        auto read(char * s, streamsize n) -> streamsize
+        {
+            if (block_pos == block.size()) {
+                unique_lock<mutex> guard{ lock };
+                changed.wait(guard, [&] { return finished || ! blocks.empty(); });
+                if (blocks.empty())
+                    return -1;
+                block = move(blocks.front());
+                block_pos = 0;
+                blocks.pop_front();
+                changed.notify_all();
+            }
+
+            auto result = min<streamsize>(n, block.size() - block_pos);
+            block.copy(s, result, block_pos);
+            block_pos += result;
+            return result;
+        }
+    };
+
+    struct BlockQueueSource
+    {
+        using char_type = char;
+        using category = boost::iostreams::source_tag;
+
+        BlockQueue * queue;
+
+        auto read(char * s, streamsize n) -> streamsize
+        {
+            return queue->read(s, n);
+        }
+    };
+}
+
+struct GraphFileContents::Imp
+{
+    void * mapping = MAP_FAILED;
+    size_t mapping_size = 0;
+    string buffer;
+    string_view text;
+};
+
+GraphFileContents::GraphFileContents(const string & filename) :
+    _imp(new Imp{ })
+{
+    int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (-1 == fd)
+        throw GraphFileError{ filename, "unable to open file", false };
+
+    struct stat file_stat;
+    if (0 == ::fstat(fd, &file_stat) && S_ISREG(file_stat.st_mode) && file_stat.st_size > 0) {
+        _imp->mapping_size = file_stat.st_size;
+        _imp->mapping = ::mmap(nullptr, _imp->mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+
+    if (MAP_FAILED != _imp->mapping) {
+        ::madvise(_imp->mapping, _imp->mapping_size, MADV_SEQUENTIAL);
+        _imp->text = string_view{ static_cast<const char *>(_imp->mapping), _imp->mapping_size };
+
+        // readahead on the mapping keeps the disk busy while we decompress
+        auto compression = detect_compression(_imp->text.substr(0, compression_magic_size));
+        if (Compression::None != compression) {
+            try {
+                _imp->buffer = decompress(compression, array_source{ _imp->text.data(), _imp->text.size() }, filename);
+            }
+            catch (...) {
+                ::munmap(_imp->mapping, _imp->mapping_size);
+                _imp->mapping = MAP_FAILED;
+                ::close(fd);
+                throw;
+            }
+            ::munmap(_imp->mapping, _imp->mapping_size);
+            _imp->mapping = MAP_FAILED;
+            _imp->text = _imp->buffer;
+        }
+    }
+    else {
+        // not something we can map, so fall back to reading it all in, on a
+        // separate thread in case we need to decompress it
+        BlockQueue queue;
+        thread reader{ [&] { queue.read_from(fd); } };
+
+        try {
+            auto compression = detect_compression(queue.peek(compression_magic_size));
+            if (Compression::None != compression)
+                _imp->buffer = decompress(compression, BlockQueueSource{ &queue }, filename);
+            else {
+                char data[read_block_size];
+                for (streamsize n ; (n = queue.read(data, sizeof(data))) > 0 ; )
+                    _imp->buffer.append(data, n);
+            }
+        }
+        catch (...) {
+            queue.abandon();
+            reader.join();
+            ::close(fd);
+            throw;
+        }
+
+        reader.join();
+        if (queue.failed) {
+            ::close(fd);
+            throw GraphFileError{ filename, "error reading file", true };
+        }
+        _imp->text = _imp->buffer;
+    }
+
+    ::close(fd);
+}
+
+GraphFileContents::~GraphFileContents()
+{
+    if (MAP_FAILED != _imp->mapping)
+        ::munmap(_imp->mapping, _imp->mapping_size);
+}
+
+auto GraphFileContents::text() const -> string_view
+{
+    return _imp->text;
+}
+
+auto split_at_lines(string_view text, unsigned n) -> vector<string_view>
+{
+    vector<string_view> result;
+    auto target_size = text.size() / n + 1;
+    while (! text.empty()) {
+        auto end = text.find('\n', min(target_size, text.size()) - 1);
+        end = (string_view::npos == end) ? text.size() : end + 1;
+        result.push_back(text.substr(0, end));
+        text.remove_prefix(end);
+    }
+    return result;
+}
+
+auto how_many_parse_chunks(string_view text) -> unsigned
+{
+    unsigned n_threads = how_many_threads(0);
+    if (1 == n_threads)
+        return 1;
+    return max<string_view::size_type>(1, min<string_view::size_type>(4 * n_threads, text.size() / minimum_parse_chunk_size));
+}
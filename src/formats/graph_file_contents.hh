@@ -0,0 +1,169 @@
+/* vim: set sw=4 sts=4 et foldmethod=syntax : */
+
+#ifndef GLASGOW_SUBGRAPH_SOLVER_SOLVER_FORMATS_GRAPH_FILE_CONTENTS_HH
+#define GLASGOW_SUBGRAPH_SOLVER_SOLVER_FORMATS_GRAPH_FILE_CONTENTS_HH 1
+
+#include <charconv>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+/**
+ * The entire contents of a graph file. Regular files are memory mapped, so
+ * readers can parse directly from the mapping rather than copying; anything
+ * else, such as a pipe, is read into memory.
+ */
+class GraphFileContents
+{
+    private:
+        struct Imp;
+        std::unique_ptr<Imp> _imp;
+
+    public:
+        /**
+         * \throw GraphFileError
+         */
+        explicit GraphFileContents(const std::string & filename);
+        ~GraphFileContents();
+
+        GraphFileContents(const GraphFileContents &) = delete;
+        GraphFileContents & operator= (const GraphFileContents &) = delete;
+
+        auto text() const -> std::string_view;
+};
+
+/**
+ * Split text into about n pieces, each ending just after a newline (apart from
+ * perhaps the last), so that lines can be parsed in parallel.
+ */
+auto split_at_lines(std::string_view text, unsigned n) -> std::vector<std::string_view>;
+
+/**
+ * How many pieces is it worth splitting text into, for parsing in parallel?
+ * Small files and single core machines get just one.
+ */
+auto how_many_parse_chunks(std::string_view text) -> unsigned;
+
+/**
+ * Is this whitespace, in the sense used by operator>> and by \s in a regex?
+ */
+inline auto is_graph_file_space(char c) -> bool
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+/**
+ * Tokenises some text from a graph file, without copying.
+ */
+class GraphFileScanner
+{
+    private:
+        const char * _pos;
+        const char * _end;
+
+    public:
+        explicit GraphFileScanner(std::string_view text) :
+            _pos(text.data()),
+            _end(text.data() + text.size())
+        {
+        }
+
+        auto at_end() const -> bool
+        {
+            return _pos == _end;
+        }
+
+        /**
+         * Returns true if any whitespace was skipped.
+         */
+        auto skip_whitespace() -> bool
+        {
+            auto start = _pos;
+            while (_pos != _end && is_graph_file_space(*_pos))
+                ++_pos;
+            return _pos != start;
+        }
+
+        /**
+         * If the text continues with s, skip past it and return true.
+         */
+        auto skip_literal(std::string_view s) -> bool
+        {
+            if (std::string_view::size_type(_end - _pos) < s.size() || std::string_view{ _pos, s.size() } != s)
+                return false;
+            _pos += s.size();
+            return true;
+        }
+
+        /**
+         * Consume any decimal digits, without skipping whitespace first.
+         */
+        auto digits() -> std::string_view
+        {
+            auto start = _pos;
+            while (_pos != _end && *_pos >= '0' && *_pos <= '9')
+                ++_pos;
+            return std::string_view{ start, std::string_view::size_type(_pos - start) };
+        }
+
+        /**
+         * Skip whitespace, and then read an optionally signed integer.
+         * Returns false if there isn't one, or if it does not fit.
+         */
+        auto next_int(int & result) -> bool
+        {
+            skip_whitespace();
+            auto first = _pos;
+            if (first != _end && *first == '+' && first + 1 != _end && *(first + 1) != '-')
+                ++first;
+            auto [ last, error ] = std::from_chars(first, _end, result);
+            if (error != std::errc{ })
+                return false;
+            _pos = last;
+            return true;
+        }
+
+        /**
+         * Skip whitespace, and then return the next run of non-whitespace,
+         * which is empty only at the end of the text.
+         */
+        auto next_word() -> std::string_view
+        {
+            skip_whitespace();
+            auto start = _pos;
+            while (_pos != _end && ! is_graph_file_space(*_pos))
+                ++_pos;
+            return std::string_view{ start, std::string_view::size_type(_pos - start) };
+        }
+
+        /**
+         * Read up to and past the next newline, like std::getline.
+         */
+        auto next_line(std::string_view & line) -> bool
+        {
+            if (_pos == _end)
+                return false;
+
+            auto start = _pos;
+            while (_pos != _end && *_pos != '\n')
+                ++_pos;
+            line = std::string_view{ start, std::string_view::size_type(_pos - start) };
+            if (_pos != _end)
+                ++_pos;
+            return true;
+        }
+};
+
+/**
+ * Convert a string of decimal digits to an int, returning false if it is
+ * empty or does not fit.
+ */
+inline auto parse_graph_file_int(std::string_view digits, int & result) -> bool
+{
+    auto [ last, error ] = std::from_chars(digits.data(), digits.data() + digits.size(), result);
+    return error == std::errc{ } && last == digits.data() + digits.size();
+}
+
+#endif
@@ -4,9 +4,11 @@
 #include "formats/graph_file_error.hh"
 
 #include <algorithm>
+#include <atomic>
 #include <cctype>
 #include <cstdint>
-#include <limits>
+#include <map>
+#include <mutex>
 #include <string>
 #include <type_traits>
 #include <vector>
@@ -14,25 +16,29 @@
 #include <boost/bimap.hpp>
 #include <boost/bimap/unordered_set_of.hpp>
 
+using std::atomic;
 using std::back_inserter;
 using std::count_if;
-using std::distance;
 using std::find;
 using std::function;
 using std::isgraph;
-using std::numeric_limits;
+using std::less;
+using std::lower_bound;
 using std::make_optional;
-using std::make_pair;
 using std::map;
 using std::max;
 using std::move;
+using std::mutex;
 using std::nullopt;
 using std::optional;
 using std::pair;
+using std::prev;
+using std::stable_sort;
 using std::string;
 using std::string_view;
 using std::to_string;
 using std::transform;
+using std::unique_lock;
 using std::vector;
 
 using Names = boost::bimaps::bimap<boost::bimaps::unordered_set_of<int>, boost::bimaps::unordered_set_of<string> >;
@@ -49,14 +55,124 @@ namespace
     }
 }
 
+namespace
+{
+    struct PendingEdge
+    {
+        int from, to;
+        unsigned label;
+        bool replaces_label;
+    };
+}
+
 struct InputGraph::Imp
 {
     int size = 0;
     bool has_vertex_labels, has_edge_labels;
-    map<pair<int, int>, string> edges;
     vector<string> vertex_labels;
     Names vertex_names;
     bool loopy = false, directed = false;
+
+    // edge labels are interned, and label 0 is the empty label
+    vector<string> edge_label_names{ 1 };
+    map<string, unsigned, less<> > edge_label_ids;
+
+    // new edges go on a list, which is folded into the sorted adjacency
+    // rows the next time we are queried
+    mutable vector<PendingEdge> pending_edges;
+    mutable mutex build_mutex;
+    mutable atomic<bool> built{ true };
+    mutable vector<std::size_t> row_starts{ 0 };
+    mutable vector<int> neighbours;
+    mutable vector<unsigned> neighbour_labels;
+
+    auto intern_edge_label(string_view label) -> unsigned
+    {
+        if (label.empty())
+            return 0;
+        auto i = edge_label_ids.find(label);
+        if (i != edge_label_ids.end())
+            return i->second;
+        edge_label_names.emplace_back(label);
+        return edge_label_ids.emplace(label, edge_label_names.size() - 1).first->second;
+    }
+
+    auto add(int a, int b, unsigned label, bool replaces_label) -> void
+    {
+        pending_edges.push_back(PendingEdge{ a, b, label, replaces_label });
+        built.store(false, std::memory_order_relaxed);
+    }
+
+    auto build() const -> void
+    {
+        if (built.load(std::memory_order_acquire))
+            return;
+
+        unique_lock<mutex> lock{ build_mutex };
+        if (built.load(std::memory_order_relaxed))
+            return;
+
+        int old_rows = row_starts.size() - 1, rows = max(size, old_rows);
+        for (auto & e : pending_edges)
+            rows = max(rows, max(e.from, e.to) + 1);
+
+        // bucket everything by source vertex, existing edges first and then
+        // new edges in the order they were added
+        vector<std::size_t> starts(rows + 1, 0);
+        for (int a = 0 ; a < old_rows ; ++a)
+            starts[a + 1] += row_starts[a + 1] - row_starts[a];
+        for (auto & e : pending_edges)
+            ++starts[e.from + 1];
+        for (int a = 0 ; a < rows ; ++a)
+            starts[a + 1] += starts[a];
+
+        vector<PendingEdge> bucketed(starts[rows]);
+        vector<std::size_t> next(starts.begin(), starts.end() - 1);
+        for (int a = 0 ; a < old_rows ; ++a)
+            for (auto i = row_starts[a] ; i != row_starts[a + 1] ; ++i)
+                bucketed[next[a]++] = PendingEdge{ a, neighbours[i], neighbour_labels[i], false };
+        for (auto & e : pending_edges)
+            bucketed[next[e.from]++] = e;
+
+        // now sort each row, and merge duplicates: a directed edge replaces
+        // any earlier label, but an undirected edge does not
+        row_starts.assign(rows + 1, 0);
+        neighbours.clear();
+        neighbour_labels.clear();
+        neighbours.reserve(bucketed.size());
+        neighbour_labels.reserve(bucketed.size());
+        for (int a = 0 ; a < rows ; ++a) {
+            auto first = bucketed.begin() + starts[a], last = bucketed.begin() + starts[a + 1];
+            stable_sort(first, last, [] (const PendingEdge & x, const PendingEdge & y) { return x.to < y.to; });
+            for (auto e = first ; e != last ; ++e) {
+                if (e != first && prev(e)->to == e->to) {
+                    if (e->replaces_label)
+                        neighbour_labels.back() = e->label;
+                }
+                else {
+                    neighbours.push_back(e->to);
+                    neighbour_labels.push_back(e->label);
+                }
+            }
+            row_starts[a + 1] = neighbours.size();
+        }
+
+        pending_edges.clear();
+        pending_edges.shrink_to_fit();
+        built.store(true, std::memory_order_release);
+    }
+
+    auto find_edge(int a, int b) const -> optional<std::size_t>
+    {
+        build();
+        if (a < 0 || std::size_t(a) + 1 >= row_starts.size())
+            return nullopt;
+        auto first = neighbours.begin() + row_starts[a], last = neighbours.begin() + row_starts[a + 1];
+        auto e = lower_bound(first, last, b);
+        if (e == last || *e != b)
+            return nullopt;
+        return e - neighbours.begin();
+    }
 };
 
 InputGraph::InputGraph(int size, bool v, bool e) :
@@ -79,12 +195,13 @@ auto InputGraph::resize(int size) -> void
 {
     _imp->size = size;
     _imp->vertex_labels.resize(size);
+    _imp->built.store(false, std::memory_order_relaxed);
 }
 
 auto InputGraph::add_edge(int a, int b) -> void
 {
-    _imp->edges.emplace(make_pair(a, b), "");
-    _imp->edges.emplace(make_pair(b, a), "");
+    _imp->add(a, b, 0, false);
+    _imp->add(b, a, 0, false);
     if (a == b)
         _imp->loopy = true;
 }
@@ -95,14 +212,38 @@ auto InputGraph::add_directed_edge(int a, int b, string_view label) -> void
 
     _imp->directed = true;
 
-    _imp->edges.emplace(make_pair(a, b), label).first->second = label;
+    _imp->add(a, b, _imp->intern_edge_label(label), true);
     if (a == b)
         _imp->loopy = true;
 }
 
+auto InputGraph::set_adjacency_rows(vector<std::size_t> && row_starts, vector<int> && neighbours,
+        vector<unsigned> && labels, vector<string> && edge_label_names, bool directed) -> void
+{
+    for (auto & l : edge_label_names)
+        sanity_check_name(l, "edge label");
+
+    _imp->edge_label_names = move(edge_label_names);
+    _imp->edge_label_ids.clear();
+    for (unsigned l = 1 ; l < _imp->edge_label_names.size() ; ++l)
+        _imp->edge_label_ids.emplace(_imp->edge_label_names[l], l);
+
+    _imp->row_starts = move(row_starts);
+    _imp->neighbours = move(neighbours);
+    _imp->neighbour_labels = move(labels);
+    _imp->pending_edges.clear();
+    _imp->built.store(true, std::memory_order_release);
+
+    _imp->directed = directed;
+    _imp->loopy = false;
+    for (int a = 0 ; std::size_t(a) + 1 < _imp->row_starts.size() ; ++a)
+        if (_imp->find_edge(a, a))
+            _imp->loopy = true;
+}
+
 auto InputGraph::adjacent(int a, int b) const -> bool
 {
-    return _imp->edges.count({ a, b });
+    return _imp->find_edge(a, b).has_value();
 }
 
 auto InputGraph::size() const -> int
@@ -112,7 +253,8 @@ auto InputGraph::size() const -> int
 
 auto InputGraph::number_of_directed_edges() const -> int
 {
-    return _imp->edges.size();
+    _imp->build();
+    return _imp->neighbours.size();
 }
 
 auto InputGraph::loopy() const -> bool
@@ -122,9 +264,10 @@ auto InputGraph::loopy() const -> bool
 
 auto InputGraph::degree(int a) const -> int
 {
-    auto lower = _imp->edges.lower_bound({ a, 0 });
-    auto upper = _imp->edges.upper_bound({ a, numeric_limits<int>::max() });
-    return distance(lower, upper);
+    _imp->build();
+    if (a < 0 || std::size_t(a) + 1 >= _imp->row_starts.size())
+        return 0;
+    return _imp->row_starts[a + 1] - _imp->row_starts[a];
 }
 
 auto InputGraph::set_vertex_label(int v, string_view l) -> void
@@ -164,7 +307,8 @@ auto InputGraph::vertex_from_name(string_view n) const -> optional<int>
 
 auto InputGraph::edge_label(int a, int b) const -> string_view
 {
-    return _imp->edges.find({a, b})->second;
+    auto e = _imp->find_edge(a, b);
+    return e ? string_view{ _imp->edge_label_names[_imp->neighbour_labels[*e]] } : string_view{ };
 }
 
 auto InputGraph::has_vertex_labels() const -> bool
@@ -184,7 +328,9 @@ auto InputGraph::directed() const -> bool
 
 auto InputGraph::for_each_edge(const function<auto (int, int, std::string_view) -> void> & c) const -> void
 {
-    for (auto & [ e, l ] : _imp->edges)
-        c(e.first, e.second, l);
+    _imp->build();
+    for (int a = 0 ; std::size_t(a) + 1 < _imp->row_starts.size() ; ++a)
+        for (auto i = _imp->row_starts[a] ; i != _imp->row_starts[a + 1] ; ++i)
+            c(a, _imp->neighbours[i], _imp->edge_label_names[_imp->neighbour_labels[i]]);
 }
 
@@ -8,11 +8,13 @@
 #include <optional>
 #include <string>
 #include <string_view>
+#include <vector>
 
 /**
- * A graph, in a convenient format for reading in from files. We don't do any
- * performance critical operations on this: the algorithms re-encode as
- * necessary.
+ * A graph, in a convenient format for reading in from files. The algorithms
+ * re-encode as necessary, but building their encodings queries this a lot, so
+ * edges are stored as sorted adjacency rows with interned labels. These are
+ * built lazily, the first time the graph is queried after being modified.
  *
  * Indices start at 0.
  */
@@ -64,6 +66,15 @@ class InputGraph
          */
         auto add_directed_edge(int a, int b, std::string_view label) -> void;
 
+        /**
+         * Replace every edge at once, using sorted adjacency rows. There are
+         * size() + 1 row_starts, each row is sorted with no repeats, and
+         * labels index edge_label_names, whose first entry must be empty.
+         * This is for loaders that already have their edges in this form.
+         */
+        auto set_adjacency_rows(std::vector<std::size_t> && row_starts, std::vector<int> && neighbours,
+                std::vector<unsigned> && labels, std::vector<std::string> && edge_label_names, bool directed) -> void;
+
         /**
          * Are vertices a and b adjacent?
          */
@@ -2,60 +2,56 @@
 
 #include "formats/lad.hh"
 #include "formats/input_graph.hh"
+#include "formats/graph_file_contents.hh"
 
-#include <fstream>
-#include <map>
+#include <string>
+#include <string_view>
 
-using std::ifstream;
-using std::map;
-using std::pair;
 using std::string;
+using std::string_view;
 using std::to_string;
 
 namespace
 {
-    auto read_word(ifstream & infile) -> int
-    {
-        int x;
-        infile >> x;
-        return x;
-    }
-
-    auto read_any_lad(ifstream && infile, const string & filename,
+    auto read_any_lad(string_view text, const string & filename,
             bool directed,
             bool vertex_labels,
             bool edge_labels) -> InputGraph
     {
         InputGraph result{ 0, vertex_labels, edge_labels };
+        GraphFileScanner scanner{ text };
 
-        result.resize(read_word(infile));
-        if (! infile)
+        int size;
+        if (! scanner.next_int(size) || size < 0)
             throw GraphFileError{ filename, "error reading size", true };
+        result.resize(size);
 
         for (int r = 0 ; r < result.size() ; ++r) {
             result.set_vertex_name(r, to_string(r));
 
             if (vertex_labels) {
-                int l = read_word(infile);
-                if (! infile)
+                int l;
+                if (! scanner.next_int(l))
                     throw GraphFileError{ filename, "error reading label", true };
 
                 result.set_vertex_label(r, to_string(l));
             }
 
-            int c_end = read_word(infile);
-            if (! infile)
+            int c_end;
+            if (! scanner.next_int(c_end))
                 throw GraphFileError{ filename, "error reading edges count", true };
 
             for (int c = 0 ; c < c_end ; ++c) {
-                int e = read_word(infile);
+                int e;
+                if (! scanner.next_int(e))
+                    throw GraphFileError{ filename, "error reading edge", true };
 
                 if (e < 0 || e >= result.size())
                     throw GraphFileError{ filename, "edge index out of bounds", true };
 
                 if (edge_labels) {
-                    int l = read_word(infile);
-                    if (l < 0)
+                    int l;
+                    if (! scanner.next_int(l) || l < 0)
                         throw GraphFileError{ filename, "edge label invalid", true };
 
                     result.add_directed_edge(r, e, to_string(l));
@@ -67,33 +63,31 @@ namespace
             }
         }
 
-        string rest;
-        if (infile >> rest)
-            throw GraphFileError{ filename, "EOF not reached, next text is \"" + rest + "\"", true };
-        if (! infile.eof())
-            throw GraphFileError{ filename, "EOF not reached", true };
+        auto rest = scanner.next_word();
+        if (! rest.empty())
+            throw GraphFileError{ filename, "EOF not reached, next text is \"" + string{ rest } + "\"", true };
 
         return result;
     }
 }
 
-auto read_lad(ifstream && infile, const string & filename) -> InputGraph
+auto read_lad(string_view text, const string & filename) -> InputGraph
 {
-    return read_any_lad(move(infile), filename, false, false, false);
+    return read_any_lad(text, filename, false, false, false);
 }
 
-auto read_directed_lad(ifstream && infile, const string & filename) -> InputGraph
+auto read_directed_lad(string_view text, const string & filename) -> InputGraph
 {
-    return read_any_lad(move(infile), filename, true, false, false);
+    return read_any_lad(text, filename, true, false, false);
 }
 
-auto read_labelled_lad(ifstream && infile, const string & filename) -> InputGraph
+auto read_labelled_lad(string_view text, const string & filename) -> InputGraph
 {
-    return read_any_lad(move(infile), filename, true, true, true);
+    return read_any_lad(text, filename, true, true, true);
 }
 
-auto read_vertex_labelled_lad(ifstream && infile, const string & filename) -> InputGraph
+auto read_vertex_labelled_lad(string_view text, const string & filename) -> InputGraph
 {
-    return read_any_lad(move(infile), filename, false, true, false);
+    return read_any_lad(text, filename, false, true, false);
 }
 
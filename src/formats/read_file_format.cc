@@ -1,77 +1,101 @@
 /* vim: set sw=4 sts=4 et foldmethod=syntax : */
 
 #include "formats/read_file_format.hh"
+#include "formats/binary.hh"
 #include "formats/dimacs.hh"
 #include "formats/lad.hh"
 #include "formats/csv.hh"
 #include "formats/vfmcs.hh"
+#include "formats/graph_file_contents.hh"
 
-#include <fstream>
-#include <regex>
-#include <sstream>
+#include <algorithm>
+#include <string_view>
 #include <vector>
 
-using std::ifstream;
-using std::ios;
-using std::move;
-using std::regex;
-using std::smatch;
-using std::stoi;
+using std::any_of;
 using std::string;
-using std::stringstream;
+using std::string_view;
 using std::to_string;
 using std::vector;
 
-auto detect_format(ifstream & infile, const string & filename) -> string
+namespace
 {
-    string line;
-    if (! getline(infile, line) || line.empty())
+    auto is_lad_header(string_view line) -> bool
+    {
+        // \d+
+        GraphFileScanner scanner{ line };
+        return ! scanner.digits().empty() && scanner.at_end();
+    }
+
+    auto is_lad_line(string_view line) -> bool
+    {
+        // \d+\s+(\d+\s+)*\d+\s*, that is, at least two numbers
+        GraphFileScanner scanner{ line };
+        unsigned numbers = 0;
+        while (! scanner.digits().empty()) {
+            ++numbers;
+            if (! scanner.skip_whitespace())
+                break;
+        }
+        return numbers >= 2 && scanner.at_end();
+    }
+
+    auto is_csv_line(string_view line) -> bool
+    {
+        // \S+[,>]\S+
+        if (any_of(line.begin(), line.end(), is_graph_file_space))
+            return false;
+        auto pos = line.find_first_of(",>", 1);
+        return string_view::npos != pos && pos + 1 < line.size();
+    }
+}
+
+auto detect_file_format(string_view text, const string & filename) -> string
+{
+    if (is_binary_graph(text))
+        return "binary";
+
+    GraphFileScanner scanner{ text };
+
+    string_view line;
+    if (! scanner.next_line(line) || line.empty())
         throw GraphFileError{ filename, "unable to read file to detect file format", true };
 
-    static const regex
-        dimacs_comment{ R"(c(\s.*)?)" },
-        dimacs_problem{ R"(p\s+(edge|col)\s+(\d+)\s+(\d+)?\s*)" },
-        lad_header{ R"(\d+)" },
-        lad_zero_labelled_line{ R"(0 \d+)" },
-        lad_zero_unlabelled_line{ R"(0)" },
-        lad_line{ R"(\d+\s+(\d+\s+)*\d+\s*)" },
-        csv_problem{ R"(\S+[,>]\S+)" };
-
-    smatch match;
-    if (regex_match(line, match, dimacs_comment)) {
-        while (regex_match(line, match, dimacs_comment)) {
+    string_view size;
+    if (is_dimacs_comment_line(line)) {
+        while (is_dimacs_comment_line(line)) {
             // looks like a DIMACS comment, ignore
-            if (! getline(infile, line) || line.empty())
+            if (! scanner.next_line(line) || line.empty())
                 throw GraphFileError{ filename, "unable to auto-detect file format (entirely c lines?)", true };
         }
-        if (! regex_match(line, match, dimacs_problem))
+        if (! is_dimacs_problem_line(line, size))
             throw GraphFileError{ filename, "unable to auto-detect file format (c line not followed by a p line?)", true };
         return "dimacs";
     }
-    else if (regex_match(line, match, dimacs_problem))
+    else if (is_dimacs_problem_line(line, size))
         return "dimacs";
-    else if (regex_match(line, match, lad_header)) {
+    else if (is_lad_header(line)) {
         if ("0" == line)
             return "lad";
 
         // got to figure out whether we're labelled or not
-        if (! getline(infile, line) || line.empty())
+        if (! scanner.next_line(line) || line.empty())
             throw GraphFileError{ filename, "unable to auto-detect file format (number followed by nothing)", true };
-        if (regex_match(line, match, lad_zero_labelled_line))
+        if (line.size() > 2 && 0 == line.compare(0, 2, "0 ") && is_lad_header(line.substr(2)))
             return "labelledlad";
-        else if (regex_match(line, match, lad_zero_unlabelled_line))
+        else if ("0" == line)
             return "lad";
-        else if (regex_match(line, match, lad_line)) {
-            stringstream line_stream{ line };
-            vector<string> words;
-            string word;
-            while (line_stream >> word)
-                words.emplace_back(word);
+        else if (is_lad_line(line)) {
+            GraphFileScanner line_scanner{ line };
+            vector<string_view> words;
+            for (auto word = line_scanner.next_word() ; ! word.empty() ; word = line_scanner.next_word())
+                words.push_back(word);
 
-            if (words.size() < 2)
-                throw GraphFileError{ filename, "unable to auto-detect file format (not enough words in a lad line)", true };
+            int first_word, second_word;
+            if (! parse_graph_file_int(words.at(0), first_word) || ! parse_graph_file_int(words.at(1), second_word))
+                throw GraphFileError{ filename, "unable to auto-detect file format (number too large in a lad line)", true };
 
-            unsigned items_if_lad = stoi(words.at(0)), items_if_labelledlad = stoi(words.at(1));
+            unsigned items_if_lad = first_word, items_if_labelledlad = second_word;
             if (words.size() == items_if_lad + 1 && ! (words.size() == (2 * items_if_labelledlad) + 2))
                 return "lad";
             else if (! (words.size() == items_if_lad + 1) && (words.size() == (2 * items_if_labelledlad) + 2))
@@ -86,7 +110,7 @@ auto detect_format(ifstream & infile, const string & filename) -> string
         else
             throw GraphFileError{ filename, "unable to auto-detect file format (looks like lad, but no edge line found)", true };
     }
-    else if (regex_match(line, match, csv_problem))
+    else if (is_csv_line(line))
         return "csv";
 
     throw GraphFileError{ filename, "unable to auto-detect file format (no recognisable header found)", true };
@@ -94,39 +118,35 @@ auto detect_format(ifstream & infile, const string & filename) -> string
 
 auto read_file_format(const string & format, const string & filename) -> InputGraph
 {
-    ifstream infile{ filename };
-    if (! infile)
-        throw GraphFileError{ filename, "unable to open file", false };
+    GraphFileContents contents{ filename };
+    auto text = contents.text();
 
     auto actual_format = format;
-    if (actual_format == "auto") {
-        actual_format = detect_format(infile, filename);
-        infile.clear();
-        if (! infile.seekg(0, ios::beg))
-            throw GraphFileError{ filename, "unable to seek on input file (try specifying file format explicitly)", true };
-    }
+    if (actual_format == "auto")
+        actual_format = detect_file_format(text, filename);
 
     if (actual_format == "dimacs")
-        return read_dimacs(move(infile), filename);
+        return read_dimacs(text, filename);
     else if (actual_format == "lad")
-        return read_lad(move(infile), filename);
+        return read_lad(text, filename);
     else if (actual_format == "directedlad")
-        return read_directed_lad(move(infile), filename);
+        return read_directed_lad(text, filename);
     else if (actual_format == "labelledlad")
-        return read_labelled_lad(move(infile), filename);
+        return read_labelled_lad(text, filename);
     else if (actual_format == "vertexlabelledlad")
-        return read_vertex_labelled_lad(move(infile), filename);
+        return read_vertex_labelled_lad(text, filename);
     else if (actual_format == "csv")
-        return read_csv(move(infile), filename);
+        return read_csv(text, filename);
+    else if (actual_format == "binary")
+        return read_binary(text, filename);
     else if (actual_format == "vfmcs")
-        return read_unlabelled_undirected_vfmcs(move(infile), filename);
+        return read_unlabelled_undirected_vfmcs(text, filename);
     else if (actual_format == "vfmcsv")
-        return read_vertex_labelled_undirected_vfmcs(move(infile), filename);
+        return read_vertex_labelled_undirected_vfmcs(text, filename);
     else if (actual_format == "vfmcsvd")
-        return read_vertex_labelled_directed_vfmcs(move(infile), filename);
+        return read_vertex_labelled_directed_vfmcs(text, filename);
     else if (0 == actual_format.compare(0, 8, "csvname:"))
-        return read_csv_name(move(infile), filename, actual_format.substr(8));
+        return read_csv_name(text, filename, actual_format.substr(8));
     else
         throw GraphFileError{ filename, "Unknown file format '" + format + "'", true };
 }
-
@@ -7,13 +7,14 @@
 #include "formats/graph_file_error.hh"
 
 #include <string>
+#include <string_view>
 
 /**
  * Detect a graph file format.
  *
  * \throw GraphFileError
  */
-auto detect_file_format(std::ifstream & infile, const std::string & filename) -> std::string;
+auto detect_file_format(std::string_view text, const std::string & filename) -> std::string;
 
 /**
  * Read in a file in the specified format ("auto" to try to auto-detect).
@@ -3,28 +3,41 @@
 #include "vfmcs.hh"
 #include "formats/graph_file_error.hh"
 
-#include <fstream>
 #include <string>
+#include <string_view>
 
-using std::ifstream;
-using std::move;
 using std::to_string;
 using std::string;
+using std::string_view;
 
 namespace
 {
-    auto read_word(ifstream & infile) -> unsigned
+    // Little endian 16 bit words, remembering if we ever ran off the end.
+    struct WordReader
     {
-        unsigned char a, b;
-        a = static_cast<unsigned char>(infile.get());
-        b = static_cast<unsigned char>(infile.get());
-        return unsigned(a) | (unsigned(b) << 8);
-    }
+        string_view text;
+        string_view::size_type pos = 0;
+        bool failed = false;
+
+        auto read_word() -> unsigned
+        {
+            if (text.size() - pos < 2) {
+                pos = text.size();
+                failed = true;
+                return 0xffff;
+            }
+
+            unsigned char a = text[pos], b = text[pos + 1];
+            pos += 2;
+            return unsigned(a) | (unsigned(b) << 8);
+        }
+    };
 
-    auto read_vfmcs(ifstream && infile, const string & filename, bool vertex_labels, bool directed) -> InputGraph
+    auto read_vfmcs(string_view text, const string & filename, bool vertex_labels, bool directed) -> InputGraph
     {
-        int size = read_word(infile);
-        if (! infile)
+        WordReader words{ text };
+        int size = words.read_word();
+        if (words.failed)
             throw GraphFileError{ filename, "error reading size", true };
 
         InputGraph result{ size, true, false };
@@ -39,21 +52,21 @@ namespace
         }
 
         for (int r = 0 ; r < result.size() ; ++r) {
-            unsigned l = read_word(infile) >> (16 - k1);
+            unsigned l = words.read_word() >> (16 - k1);
             if (vertex_labels)
                 result.set_vertex_label(r, to_string(l));
         }
 
-        if (! infile)
+        if (words.failed)
             throw GraphFileError{ filename, "error reading attributes", true };
 
         for (int r = 0 ; r < result.size() ; ++r) {
-            int c_end = read_word(infile);
-            if (! infile)
+            int c_end = words.read_word();
+            if (words.failed)
                 throw GraphFileError{ filename, "error reading edges count", true };
 
             for (int c = 0 ; c < c_end ; ++c) {
-                unsigned e = read_word(infile);
+                unsigned e = words.read_word();
 
                 if (e >= unsigned(result.size()))
                     throw GraphFileError{ filename, "edge index " + to_string(e) + " out of bounds", true };
@@ -62,30 +75,29 @@ namespace
                     result.add_directed_edge(r, e, "directed");
                 else
                     result.add_edge(r, e);
-                read_word(infile);
+                words.read_word();
             }
         }
 
-        infile.peek();
-        if (! infile.eof())
+        if (words.pos != text.size())
             throw GraphFileError{ filename, "EOF not reached", true };
 
         return result;
     }
 }
 
-auto read_unlabelled_undirected_vfmcs(ifstream && infile, const string & filename) -> InputGraph
+auto read_unlabelled_undirected_vfmcs(string_view text, const string & filename) -> InputGraph
 {
-    return read_vfmcs(move(infile), filename, false, false);
+    return read_vfmcs(text, filename, false, false);
 }
 
-auto read_vertex_labelled_undirected_vfmcs(ifstream && infile, const string & filename) -> InputGraph
+auto read_vertex_labelled_undirected_vfmcs(string_view text, const string & filename) -> InputGraph
 {
-    return read_vfmcs(move(infile), filename, true, false);
+    return read_vfmcs(text, filename, true, false);
 }
 
-auto read_vertex_labelled_directed_vfmcs(std::ifstream && infile, const std::string & filename) -> InputGraph
+auto read_vertex_labelled_directed_vfmcs(string_view text, const string & filename) -> InputGraph
 {
-    return read_vfmcs(move(infile), filename, true, true);
+    return read_vfmcs(text, filename, true, true);
 }
 
@@ -6,13 +6,13 @@
 #include "formats/input_graph.hh"
 #include "formats/graph_file_error.hh"
 
-#include <iosfwd>
 #include <string>
+#include <string_view>
 
-auto read_unlabelled_undirected_vfmcs(std::ifstream && infile, const std::string & filename) -> InputGraph;
+auto read_unlabelled_undirected_vfmcs(std::string_view text, const std::string & filename) -> InputGraph;
 
-auto read_vertex_labelled_undirected_vfmcs(std::ifstream && infile, const std::string & filename) -> InputGraph;
+auto read_vertex_labelled_undirected_vfmcs(std::string_view text, const std::string & filename) -> InputGraph;
 
-auto read_vertex_labelled_directed_vfmcs(std::ifstream && infile, const std::string & filename) -> InputGraph;
+auto read_vertex_labelled_directed_vfmcs(std::string_view text, const std::string & filename) -> InputGraph;
 
 #endif
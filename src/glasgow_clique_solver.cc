@@ -61,7 +61,7 @@ auto main(int argc, char * argv[]) -> int
         display_options.add_options()
             ("help",                                         "Display help information")
             ("timeout",            po::value<int>(),         "Abort after this many seconds")
-            ("format",             po::value<string>(),      "Specify input file format (auto, lad, labelledlad, dimacs)")
+            ("format",             po::value<string>(),      "Specify input file format (auto, lad, labelledlad, dimacs, binary)")
             ("decide",             po::value<int>(),         "Solve this decision problem");
 
         po::options_description configuration_options{ "Advanced configuration options" };
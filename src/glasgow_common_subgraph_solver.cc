@@ -58,7 +58,7 @@ auto main(int argc, char * argv[]) -> int
 
         po::options_description input_options{ "Input file options" };
         input_options.add_options()
-            ("format",             po::value<string>(),      "Specify input file format (auto, lad, vertexlabelledlad, labelledlad, dimacs)")
+            ("format",             po::value<string>(),      "Specify input file format (auto, lad, vertexlabelledlad, labelledlad, dimacs, binary)")
             ("first-format",       po::value<string>(),      "Specify input file format just for the first graph")
             ("second-format",      po::value<string>(),      "Specify input file format just for the second graph");
         display_options.add(input_options);
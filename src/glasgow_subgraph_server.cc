@@ -0,0 +1,760 @@
+/* vim: set sw=4 sts=4 et foldmethod=syntax : */
+
+#include "formats/read_file_format.hh"
+#include "configuration.hh"
+#include "homomorphism.hh"
+#include "prepared_target.hh"
+#include "restarts.hh"
+#include "thread_utils.hh"
+#include "verify.hh"
+
+#include <boost/program_options.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <ctime>
+#include <deque>
+#include <exception>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace po = boost::program_options;
+
+using std::atomic;
+using std::cerr;
+using std::condition_variable;
+using std::cout;
+using std::current_exception;
+using std::cv_status;
+using std::deque;
+using std::endl;
+using std::exception;
+using std::generic_category;
+using std::istringstream;
+using std::list;
+using std::localtime;
+using std::make_shared;
+using std::make_unique;
+using std::map;
+using std::move;
+using std::mutex;
+using std::optional;
+using std::ostream;
+using std::ostringstream;
+using std::promise;
+using std::put_time;
+using std::set;
+using std::shared_future;
+using std::shared_ptr;
+using std::string;
+using std::system_error;
+using std::thread;
+using std::unique_lock;
+using std::unique_ptr;
+using std::vector;
+
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+using std::chrono::operator""ms;
+using std::chrono::seconds;
+using std::chrono::steady_clock;
+using std::chrono::system_clock;
+
+namespace
+{
+    /**
+     * A preloaded target. Requests whose parameters need the target to be
+     * prepared differently get their own PreparedTarget, which is kept for
+     * later requests. Preparations are keyed by PreparedTarget::settings_key,
+     * and are added before they are built, so that requests with the same
+     * settings wait for one build rather than each starting their own.
+     */
+    struct ServedTarget
+    {
+        string filename;
+        InputGraph graph;
+
+        mutex prepared_mutex;
+        map<string, shared_future<shared_ptr<const PreparedTarget> > > prepared;
+
+        ServedTarget(const string & f, InputGraph && g) :
+            filename(f),
+            graph(move(g))
+        {
+        }
+    };
+
+    struct Request
+    {
+        string pattern_file;
+        string pattern_format_name;
+        ServedTarget * target = nullptr;
+        HomomorphismParams params;
+        bool print_all_solutions = false;
+        steady_clock::time_point received_at;
+
+        // set if the client went away, or the server is stopping
+        atomic<bool> cancelled{ false };
+
+        mutex finished_mutex;
+        condition_variable finished_cv;
+        bool finished = false;
+        string response;
+    };
+
+    struct Server
+    {
+        vector<unique_ptr<ServedTarget> > targets;
+        string target_format_name;
+        optional<string> target_cache;
+
+        mutex queue_mutex;
+        condition_variable queue_cv;
+        deque<shared_ptr<Request> > queue;
+        set<shared_ptr<Request> > unfinished;
+        bool stopping = false;
+
+        mutex connections_mutex;
+        condition_variable connections_cv;
+        set<int> connections;
+    };
+
+    int stop_pipe_write_fd = -1;
+
+    auto stop_signal_handler(int) -> void
+    {
+        char c = 0;
+        if (-1 == ::write(stop_pipe_write_fd, &c, 1)) {
+            // nothing useful we can do from inside a signal handler
+        }
+    }
+
+    auto cancel(Request & request) -> void
+    {
+        request.cancelled.store(true);
+        request.params.timeout->trigger_early_abort();
+    }
+
+    auto request_options() -> po::options_description
+    {
+        po::options_description result{ "Request options" };
+        result.add_options()
+            ("timeout",              po::value<int>(),         "Abort after this many seconds, including time spent queued")
+            ("noninjective",                                   "Drop the injectivity requirement")
+            ("locally-injective",                              "Require only local injectivity")
+            ("count-solutions",                                "Count the number of solutions")
+            ("print-all-solutions",                            "Print out every solution, rather than one")
+            ("induced",                                        "Find an induced mapping")
+            ("format",               po::value<string>(),      "Specify input file format for the pattern graph")
+            ("restarts",             po::value<string>(),      "Specify restart policy (luby / geometric / timed / none)")
+            ("geometric-multiplier", po::value<double>(),      "Specify multiplier for geometric restarts")
+            ("geometric-constant",   po::value<double>(),      "Specify starting constant for geometric restarts")
+            ("restart-interval",     po::value<int>(),         "Specify the restart interval in milliseconds for timed restarts")
+            ("restart-minimum",      po::value<int>(),         "Specify a minimum number of backtracks before a timed restart can trigger")
+            ("luby-constant",        po::value<int>(),         "Specify the starting constant / multiplier for Luby restarts")
+            ("value-ordering",       po::value<string>(),      "Specify value-ordering heuristic (biased / degree / antidegree / random)")
+            ("threads",              po::value<unsigned>(),    "Use threaded search, with this many threads (0 to auto-detect)")
+            ("triggered-restarts",                             "Have one thread trigger restarts")
+            ("work-stealing",                                  "Have threads split up the search tree, rather than racing with restarts")
+            ("deterministic",                                  "Have threads split up the search tree in a fixed way, so results and node counts are repeatable")
+            ("no-clique-detection",                            "Disable clique / independent set detection")
+            ("no-supplementals",                               "Do not use supplemental graphs")
+            ("no-nds",                                         "Do not use neighbourhood degree sequences")
+            ("lazy-supplementals",                             "Build supplemental target graph rows only when search first needs them")
+            ("target-representation", po::value<string>(),    "Store the target as bitset rows or as neighbour lists (auto / dense / sparse)")
+            ("distance3",                                      "Use distance 3 filtering (experimental)")
+            ("k4",                                             "Use 4-clique filtering (experimental)")
+            ("n-exact-path-graphs",  po::value<int>(),         "Specify number of exact path graphs");
+        return result;
+    }
+
+    /**
+     * Parse one request line, which is written like a command line for
+     * glasgow_subgraph_solver, with the target file being optional if only
+     * one target is being served.
+     *
+     * \throw UnsupportedConfiguration
+     * \throw po::error
+     */
+    auto parse_request(Server & server, const string & line, Request & request) -> void
+    {
+        vector<string> words;
+        istringstream line_stream{ line };
+        for (string word ; line_stream >> word ; )
+            words.push_back(word);
+
+        po::options_description all_options{ "All options" };
+        all_options.add_options()
+            ("pattern-file", po::value<string>(), "specify the pattern file")
+            ("target-file",  po::value<string>(), "specify the target file")
+            ;
+        all_options.add(request_options());
+
+        po::positional_options_description positional_options;
+        positional_options
+            .add("pattern-file", 1)
+            .add("target-file", 1)
+            ;
+
+        po::variables_map options_vars;
+        po::store(po::command_line_parser(words)
+                .options(all_options)
+                .positional(positional_options)
+                .run(), options_vars);
+        po::notify(options_vars);
+
+        if (! options_vars.count("pattern-file"))
+            throw UnsupportedConfiguration{ "No pattern file specified" };
+        request.pattern_file = options_vars["pattern-file"].as<string>();
+        request.pattern_format_name = options_vars.count("format") ? options_vars["format"].as<string>() : "auto";
+
+        if (options_vars.count("target-file")) {
+            auto target_file = options_vars["target-file"].as<string>();
+            for (auto & t : server.targets)
+                if (t->filename == target_file)
+                    request.target = t.get();
+            if (! request.target)
+                throw UnsupportedConfiguration{ "Target '" + target_file + "' is not being served" };
+        }
+        else if (1 == server.targets.size())
+            request.target = server.targets.front().get();
+        else
+            throw UnsupportedConfiguration{ "No target file specified, and more than one target is being served" };
+
+        auto & params = request.params;
+
+        if (options_vars.count("noninjective") && options_vars.count("locally-injective"))
+            throw UnsupportedConfiguration{ "Cannot specify both --noninjective and --locally-injective" };
+        else if (options_vars.count("noninjective"))
+            params.injectivity = Injectivity::NonInjective;
+        else if (options_vars.count("locally-injective"))
+            params.injectivity = Injectivity::LocallyInjective;
+
+        params.induced = options_vars.count("induced");
+        params.count_solutions = options_vars.count("count-solutions") || options_vars.count("print-all-solutions");
+        request.print_all_solutions = options_vars.count("print-all-solutions");
+
+        params.triggered_restarts = options_vars.count("triggered-restarts");
+        params.work_stealing = options_vars.count("work-stealing");
+        params.deterministic = options_vars.count("deterministic");
+        if (options_vars.count("threads"))
+            params.n_threads = options_vars["threads"].as<unsigned>();
+
+        string restarts_policy = options_vars.count("restarts") ? options_vars["restarts"].as<string>() :
+            params.count_solutions || params.work_stealing || params.deterministic ? "none" : "luby";
+        if (restarts_policy == "luby") {
+            unsigned long long multiplier = LubyRestartsSchedule::default_multiplier;
+            if (options_vars.count("luby-constant"))
+                multiplier = options_vars["luby-constant"].as<int>();
+            params.restarts_schedule = make_unique<LubyRestartsSchedule>(multiplier);
+        }
+        else if (restarts_policy == "geometric") {
+            double geometric_constant = GeometricRestartsSchedule::default_initial_value;
+            double geometric_multiplier = GeometricRestartsSchedule::default_multiplier;
+            if (options_vars.count("geometric-constant"))
+                geometric_constant = options_vars["geometric-constant"].as<double>();
+            if (options_vars.count("geometric-multiplier"))
+                geometric_multiplier = options_vars["geometric-multiplier"].as<double>();
+            params.restarts_schedule = make_unique<GeometricRestartsSchedule>(geometric_constant, geometric_multiplier);
+        }
+        else if (restarts_policy == "timed") {
+            milliseconds duration = TimedRestartsSchedule::default_duration;
+            unsigned long long minimum_backtracks = TimedRestartsSchedule::default_minimum_backtracks;
+            if (options_vars.count("restart-interval"))
+                duration = milliseconds{ options_vars["restart-interval"].as<int>() };
+            if (options_vars.count("restart-minimum"))
+                minimum_backtracks = options_vars["restart-minimum"].as<int>();
+            params.restarts_schedule = make_unique<TimedRestartsSchedule>(duration, minimum_backtracks);
+        }
+        else if (restarts_policy == "none")
+            params.restarts_schedule = make_unique<NoRestartsSchedule>();
+        else
+            throw UnsupportedConfiguration{ "Unknown restarts policy '" + restarts_policy + "'" };
+
+        if (options_vars.count("value-ordering")) {
+            string value_ordering_heuristic = options_vars["value-ordering"].as<string>();
+            if (value_ordering_heuristic == "biased")
+                params.value_ordering_heuristic = ValueOrdering::Biased;
+            else if (value_ordering_heuristic == "degree")
+                params.value_ordering_heuristic = ValueOrdering::Degree;
+            else if (value_ordering_heuristic == "antidegree")
+                params.value_ordering_heuristic = ValueOrdering::AntiDegree;
+            else if (value_ordering_heuristic == "random")
+                params.value_ordering_heuristic = ValueOrdering::Random;
+            else
+                throw UnsupportedConfiguration{ "Unknown value-ordering heuristic '" + value_ordering_heuristic + "'" };
+        }
+
+        params.clique_detection = ! options_vars.count("no-clique-detection");
+        params.distance3 = options_vars.count("distance3");
+        params.k4 = options_vars.count("k4");
+        if (options_vars.count("n-exact-path-graphs"))
+            params.number_of_exact_path_graphs = options_vars["n-exact-path-graphs"].as<int>();
+        params.no_supplementals = options_vars.count("no-supplementals");
+        params.no_nds = options_vars.count("no-nds");
+        params.lazy_supplementals = options_vars.count("lazy-supplementals");
+
+        if (options_vars.count("target-representation")) {
+            string target_representation = options_vars["target-representation"].as<string>();
+            if (target_representation == "auto")
+                params.target_representation = TargetRepresentation::Auto;
+            else if (target_representation == "dense")
+                params.target_representation = TargetRepresentation::Dense;
+            else if (target_representation == "sparse")
+                params.target_representation = TargetRepresentation::Sparse;
+            else
+                throw UnsupportedConfiguration{ "Unknown target representation '" + target_representation + "'" };
+        }
+
+        params.timeout = make_shared<Timeout>(options_vars.count("timeout") ? seconds{ options_vars["timeout"].as<int>() } : seconds{ 0 });
+    }
+
+    /**
+     * Find a prepared target compatible with these parameters, preparing one
+     * if necessary. The second value is set if this call did the preparing.
+     * Preparation happens without holding the lock, so requests which can use
+     * an existing prepared target are not held up by one which can't.
+     */
+    auto prepared_target_for(Server & server, ServedTarget & target, const HomomorphismParams & params,
+            bool & was_prepared) -> const PreparedTarget &
+    {
+        auto key = PreparedTarget::settings_key(params);
+        promise<shared_ptr<const PreparedTarget> > preparing;
+        auto prepared = preparing.get_future().share();
+        {
+            unique_lock<mutex> guard{ target.prepared_mutex };
+            auto p = target.prepared.find(key);
+            if (p != target.prepared.end()) {
+                auto existing = p->second;
+                guard.unlock();
+                was_prepared = false;
+                return *existing.get();
+            }
+
+            target.prepared.emplace(key, prepared);
+        }
+
+        was_prepared = true;
+        try {
+            if (server.target_cache)
+                preparing.set_value(prepare_target_using_cache(*server.target_cache, target.filename,
+                            server.target_format_name, target.graph, params).first);
+            else
+                preparing.set_value(make_unique<PreparedTarget>(target.graph, params));
+        }
+        catch (...) {
+            // anyone already waiting gets the same error, and a later request
+            // can try again
+            {
+                unique_lock<mutex> guard{ target.prepared_mutex };
+                target.prepared.erase(key);
+            }
+            preparing.set_exception(current_exception());
+            throw;
+        }
+
+        return *prepared.get();
+    }
+
+    auto print_mapping(ostream & out, const InputGraph & pattern, const InputGraph & target,
+            const VertexToVertexMapping & mapping) -> void
+    {
+        out << "mapping = ";
+        for (auto v : mapping)
+            out << "(" << pattern.vertex_name(v.first) << " -> " << target.vertex_name(v.second) << ") ";
+        out << endl;
+    }
+
+    auto solve_request(Server & server, Request & request, ostream & out) -> void
+    {
+        auto & params = request.params;
+        auto & target = request.target->graph;
+
+        out << "pattern_file = " << request.pattern_file << endl;
+        out << "target_file = " << request.target->filename << endl;
+        out << "queue_time = " << duration_cast<milliseconds>(steady_clock::now() - request.received_at).count() << endl;
+
+        auto pattern = read_file_format(request.pattern_format_name, request.pattern_file);
+        out << "pattern_vertices = " << pattern.size() << endl;
+        out << "pattern_directed_edges = " << pattern.number_of_directed_edges() << endl;
+
+        if (params.timeout->should_abort()) {
+            out << "status = aborted" << endl;
+            return;
+        }
+
+        auto preparation_start_time = steady_clock::now();
+        bool was_prepared;
+        auto & prepared_target = prepared_target_for(server, *request.target, params, was_prepared);
+        if (was_prepared)
+            out << "target_preparation_time = " << duration_cast<milliseconds>(steady_clock::now() - preparation_start_time).count() << endl;
+
+        mutex print_mutex;
+        if (request.print_all_solutions)
+            params.enumerate_callback = [&] (const VertexToVertexMapping & mapping) {
+                unique_lock<mutex> lock{ print_mutex };
+                print_mapping(out, pattern, target, mapping);
+            };
+
+        params.start_time = steady_clock::now();
+        auto result = solve_homomorphism_problem(pattern, target, prepared_target, params);
+        auto overall_time = duration_cast<milliseconds>(steady_clock::now() - params.start_time);
+        params.timeout->stop();
+
+        out << "status = ";
+        if (params.timeout->aborted() || request.cancelled.load())
+            out << "aborted";
+        else if ((! result.mapping.empty()) || (params.count_solutions && result.solution_count > 0))
+            out << "true";
+        else
+            out << "false";
+        out << endl;
+
+        if (params.count_solutions)
+            out << "solution_count = " << result.solution_count << endl;
+
+        out << "nodes = " << result.nodes << endl;
+        out << "propagations = " << result.propagations << endl;
+
+        if (! result.mapping.empty() && ! request.print_all_solutions)
+            print_mapping(out, pattern, target, result.mapping);
+
+        out << "runtime = " << overall_time.count() << endl;
+
+        for (const auto & s : result.extra_stats)
+            out << s << endl;
+
+        verify_homomorphism(pattern, target, params.injectivity == Injectivity::Injective, params.injectivity == Injectivity::LocallyInjective,
+                params.induced, result.mapping);
+    }
+
+    auto work(Server & server) -> void
+    {
+        while (true) {
+            shared_ptr<Request> request;
+            {
+                unique_lock<mutex> guard{ server.queue_mutex };
+                server.queue_cv.wait(guard, [&] { return server.stopping || ! server.queue.empty(); });
+                if (server.queue.empty())
+                    return;
+                request = server.queue.front();
+                server.queue.pop_front();
+            }
+
+            ostringstream response;
+            try {
+                solve_request(server, *request, response);
+            }
+            catch (const exception & e) {
+                response << "error = " << e.what() << endl;
+            }
+
+            {
+                unique_lock<mutex> guard{ server.queue_mutex };
+                server.unfinished.erase(request);
+            }
+
+            unique_lock<mutex> guard{ request->finished_mutex };
+            request->response = response.str();
+            request->finished = true;
+            request->finished_cv.notify_all();
+        }
+    }
+
+    auto send_all(int fd, const string & data) -> bool
+    {
+        for (string::size_type done = 0 ; done < data.size() ; ) {
+            auto n = ::send(fd, data.data() + done, data.size() - done, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (EINTR == errno)
+                    continue;
+                return false;
+            }
+            done += n;
+        }
+        return true;
+    }
+
+    auto read_line(int fd, string & buffer, string & line) -> bool
+    {
+        while (true) {
+            auto newline = buffer.find('\n');
+            if (string::npos != newline) {
+                line = buffer.substr(0, newline);
+                buffer.erase(0, newline + 1);
+                return true;
+            }
+
+            char data[4096];
+            auto n = ::read(fd, data, sizeof(data));
+            if (n < 0 && EINTR == errno)
+                continue;
+            if (n <= 0)
+                return false;
+            buffer.append(data, n);
+        }
+    }
+
+    // Each connection sends requests one line at a time, and gets back the
+    // same key = value output as glasgow_subgraph_solver, followed by a blank
+    // line. A request whose client hangs up is cancelled.
+    auto handle_connection(Server & server, int fd) -> void
+    {
+        string buffer, line;
+        while (read_line(fd, buffer, line)) {
+            if (line.find_first_not_of(" \t\r") == string::npos)
+                continue;
+
+            auto request = make_shared<Request>();
+            request->received_at = steady_clock::now();
+            try {
+                parse_request(server, line, *request);
+            }
+            catch (const exception & e) {
+                if (! send_all(fd, "error = " + string(e.what()) + "\n\n"))
+                    break;
+                continue;
+            }
+
+            {
+                unique_lock<mutex> guard{ server.queue_mutex };
+                if (server.stopping)
+                    break;
+                server.queue.push_back(request);
+                server.unfinished.insert(request);
+                server.queue_cv.notify_one();
+            }
+
+            unique_lock<mutex> guard{ request->finished_mutex };
+            while (! request->finished)
+                if (cv_status::timeout == request->finished_cv.wait_for(guard, 100ms)) {
+                    pollfd hangup{ fd, 0, 0 };
+                    if (1 == ::poll(&hangup, 1, 0) && (hangup.revents & (POLLHUP | POLLERR)))
+                        cancel(*request);
+                }
+
+            if (! send_all(fd, request->response + "\n"))
+                break;
+        }
+
+        unique_lock<mutex> guard{ server.connections_mutex };
+        server.connections.erase(fd);
+        ::close(fd);
+        server.connections_cv.notify_all();
+    }
+
+    auto listen_on(const string & socket_name) -> int
+    {
+        sockaddr_un address;
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (socket_name.size() >= sizeof(address.sun_path))
+            throw UnsupportedConfiguration{ "Socket name '" + socket_name + "' is too long" };
+        socket_name.copy(address.sun_path, socket_name.size());
+
+        // a socket left behind by a previous server would stop us binding
+        struct stat socket_stat;
+        if (0 == ::lstat(socket_name.c_str(), &socket_stat) && S_ISSOCK(socket_stat.st_mode))
+            ::unlink(socket_name.c_str());
+
+        int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (-1 == fd)
+            throw system_error{ errno, generic_category(), "socket" };
+        if (-1 == ::bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) || -1 == ::listen(fd, SOMAXCONN)) {
+            int bind_errno = errno;
+            ::close(fd);
+            throw system_error{ bind_errno, generic_category(), "unable to listen on '" + socket_name + "'" };
+        }
+        return fd;
+    }
+}
+
+auto main(int argc, char * argv[]) -> int
+{
+    try {
+        po::options_description display_options{ "Program options" };
+        display_options.add_options()
+            ("help",                                         "Display help information")
+            ("format",             po::value<string>(),      "Specify input file format for the targets (auto, lad, vertexlabelledlad, labelledlad, dimacs, binary)")
+            ("workers",            po::value<unsigned>(),    "Solve this many requests at once (0 to auto-detect, the default)")
+            ("target-cache",       po::value<string>(),      "Cache prepared targets in this directory, for reuse by later runs");
+
+        po::options_description all_options{ "All options" };
+        all_options.add_options()
+            ("socket",       po::value<string>(),          "specify the socket to listen on")
+            ("target-file",  po::value<vector<string> >(), "specify the target files")
+            ;
+
+        all_options.add(display_options);
+
+        po::positional_options_description positional_options;
+        positional_options
+            .add("socket", 1)
+            .add("target-file", -1)
+            ;
+
+        po::variables_map options_vars;
+        po::store(po::command_line_parser(argc, argv)
+                .options(all_options)
+                .positional(positional_options)
+                .run(), options_vars);
+        po::notify(options_vars);
+
+        /* --help? Show a message, and exit. */
+        if (options_vars.count("help")) {
+            cout << "Usage: " << argv[0] << " [options] socket target-file..." << endl;
+            cout << endl;
+            cout << "Each line sent to the socket is a request, written as [request options] pattern-file [target-file]," << endl;
+            cout << "and is answered using the same key = value output as glasgow_subgraph_solver, followed by a blank line." << endl;
+            cout << endl;
+            cout << display_options << endl;
+            cout << request_options() << endl;
+            return EXIT_SUCCESS;
+        }
+
+        /* No socket or no target specified? Show a message and exit. */
+        if (! options_vars.count("socket") || ! options_vars.count("target-file")) {
+            cout << "Usage: " << argv[0] << " [options] socket target-file..." << endl;
+            return EXIT_FAILURE;
+        }
+
+        Server server;
+        server.target_format_name = options_vars.count("format") ? options_vars["format"].as<string>() : "auto";
+        if (options_vars.count("target-cache"))
+            server.target_cache = options_vars["target-cache"].as<string>();
+
+        char hostname_buf[255];
+        if (0 == gethostname(hostname_buf, 255))
+            cout << "hostname = " << string(hostname_buf) << endl;
+        cout << "commandline =";
+        for (int i = 0 ; i < argc ; ++i)
+            cout << " " << argv[i];
+        cout << endl;
+
+        auto started_at = system_clock::to_time_t(system_clock::now());
+        cout << "started_at = " << put_time(localtime(&started_at), "%F %T") << endl;
+
+        /* Read in and prepare the targets, using the parameters that a
+         * request with no options would use. */
+        for (auto & target_file : options_vars["target-file"].as<vector<string> >()) {
+            auto preparation_start_time = steady_clock::now();
+            server.targets.push_back(make_unique<ServedTarget>(target_file, read_file_format(server.target_format_name, target_file)));
+
+            HomomorphismParams default_params;
+            bool was_prepared;
+            prepared_target_for(server, *server.targets.back(), default_params, was_prepared);
+
+            cout << "target_file = " << target_file << endl;
+            cout << "target_vertices = " << server.targets.back()->graph.size() << endl;
+            cout << "target_directed_edges = " << server.targets.back()->graph.number_of_directed_edges() << endl;
+            cout << "target_preparation_time = " << duration_cast<milliseconds>(steady_clock::now() - preparation_start_time).count() << endl;
+        }
+
+        int stop_pipe[2];
+        if (-1 == ::pipe2(stop_pipe, O_CLOEXEC))
+            throw system_error{ errno, generic_category(), "pipe" };
+        stop_pipe_write_fd = stop_pipe[1];
+        std::signal(SIGINT, stop_signal_handler);
+        std::signal(SIGTERM, stop_signal_handler);
+
+        string socket_name = options_vars["socket"].as<string>();
+        int listen_fd = listen_on(socket_name);
+
+        unsigned n_workers = how_many_threads(options_vars.count("workers") ? options_vars["workers"].as<unsigned>() : 0);
+        vector<thread> workers;
+        for (unsigned w = 0 ; w < n_workers ; ++w)
+            workers.emplace_back([&] { work(server); });
+
+        cout << "workers = " << n_workers << endl;
+        cout << "listening = " << socket_name << endl;
+
+        while (true) {
+            pollfd fds[2] = { { listen_fd, POLLIN, 0 }, { stop_pipe[0], POLLIN, 0 } };
+            if (-1 == ::poll(fds, 2, -1)) {
+                if (EINTR == errno)
+                    continue;
+                throw system_error{ errno, generic_category(), "poll" };
+            }
+
+            if (fds[1].revents)
+                break;
+
+            if (fds[0].revents & POLLIN) {
+                int fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+                if (-1 == fd)
+                    continue;
+
+                unique_lock<mutex> guard{ server.connections_mutex };
+                server.connections.insert(fd);
+                thread{ [&server, fd] { handle_connection(server, fd); } }.detach();
+            }
+        }
+
+        cout << "stopping = true" << endl;
+        ::close(listen_fd);
+        ::unlink(socket_name.c_str());
+
+        /* Cancel everything that is queued or running, and wait for the
+         * workers and connections to notice. */
+        {
+            unique_lock<mutex> guard{ server.queue_mutex };
+            server.stopping = true;
+            for (auto & request : server.unfinished)
+                cancel(*request);
+            server.queue_cv.notify_all();
+        }
+
+        for (auto & w : workers)
+            w.join();
+
+        {
+            unique_lock<mutex> guard{ server.connections_mutex };
+            for (auto fd : server.connections)
+                ::shutdown(fd, SHUT_RDWR);
+            server.connections_cv.wait(guard, [&] { return server.connections.empty(); });
+        }
+
+        return EXIT_SUCCESS;
+    }
+    catch (const GraphFileError & e) {
+        cerr << "Error: " << e.what() << endl;
+        if (e.file_at_least_existed())
+            cerr << "Maybe try specifying --format?" << endl;
+        return EXIT_FAILURE;
+    }
+    catch (const po::error & e) {
+        cerr << "Error: " << e.what() << endl;
+        cerr << "Try " << argv[0] << " --help" << endl;
+        return EXIT_FAILURE;
+    }
+    catch (const exception & e) {
+        cerr << "Error: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+}
@@ -0,0 +1,12 @@
+TARGET := glasgow_subgraph_server
+
+SOURCES := \
+    glasgow_subgraph_server.cc
+
+TGT_PREREQS := libcommon.a
+ifeq ($(shell uname -s), Linux)
+TGT_LDLIBS := libcommon.a $(boost_ldlibs) -lstdc++fs
+else
+TGT_LDLIBS := libcommon.a $(boost_ldlibs)
+endif
+
@@ -2,41 +2,71 @@
 
 #include "formats/read_file_format.hh"
 #include "homomorphism.hh"
+#include "prepared_target.hh"
 #include "sip_decomposer.hh"
 #include "lackey.hh"
 #include "symmetries.hh"
 #include "restarts.hh"
+#include "thread_utils.hh"
 #include "verify.hh"
 #include "proof.hh"
+#include "config.hh"
 
 #include <boost/program_options.hpp>
 
+#include <algorithm>
 #include <chrono>
 #include <cstdlib>
 #include <ctime>
 #include <exception>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
 #include <vector>
 
+#if defined(STD_FS_IS_EXPERIMENTAL)
+#  include <experimental/filesystem>
+#elif defined(STD_FS_IS_STD)
+#  include <filesystem>
+#elif defined(STD_FS_IS_BOOST)
+#  include <boost/filesystem.hpp>
+#endif
+
 #include <unistd.h>
 
 namespace po = boost::program_options;
 
 using std::boolalpha;
 using std::cerr;
+using std::cin;
 using std::cout;
 using std::endl;
 using std::exception;
 using std::function;
+using std::getline;
+using std::ifstream;
+using std::istream;
 using std::list;
 using std::localtime;
 using std::make_pair;
 using std::make_shared;
 using std::make_unique;
+using std::map;
+using std::mutex;
+using std::ostream;
+using std::ostringstream;
 using std::put_time;
+using std::sort;
 using std::string;
+using std::thread;
+using std::tie;
+using std::unique_lock;
+using std::unique_ptr;
 using std::vector;
 
 using std::chrono::duration_cast;
@@ -46,6 +76,241 @@ using std::chrono::seconds;
 using std::chrono::steady_clock;
 using std::chrono::system_clock;
 
+#if defined(STD_FS_IS_EXPERIMENTAL)
+using std::experimental::filesystem::directory_iterator;
+using std::experimental::filesystem::is_directory;
+using std::experimental::filesystem::is_regular_file;
+#elif defined(STD_FS_IS_STD)
+using std::filesystem::directory_iterator;
+using std::filesystem::is_directory;
+using std::filesystem::is_regular_file;
+#elif defined(STD_FS_IS_BOOST)
+using boost::filesystem::directory_iterator;
+using boost::filesystem::is_directory;
+using boost::filesystem::is_regular_file;
+#endif
+
+namespace
+{
+    auto print_mapping(ostream & out, const InputGraph & pattern, const InputGraph & target,
+            const VertexToVertexMapping & mapping) -> void
+    {
+        out << "mapping = ";
+        for (auto v : mapping)
+            out << "(" << pattern.vertex_name(v.first) << " -> " << target.vertex_name(v.second) << ") ";
+        out << endl;
+    }
+
+    auto print_result(ostream & out, const InputGraph & pattern, const InputGraph & target,
+            const HomomorphismParams & params, const HomomorphismResult & result,
+            milliseconds overall_time, bool print_final_mapping) -> void
+    {
+        out << "status = ";
+        if (params.timeout->aborted())
+            out << "aborted";
+        else if ((! result.mapping.empty()) || (params.count_solutions && result.solution_count > 0))
+            out << "true";
+        else
+            out << "false";
+        out << endl;
+
+        if (params.count_solutions)
+            out << "solution_count = " << result.solution_count << endl;
+
+        out << "nodes = " << result.nodes << endl;
+        out << "propagations = " << result.propagations << endl;
+
+        if (! result.mapping.empty() && print_final_mapping)
+            print_mapping(out, pattern, target, result.mapping);
+
+        out << "runtime = " << overall_time.count() << endl;
+
+        for (const auto & s : result.extra_stats)
+            out << s << endl;
+    }
+
+    /**
+     * Everything in params which can be shared between patterns in a batch.
+     * Each pattern gets its own restarts schedule, but the caller must supply
+     * the timeout, start time, and any callback. Batches can't use a lackey
+     * or proofs.
+     */
+    auto params_for_batch_pattern(const HomomorphismParams & params) -> HomomorphismParams
+    {
+        HomomorphismParams result;
+        static_cast<HomomorphismSettings &>(result) = params;
+        result.restarts_schedule.reset(params.restarts_schedule->clone());
+        return result;
+    }
+
+    /**
+     * Read the target once, prepare it once, and then solve every pattern
+     * named by the batch file (one filename per line, '-' for standard
+     * input, or a directory) against it, printing one record per pattern,
+     * in order. Returns true if every pattern was read and solved.
+     */
+    auto solve_batch(const char * const program_name, const po::variables_map & options_vars, HomomorphismParams & params,
+            const string & pattern_format_name, const string & target_format_name,
+            string & target_automorphism_group_size, bool was_given_target_automorphism_group) -> bool
+    {
+        auto batch_start_time = steady_clock::now();
+
+        string batch_file = options_vars["pattern-file"].as<string>();
+        string target_file = options_vars["target-file"].as<string>();
+        auto target = read_file_format(target_format_name, target_file);
+
+        cout << "batch_file = " << batch_file << endl;
+        cout << "target_file = " << target_file << endl;
+        cout << "target_vertices = " << target.size() << endl;
+        cout << "target_directed_edges = " << target.number_of_directed_edges() << endl;
+
+        if (options_vars.count("target-symmetries")) {
+            auto gap_start_time = steady_clock::now();
+            find_symmetries(program_name, target, params.target_occur_less_constraints, target_automorphism_group_size);
+            was_given_target_automorphism_group = true;
+            cout << "target_symmetry_time = " << duration_cast<milliseconds>(steady_clock::now() - gap_start_time).count() << endl;
+            cout << "target_occur_less_constraints =";
+            for (auto & [ a, b ] : params.target_occur_less_constraints)
+                cout << " " << a << "<" << b;
+            cout << endl;
+        }
+
+        if (was_given_target_automorphism_group)
+            cout << "target_automorphism_group_size = " << target_automorphism_group_size << endl;
+
+        auto preparation_start_time = steady_clock::now();
+        unique_ptr<PreparedTarget> prepared_target;
+        if (options_vars.count("target-cache")) {
+            bool was_cached;
+            tie(prepared_target, was_cached) = prepare_target_using_cache(options_vars["target-cache"].as<string>(),
+                    target_file, target_format_name, target, params);
+            cout << "target_cache_hit = " << boolalpha << was_cached << endl;
+        }
+        else
+            prepared_target = make_unique<PreparedTarget>(target, params);
+        cout << "target_preparation_time = " << duration_cast<milliseconds>(steady_clock::now() - preparation_start_time).count() << endl;
+        cout << endl;
+
+        // pattern filenames are handed out one at a time, so that a list can
+        // be streamed in whilst earlier patterns are being solved
+        vector<string> directory_entries;
+        ifstream list_file;
+        istream * list_stream = nullptr;
+        if (batch_file == "-")
+            list_stream = &cin;
+        else if (is_directory(batch_file)) {
+            for (auto & entry : directory_iterator(batch_file))
+                if (is_regular_file(entry.path()))
+                    directory_entries.push_back(entry.path().string());
+            sort(directory_entries.begin(), directory_entries.end());
+        }
+        else {
+            list_file.open(batch_file);
+            if (! list_file)
+                throw GraphFileError{ batch_file, "unable to open batch file", false };
+            list_stream = &list_file;
+        }
+
+        mutex batch_mutex;
+        unsigned next_to_start = 0, next_to_print = 0, number_failed = 0;
+        map<unsigned, string> unprinted_records;
+
+        auto next_pattern_file = [&] (string & pattern_file) -> bool {
+            if (! list_stream) {
+                if (next_to_start >= directory_entries.size())
+                    return false;
+                pattern_file = directory_entries[next_to_start];
+                return true;
+            }
+
+            while (getline(*list_stream, pattern_file))
+                if (! pattern_file.empty())
+                    return true;
+            return false;
+        };
+
+        seconds timeout = options_vars.count("timeout") ? seconds{ options_vars["timeout"].as<int>() } : 0s;
+        bool print_all_solutions = options_vars.count("print-all-solutions");
+
+        auto solve_pattern = [&] (const string & pattern_file, ostream & out) -> bool {
+            out << "pattern_file = " << pattern_file << endl;
+            try {
+                auto pattern = read_file_format(pattern_format_name, pattern_file);
+                out << "pattern_vertices = " << pattern.size() << endl;
+                out << "pattern_directed_edges = " << pattern.number_of_directed_edges() << endl;
+
+                auto pattern_params = params_for_batch_pattern(params);
+                pattern_params.timeout = make_shared<Timeout>(timeout);
+                mutex print_mutex;
+                if (print_all_solutions)
+                    pattern_params.enumerate_callback = [&] (const VertexToVertexMapping & mapping) {
+                        unique_lock<mutex> lock{ print_mutex };
+                        print_mapping(out, pattern, target, mapping);
+                    };
+
+                pattern_params.start_time = steady_clock::now();
+                auto result = solve_homomorphism_problem(pattern, target, *prepared_target, pattern_params);
+                auto overall_time = duration_cast<milliseconds>(steady_clock::now() - pattern_params.start_time);
+                pattern_params.timeout->stop();
+
+                print_result(out, pattern, target, pattern_params, result, overall_time, ! print_all_solutions);
+
+                verify_homomorphism(pattern, target, params.injectivity == Injectivity::Injective, params.injectivity == Injectivity::LocallyInjective,
+                        params.induced, result.mapping);
+                return true;
+            }
+            catch (const exception & e) {
+                out << "error = " << e.what() << endl;
+                return false;
+            }
+        };
+
+        auto solve_patterns = [&] () {
+            while (true) {
+                string pattern_file;
+                unsigned index;
+                {
+                    unique_lock<mutex> guard{ batch_mutex };
+                    if (! next_pattern_file(pattern_file))
+                        return;
+                    index = next_to_start++;
+                }
+
+                ostringstream record;
+                bool succeeded = solve_pattern(pattern_file, record);
+
+                // records are printed in the order patterns were listed,
+                // regardless of which finishes first
+                unique_lock<mutex> guard{ batch_mutex };
+                if (! succeeded)
+                    ++number_failed;
+                unprinted_records.emplace(index, record.str());
+                for (auto r = unprinted_records.begin() ; r != unprinted_records.end() && r->first == next_to_print ; ++next_to_print) {
+                    cout << r->second << endl;
+                    r = unprinted_records.erase(r);
+                }
+            }
+        };
+
+        unsigned n_batch_threads = options_vars.count("batch-threads") ? how_many_threads(options_vars["batch-threads"].as<unsigned>()) : 1;
+        if (1 == n_batch_threads)
+            solve_patterns();
+        else {
+            vector<thread> batch_threads;
+            for (unsigned t = 0 ; t < n_batch_threads ; ++t)
+                batch_threads.emplace_back(solve_patterns);
+            for (auto & t : batch_threads)
+                t.join();
+        }
+
+        cout << "batch_patterns = " << next_to_start << endl;
+        cout << "batch_failures = " << number_failed << endl;
+        cout << "batch_runtime = " << duration_cast<milliseconds>(steady_clock::now() - batch_start_time).count() << endl;
+
+        return 0 == number_failed;
+    }
+}
+
 auto main(int argc, char * argv[]) -> int
 {
     try {
@@ -53,7 +318,7 @@ auto main(int argc, char * argv[]) -> int
         display_options.add_options()
             ("help",                                         "Display help information")
             ("timeout",            po::value<int>(),         "Abort after this many seconds")
-            ("parallel",                                     "Use auto-configured parallel search (highly nondeterministic runtimes)");
+            ("parallel",                                     "Use auto-configured parallel search (highly nondeterministic runtimes, unless --deterministic)");
 
         po::options_description problem_options{ "Problem options" };
         problem_options.add_options()
@@ -66,7 +331,7 @@ auto main(int argc, char * argv[]) -> int
 
         po::options_description input_options{ "Input file options" };
         input_options.add_options()
-            ("format",             po::value<string>(),      "Specify input file format (auto, lad, vertexlabelledlad, labelledlad, dimacs)")
+            ("format",             po::value<string>(),      "Specify input file format (auto, lad, vertexlabelledlad, labelledlad, dimacs, binary)")
             ("pattern-format",     po::value<string>(),      "Specify input file format just for the pattern graph")
             ("target-format",      po::value<string>(),      "Specify input file format just for the target graph");
         display_options.add(input_options);
@@ -88,16 +353,28 @@ auto main(int argc, char * argv[]) -> int
         mangling_options.add_options()
             ("no-clique-detection",                            "Disable clique / independent set detection")
             ("no-supplementals",                               "Do not use supplemental graphs")
-            ("no-nds",                                         "Do not use neighbourhood degree sequences");
+            ("no-nds",                                         "Do not use neighbourhood degree sequences")
+            ("lazy-supplementals",                             "Build supplemental target graph rows only when search first needs them")
+            ("target-representation", po::value<string>(),     "Store the target as bitset rows or as neighbour lists (auto / dense / sparse)")
+            ("target-cache",          po::value<string>(),     "Cache prepared targets in this directory, for reuse by later runs");
         display_options.add(mangling_options);
 
         po::options_description parallel_options{ "Advanced parallelism options" };
         parallel_options.add_options()
             ("threads",              po::value<unsigned>(),    "Use threaded search, with this many threads (0 to auto-detect)")
             ("triggered-restarts",                             "Have one thread trigger restarts (more nondeterminism, better performance)")
+            ("work-stealing",                                  "Have threads split up the search tree, rather than racing with restarts")
+            ("deterministic",                                  "Have threads split up the search tree in a fixed way, so results and node counts are repeatable")
             ("delay-thread-creation",                          "Do not create threads until after the first restart");
         display_options.add(parallel_options);
 
+        po::options_description batch_options{ "Batch options" };
+        batch_options.add_options()
+            ("batch",                                          "Treat the pattern file as a list of pattern filenames, one per line ('-' for standard input), "
+                                                               "or as a directory of pattern files, and solve each against the same target")
+            ("batch-threads",        po::value<unsigned>(),    "Solve this many patterns at once in batch mode (0 to auto-detect)");
+        display_options.add(batch_options);
+
         vector<string> pattern_less_thans, target_occur_less_thans;
         po::options_description symmetry_options{ "Manual symmetry options" };
         symmetry_options.add_options()
@@ -197,6 +474,9 @@ auto main(int argc, char * argv[]) -> int
         if (options_vars.count("delay-thread-creation") || options_vars.count("parallel"))
             params.delay_thread_creation = true;
 
+        params.work_stealing = options_vars.count("work-stealing");
+        params.deterministic = options_vars.count("deterministic");
+
         if (options_vars.count("restarts")) {
             string restarts_policy = options_vars["restarts"].as<string>();
             if (restarts_policy == "luby") {
@@ -232,7 +512,8 @@ auto main(int argc, char * argv[]) -> int
             }
         }
         else {
-            if (params.count_solutions && ! options_vars.count("parallel"))
+            // counting in parallel splits the tree up between threads
+            if (params.count_solutions || params.work_stealing || params.deterministic)
                 params.restarts_schedule = make_unique<NoRestartsSchedule>();
             else if (options_vars.count("parallel"))
                 params.restarts_schedule = make_unique<TimedRestartsSchedule>(TimedRestartsSchedule::default_duration, TimedRestartsSchedule::default_minimum_backtracks);
@@ -263,6 +544,21 @@ auto main(int argc, char * argv[]) -> int
             params.number_of_exact_path_graphs = options_vars["n-exact-path-graphs"].as<int>();
         params.no_supplementals = options_vars.count("no-supplementals");
         params.no_nds = options_vars.count("no-nds");
+        params.lazy_supplementals = options_vars.count("lazy-supplementals");
+
+        if (options_vars.count("target-representation")) {
+            string target_representation = options_vars["target-representation"].as<string>();
+            if (target_representation == "auto")
+                params.target_representation = TargetRepresentation::Auto;
+            else if (target_representation == "dense")
+                params.target_representation = TargetRepresentation::Dense;
+            else if (target_representation == "sparse")
+                params.target_representation = TargetRepresentation::Sparse;
+            else {
+                cerr << "Unknown target representation '" << target_representation << "'" << endl;
+                return EXIT_FAILURE;
+            }
+        }
 
         string pattern_automorphism_group_size = "1", target_automorphism_group_size = "1";
         bool was_given_pattern_automorphism_group = false, was_given_target_automorphism_group = false;
@@ -296,6 +592,23 @@ auto main(int argc, char * argv[]) -> int
             params.target_occur_less_constraints.emplace_back(a, b);
         }
 
+        if (options_vars.count("target-cache") && options_vars.count("decomposition")) {
+            cerr << "Cannot specify both --target-cache and --decomposition" << endl;
+            return EXIT_FAILURE;
+        }
+
+        if (options_vars.count("batch")) {
+            for (auto & option : { "decomposition", "prove", "send-to-lackey", "pattern-symmetries", "pattern-less-than", "pattern-automorphism-group-size" })
+                if (options_vars.count(option)) {
+                    cerr << "Cannot specify both --batch and --" << option << endl;
+                    return EXIT_FAILURE;
+                }
+        }
+        else if (options_vars.count("batch-threads")) {
+            cerr << "Cannot specify --batch-threads without --batch" << endl;
+            return EXIT_FAILURE;
+        }
+
         if (options_vars.count("send-to-lackey") ^ options_vars.count("receive-from-lackey")) {
             cerr << "Must specify both of --send-to-lackey and --receive-from-lackey" << endl;
             return EXIT_FAILURE;
@@ -316,6 +629,11 @@ auto main(int argc, char * argv[]) -> int
         string default_format_name = options_vars.count("format") ? options_vars["format"].as<string>() : "auto";
         string pattern_format_name = options_vars.count("pattern-format") ? options_vars["pattern-format"].as<string>() : default_format_name;
         string target_format_name = options_vars.count("target-format") ? options_vars["target-format"].as<string>() : default_format_name;
+
+        if (options_vars.count("batch"))
+            return solve_batch(argv[0], options_vars, params, pattern_format_name, target_format_name,
+                    target_automorphism_group_size, was_given_target_automorphism_group) ? EXIT_SUCCESS : EXIT_FAILURE;
+
         auto pattern = read_file_format(pattern_format_name, options_vars["pattern-file"].as<string>());
         auto target = read_file_format(target_format_name, options_vars["target-file"].as<string>());
 
@@ -350,12 +668,11 @@ auto main(int argc, char * argv[]) -> int
         else
             params.propagate_using_lackey = PropagateUsingLackey::Never;
 
+        mutex print_mutex;
         if (options_vars.count("print-all-solutions")) {
             params.enumerate_callback = [&] (const VertexToVertexMapping & mapping) {
-                cout << "mapping = ";
-                for (auto v : mapping)
-                    cout << "(" << pattern.vertex_name(v.first) << " -> " << target.vertex_name(v.second) << ") ";
-                cout << endl;
+                unique_lock<mutex> lock{ print_mutex };
+                print_mapping(cout, pattern, target, mapping);
             };
         }
 
@@ -408,39 +725,26 @@ auto main(int argc, char * argv[]) -> int
         if (was_given_target_automorphism_group)
             cout << "target_automorphism_group_size = " << target_automorphism_group_size << endl;
 
+        unique_ptr<PreparedTarget> prepared_target;
+        if (options_vars.count("target-cache")) {
+            auto cache_start_time = steady_clock::now();
+            bool was_cached;
+            tie(prepared_target, was_cached) = prepare_target_using_cache(options_vars["target-cache"].as<string>(),
+                    options_vars["target-file"].as<string>(), target_format_name, target, params);
+            cout << "target_cache_hit = " << boolalpha << was_cached << endl;
+            cout << "target_cache_time = " << duration_cast<milliseconds>(steady_clock::now() - cache_start_time).count() << endl;
+        }
+
         auto result = options_vars.count("decomposition") ?
             solve_sip_by_decomposition(pattern, target, params) :
+            prepared_target ?
+            solve_homomorphism_problem(pattern, target, *prepared_target, params) :
             solve_homomorphism_problem(pattern, target, params);
 
         /* Stop the clock. */
         auto overall_time = duration_cast<milliseconds>(steady_clock::now() - params.start_time);
 
-        cout << "status = ";
-        if (params.timeout->aborted())
-            cout << "aborted";
-        else if ((! result.mapping.empty()) || (params.count_solutions && result.solution_count > 0))
-            cout << "true";
-        else
-            cout << "false";
-        cout << endl;
-
-        if (params.count_solutions)
-            cout << "solution_count = " << result.solution_count << endl;
-
-        cout << "nodes = " << result.nodes << endl;
-        cout << "propagations = " << result.propagations << endl;
-
-        if (! result.mapping.empty() && ! options_vars.count("print-all-solutions")) {
-            cout << "mapping = ";
-            for (auto v : result.mapping)
-                cout << "(" << pattern.vertex_name(v.first) << " -> " << target.vertex_name(v.second) << ") ";
-            cout << endl;
-        }
-
-        cout << "runtime = " << overall_time.count() << endl;
-
-        for (const auto & s : result.extra_stats)
-            cout << s << endl;
+        print_result(cout, pattern, target, params, result, overall_time, ! options_vars.count("print-all-solutions"));
 
         if (params.lackey) {
             cout << "lackey_calls = " << params.lackey->number_of_calls() << endl;
@@ -14,11 +14,13 @@
 #include <algorithm>
 #include <atomic>
 #include <condition_variable>
+#include <deque>
 #include <limits>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <optional>
+#include <set>
 #include <thread>
 #include <unordered_set>
 #include <utility>
@@ -27,6 +29,8 @@
 #include <boost/functional/hash.hpp>
 
 using std::atomic;
+using std::condition_variable;
+using std::deque;
 using std::function;
 using std::make_optional;
 using std::make_unique;
@@ -35,6 +39,8 @@ using std::move;
 using std::mutex;
 using std::optional;
 using std::pair;
+using std::prev;
+using std::set;
 using std::size_t;
 using std::sort;
 using std::string;
@@ -106,8 +112,8 @@ namespace
                         [&] (const HomomorphismAssignment & assignment) {
                             for (auto & d : domains)
                                 if (d.v == assignment.pattern_vertex) {
-                                    d.values.reset(assignment.target_vertex);
-                                    d.count = d.values.count();
+                                    if (d.values.reset(assignment.target_vertex))
+                                        --d.count;
                                     break;
                                 }
                         });
@@ -284,8 +290,8 @@ namespace
                                 [&] (const HomomorphismAssignment & assignment) {
                                     for (auto & d : domains)
                                         if (d.v == assignment.pattern_vertex) {
-                                            d.values.reset(assignment.target_vertex);
-                                            d.count = d.values.count();
+                                            if (d.values.reset(assignment.target_vertex))
+                                                --d.count;
                                             break;
                                         }
                                 }))
@@ -392,136 +398,676 @@ namespace
             return common_result;
         }
     };
-}
 
-auto solve_homomorphism_problem(
-        const InputGraph & pattern,
-        const InputGraph & target,
-        const HomomorphismParams & params) -> HomomorphismResult
-{
-    // start by setting up proof logging, if necessary
-    if (params.proof) {
-        // proof logging is currently incompatible with a whole load of "extra" features,
-        // but can be adapted to support most of them
-        if (1 != params.n_threads)
-            throw UnsupportedConfiguration{ "Proof logging cannot yet be used with threads" };
-        if (params.clique_detection)
-            throw UnsupportedConfiguration{ "Proof logging cannot yet be used with clique detection" };
-        if (params.lackey)
-            throw UnsupportedConfiguration{ "Proof logging cannot yet be used with a lackey" };
-        if (! params.pattern_less_constraints.empty() || ! params.target_occur_less_constraints.empty())
-            throw UnsupportedConfiguration{ "Proof logging cannot yet be used with less-constraints" };
-        if (params.injectivity != Injectivity::Injective)
-            throw UnsupportedConfiguration{ "Proof logging can currently only be used with injectivity" };
-        if (params.induced)
-            throw UnsupportedConfiguration{ "Proof logging cannot yet be used for induced problems" };
-        if (pattern.has_vertex_labels() || pattern.has_edge_labels())
-            throw UnsupportedConfiguration{ "Proof logging cannot yet be used on labelled graphs" };
-
-        // set up our model file, with a set of OPB variables for each CP variable
-        for (int n = 0 ; n < pattern.size() ; ++n) {
-            params.proof->create_cp_variable(n, target.size(),
-                    [&] (int v) { return pattern.vertex_name(v); },
-                    [&] (int v) { return target.vertex_name(v); });
+    // donating deeper than this moves too little work to be worth it
+    constexpr int max_donation_depth = 12;
+
+    /* Subtrees waiting to be searched, kept as the decisions that lead to
+     * them. Each thread has its own deque: it donates to and works from the
+     * back of its own, and steals from the front of everyone else's, where
+     * the oldest and so shallowest and biggest subtrees are. */
+    struct WorkStealingPool
+    {
+        mutex lock;
+        condition_variable changed;
+        vector<deque<vector<HomomorphismAssignmentInformation> > > deques;
+        unsigned busy = 0;
+        bool finished = false;
+        atomic<unsigned> idle{ 0 }, queued{ 0 };
+        unsigned long long donations = 0, steals = 0;
+
+        explicit WorkStealingPool(unsigned n_threads) :
+            deques(n_threads)
+        {
+        }
+
+        auto wanted() const -> bool
+        {
+            return queued.load(std::memory_order_relaxed) < idle.load(std::memory_order_relaxed);
+        }
+
+        auto donate(unsigned t, const HomomorphismAssignments & assignments,
+                const vector<HomomorphismAssignmentInformation> & values) -> void
+        {
+            vector<HomomorphismAssignmentInformation> decisions;
+            for (auto & a : assignments.values)
+                if (a.is_decision)
+                    decisions.push_back(a);
+
+            unique_lock<mutex> guard{ lock };
+            // values are best first, and we work from the back
+            for (auto v = values.rbegin() ; v != values.rend() ; ++v) {
+                deques[t].push_back(decisions);
+                deques[t].back().push_back(*v);
+            }
+            queued += values.size();
+            donations += values.size();
+            changed.notify_all();
         }
 
-        // generate constraints for injectivity
-        params.proof->create_injectivity_constraints(pattern.size(), target.size());
-
-        // generate edge constraints, and also handle loops here
-        for (int p = 0 ; p < pattern.size() ; ++p) {
-            for (int t = 0 ; t < target.size() ; ++t) {
-                if (pattern.adjacent(p, p) && ! target.adjacent(t, t))
-                    params.proof->create_forbidden_assignment_constraint(p, t);
-
-                // it's simpler to always have the adjacency constraints, even
-                // if the assignment is forbidden
-                params.proof->start_adjacency_constraints_for(p, t);
-
-                // if p can be mapped to t, then each neighbour of p...
-                for (int q = 0 ; q < pattern.size() ; ++q)
-                    if (q != p && pattern.adjacent(p, q)) {
-                        // ... must be mapped to a neighbour of t
-                        vector<int> permitted;
-                        for (int u = 0 ; u < target.size() ; ++u)
-                            if (t != u && target.adjacent(t, u))
-                                permitted.push_back(u);
-                        params.proof->create_adjacency_constraint(p, q, t, permitted);
+        auto next(unsigned t, bool was_busy, vector<HomomorphismAssignmentInformation> & decisions) -> bool
+        {
+            unique_lock<mutex> guard{ lock };
+            if (was_busy)
+                --busy;
+
+            while (! finished) {
+                if (! deques[t].empty()) {
+                    decisions = move(deques[t].back());
+                    deques[t].pop_back();
+                    --queued;
+                    ++busy;
+                    return true;
+                }
+
+                for (unsigned u = (t + 1) % deques.size() ; u != t ; u = (u + 1) % deques.size())
+                    if (! deques[u].empty()) {
+                        decisions = move(deques[u].front());
+                        deques[u].pop_front();
+                        --queued;
+                        ++busy;
+                        ++steals;
+                        return true;
                     }
+
+                // nothing queued and nobody working, so nothing more will
+                // ever be donated
+                if (0 == busy) {
+                    finished = true;
+                    changed.notify_all();
+                    break;
+                }
+
+                ++idle;
+                changed.wait(guard);
+                --idle;
             }
+
+            return false;
         }
 
-        // output the model file
-        params.proof->finalise_model();
-    }
+        auto stop() -> void
+        {
+            unique_lock<mutex> guard{ lock };
+            finished = true;
+            changed.notify_all();
+        }
+    };
 
-    // first sanity check: if we're finding an injective mapping, and there
-    // aren't enough vertices, fail immediately.
-    if (is_nonshrinking(params) && (pattern.size() > target.size())) {
-        if (params.proof) {
-            params.proof->failure_due_to_pattern_bigger_than_target();
-            params.proof->finish_unsat_proof();
+    struct WorkStealingSolver : HomomorphismSolver
+    {
+        unsigned n_threads;
+
+        WorkStealingSolver(const HomomorphismModel & m, const HomomorphismParams & p, unsigned t) :
+            HomomorphismSolver(m, p),
+            n_threads(t)
+        {
         }
 
-        return HomomorphismResult{ };
-    }
+        auto solve() -> HomomorphismResult
+        {
+            HomomorphismResult common_result;
+
+            // domains
+            Domains root_domains(model.pattern_size, HomomorphismDomain{ model.target_size });
+            if (! model.initialise_domains(root_domains)) {
+                common_result.complete = true;
+                return common_result;
+            }
+
+            // start search timer
+            auto search_start_time = steady_clock::now();
+
+            // every subtree is searched exactly once, so there are no
+            // duplicate solutions to filter
+            vector<unique_ptr<HomomorphismSearcher> > searchers;
+            for (unsigned t = 0 ; t < n_threads ; ++t) {
+                searchers.push_back(make_unique<HomomorphismSearcher>(model, params, [] (const HomomorphismAssignments &) -> bool { return true; }));
+                if (0 != t)
+                    searchers[t]->set_seed(t);
+            }
+
+            // everyone starts from the same root propagation
+            HomomorphismAssignments root_assignments;
+            root_assignments.values.reserve(model.pattern_size);
+            ++common_result.propagations;
+            if (! searchers[0]->propagate(root_domains, root_assignments, params.propagate_using_lackey != PropagateUsingLackey::Never)) {
+                common_result.complete = true;
+                return common_result;
+            }
+
+            WorkStealingPool pool{ n_threads };
+            pool.deques[0].emplace_back();
+            pool.queued = 1;
+
+            mutex common_result_mutex;
+            bool found_solution = false, aborted = false;
+            string by_thread_nodes, by_thread_propagations;
 
-    // is the pattern a clique? if so, use a clique algorithm instead
-    if (can_use_clique(params) && is_simple_clique(pattern)) {
-        CliqueParams clique_params;
-        clique_params.timeout = params.timeout;
-        clique_params.start_time = params.start_time;
-        clique_params.decide = make_optional(pattern.size());
-        clique_params.restarts_schedule = make_unique<NoRestartsSchedule>();
-        auto clique_result = solve_clique_problem(target, clique_params);
-
-        // now translate the result back into what we expect
-        HomomorphismResult result;
-        int v = 0;
-        for (auto & m : clique_result.clique) {
-            result.mapping.emplace(v++, m);
-            // the clique solver can find a bigger clique than we ask for
-            if (v >= pattern.size())
-                break;
+            auto work = [&] (unsigned t) {
+                HomomorphismResult thread_result;
+
+                HomomorphismWorkDonation donation;
+                donation.max_depth = max_donation_depth;
+                donation.wanted = [&] () { return pool.wanted(); };
+                donation.donate = [&, t] (const HomomorphismAssignments & a, const vector<HomomorphismAssignmentInformation> & v) {
+                    pool.donate(t, a, v);
+                };
+                searchers[t]->set_work_donation(&donation);
+
+                NoRestartsSchedule no_restarts;
+                vector<HomomorphismAssignmentInformation> decisions;
+                bool was_busy = false;
+                while (pool.next(t, was_busy, decisions)) {
+                    was_busy = true;
+
+                    Domains domains = root_domains;
+                    auto assignments = root_assignments;
+                    if (! searchers[t]->replay(decisions, domains, assignments, thread_result.propagations))
+                        continue;
+
+                    switch (searchers[t]->restarting_search(assignments, domains, thread_result.nodes, thread_result.propagations,
+                                thread_result.solution_count, decisions.size(), no_restarts)) {
+                        case SearchResult::Satisfiable:
+                            {
+                                searchers[t]->save_result(assignments, thread_result);
+                                unique_lock<mutex> lock{ common_result_mutex };
+                                found_solution = true;
+                            }
+                            params.timeout->trigger_early_abort();
+                            pool.stop();
+                            break;
+
+                        case SearchResult::Aborted:
+                            {
+                                unique_lock<mutex> lock{ common_result_mutex };
+                                aborted = true;
+                            }
+                            pool.stop();
+                            break;
+
+                        case SearchResult::SatisfiableButKeepGoing:
+                        case SearchResult::Unsatisfiable:
+                        case SearchResult::UnsatisfiableAndBackjumpUsingLackey:
+                        case SearchResult::Restart:
+                            break;
+                    }
+                }
+
+                searchers[t]->set_work_donation(nullptr);
+
+                unique_lock<mutex> lock{ common_result_mutex };
+                if (! thread_result.mapping.empty() && common_result.mapping.empty()) {
+                    common_result.mapping = move(thread_result.mapping);
+                    for (auto & x : thread_result.extra_stats)
+                        common_result.extra_stats.push_back(x);
+                }
+                common_result.nodes += thread_result.nodes;
+                common_result.propagations += thread_result.propagations;
+                common_result.solution_count += thread_result.solution_count;
+
+                by_thread_nodes.append(" " + to_string(thread_result.nodes));
+                by_thread_propagations.append(" " + to_string(thread_result.propagations));
+            };
+
+            vector<thread> threads;
+            for (unsigned t = 1 ; t < n_threads ; ++t)
+                threads.emplace_back(work, t);
+            work(0);
+            for (auto & th : threads)
+                th.join();
+
+            // finding a solution aborts everyone else, but that's fine
+            common_result.complete = found_solution || ! aborted;
+
+            common_result.extra_stats.emplace_back("by_thread_nodes =" + by_thread_nodes);
+            common_result.extra_stats.emplace_back("by_thread_propagations =" + by_thread_propagations);
+            common_result.extra_stats.emplace_back("work_donations = " + to_string(pool.donations));
+            common_result.extra_stats.emplace_back("work_steals = " + to_string(pool.steals));
+            common_result.extra_stats.emplace_back("search_time = " + to_string(
+                        duration_cast<milliseconds>(steady_clock::now() - search_start_time).count()));
+
+            return common_result;
         }
-        result.nodes = clique_result.nodes;
-        result.extra_stats = move(clique_result.extra_stats);
-        result.extra_stats.emplace_back("used_clique_solver = true");
-        result.complete = clique_result.complete;
+    };
 
-        return result;
-    }
-    else {
-        // just solve the problem
-        HomomorphismModel model(target, pattern, params);
+    /* Where a subtree sits in the search tree. A subtree is searched by its
+     * owner before anything it donates, and the deepest donations come
+     * first, so that sorting positions gives the order that sequential
+     * search would reach them. */
+    using SubtreePosition = vector<pair<int, unsigned> >;
 
-        if (! model.prepare()) {
-            HomomorphismResult result;
-            result.extra_stats.emplace_back("model_consistent = false");
-            result.complete = true;
-            if (params.proof)
+    struct DeterministicSolver : HomomorphismSolver
+    {
+        // donate after searching this many nodes ourselves, so that how the
+        // tree is split depends only upon the tree
+        static constexpr unsigned long long split_after_nodes = 10000;
+
+        struct Subtree
+        {
+            vector<HomomorphismAssignmentInformation> decisions;
+            bool finished = false;
+            unsigned long long nodes = 0, propagations = 0;
+            loooong solution_count = 0;
+            vector<VertexToVertexMapping> solutions;
+        };
+
+        unsigned n_threads;
+
+        DeterministicSolver(const HomomorphismModel & m, const HomomorphismParams & p, unsigned t) :
+            HomomorphismSolver(m, p),
+            n_threads(t)
+        {
+        }
+
+        auto solve() -> HomomorphismResult
+        {
+            HomomorphismResult common_result;
+
+            // domains
+            Domains root_domains(model.pattern_size, HomomorphismDomain{ model.target_size });
+            if (! model.initialise_domains(root_domains)) {
+                common_result.complete = true;
+                return common_result;
+            }
+
+            // start search timer
+            auto search_start_time = steady_clock::now();
+
+            vector<unique_ptr<HomomorphismSearcher> > searchers;
+            for (unsigned t = 0 ; t < n_threads ; ++t)
+                searchers.push_back(make_unique<HomomorphismSearcher>(model, params, [] (const HomomorphismAssignments &) -> bool { return true; }));
+
+            HomomorphismAssignments root_assignments;
+            root_assignments.values.reserve(model.pattern_size);
+            ++common_result.propagations;
+            if (! searchers[0]->propagate(root_domains, root_assignments, params.propagate_using_lackey != PropagateUsingLackey::Never)) {
+                common_result.complete = true;
+                return common_result;
+            }
+
+            mutex lock;
+            condition_variable changed;
+
+            // every subtree that hasn't been reported yet, in search order
+            map<SubtreePosition, Subtree> subtrees;
+            set<SubtreePosition> queued;
+            subtrees.emplace(SubtreePosition{ }, Subtree{ });
+            queued.emplace();
+
+            // the first subtree, in search order, known to contain a solution
+            optional<SubtreePosition> first_solution;
+            atomic<unsigned> first_solution_changes{ 0 };
+            HomomorphismResult first_solution_result;
+
+            unsigned busy = 0;
+            bool finished = false, aborted = false;
+            unsigned long long subtrees_searched = 0;
+
+            auto wanted = [&] (const SubtreePosition & position) {
+                return ! first_solution || position <= *first_solution;
+            };
+
+            // a finished subtree can be reported once everything before it has
+            // been, because anything else that comes before it would have to
+            // be donated by something before it
+            auto report = [&] (bool unfinished_too) {
+                for (auto s = subtrees.begin() ; s != subtrees.end() && (unfinished_too || s->second.finished) ; s = subtrees.erase(s)) {
+                    if (! s->second.finished || ! wanted(s->first))
+                        continue;
+
+                    ++subtrees_searched;
+                    common_result.nodes += s->second.nodes;
+                    common_result.propagations += s->second.propagations;
+                    common_result.solution_count += s->second.solution_count;
+                    for (auto & m : s->second.solutions)
+                        params.enumerate_callback(m);
+                }
+            };
+
+            auto work = [&] (unsigned t) {
+                SubtreePosition position;
+                unsigned long long nodes, propagations, split_mark;
+                loooong solution_count;
+                unsigned donated;
+                vector<VertexToVertexMapping> solutions;
+                unsigned seen_first_solution_changes;
+                bool abandoned;
+
+                HomomorphismWorkDonation donation;
+                donation.max_depth = max_donation_depth;
+                donation.wanted = [&] () { return nodes >= split_mark + split_after_nodes; };
+                donation.donate = [&] (const HomomorphismAssignments & assignments, const vector<HomomorphismAssignmentInformation> & values) {
+                    split_mark = nodes;
+                    vector<HomomorphismAssignmentInformation> decisions;
+                    for (auto & a : assignments.values)
+                        if (a.is_decision)
+                            decisions.push_back(a);
+
+                    unique_lock<mutex> guard{ lock };
+                    for (auto & v : values) {
+                        auto donated_position = position;
+                        donated_position.emplace_back(-int(decisions.size() + 1), donated++);
+                        if (wanted(donated_position)) {
+                            Subtree subtree;
+                            subtree.decisions = decisions;
+                            subtree.decisions.push_back(v);
+                            subtrees.emplace(donated_position, move(subtree));
+                            queued.insert(move(donated_position));
+                        }
+                    }
+                    changed.notify_all();
+                };
+
+                donation.in_search_order = true;
+
+                // give up on a subtree that comes after a solution
+                donation.abandon = [&] () {
+                    if (first_solution_changes.load(std::memory_order_relaxed) != seen_first_solution_changes) {
+                        unique_lock<mutex> guard{ lock };
+                        seen_first_solution_changes = first_solution_changes;
+                        abandoned = ! wanted(position);
+                    }
+                    return abandoned;
+                };
+
+                if (params.enumerate_callback)
+                    donation.enumerate = [&] (const VertexToVertexMapping & mapping) {
+                        solutions.push_back(mapping);
+                    };
+
+                searchers[t]->set_work_donation(&donation);
+
+                NoRestartsSchedule no_restarts;
+                unique_lock<mutex> guard{ lock };
+                while (true) {
+                    while (! queued.empty() && ! wanted(*queued.rbegin())) {
+                        subtrees.erase(*queued.rbegin());
+                        queued.erase(prev(queued.end()));
+                    }
+
+                    if (finished)
+                        break;
+                    else if (queued.empty()) {
+                        if (0 == busy) {
+                            finished = true;
+                            changed.notify_all();
+                            break;
+                        }
+                        changed.wait(guard);
+                        continue;
+                    }
+
+                    position = *queued.begin();
+                    queued.erase(queued.begin());
+                    auto & subtree = subtrees.find(position)->second;
+                    ++busy;
+                    seen_first_solution_changes = first_solution_changes;
+                    abandoned = false;
+                    guard.unlock();
+
+                    nodes = propagations = split_mark = 0;
+                    solution_count = 0;
+                    donated = 0;
+                    solutions.clear();
+
+                    // a subtree's random choices depend only upon where it is
+                    size_t seed = 0;
+                    for (auto & [ depth, index ] : position) {
+                        hash_combine(seed, depth);
+                        hash_combine(seed, index);
+                    }
+                    searchers[t]->set_seed(int(seed));
+
+                    Domains domains = root_domains;
+                    auto assignments = root_assignments;
+                    auto search_result = SearchResult::Unsatisfiable;
+                    if (searchers[t]->replay(subtree.decisions, domains, assignments, propagations))
+                        search_result = searchers[t]->restarting_search(assignments, domains, nodes, propagations,
+                                solution_count, subtree.decisions.size(), no_restarts);
+
+                    HomomorphismResult solution_result;
+                    if (SearchResult::Satisfiable == search_result)
+                        searchers[t]->save_result(assignments, solution_result);
+
+                    guard.lock();
+                    --busy;
+
+                    switch (search_result) {
+                        case SearchResult::Satisfiable:
+                            if (wanted(position)) {
+                                first_solution = position;
+                                first_solution_result = move(solution_result);
+                                ++first_solution_changes;
+                            }
+                            break;
+
+                        case SearchResult::Aborted:
+                            if (wanted(position)) {
+                                aborted = true;
+                                finished = true;
+                            }
+                            break;
+
+                        case SearchResult::SatisfiableButKeepGoing:
+                        case SearchResult::Unsatisfiable:
+                        case SearchResult::UnsatisfiableAndBackjumpUsingLackey:
+                        case SearchResult::Restart:
+                            break;
+                    }
+
+                    subtree.finished = true;
+                    subtree.nodes = nodes;
+                    subtree.propagations = propagations;
+                    subtree.solution_count = solution_count;
+                    subtree.solutions = move(solutions);
+                    report(false);
+                    changed.notify_all();
+                }
+
+                guard.unlock();
+                searchers[t]->set_work_donation(nullptr);
+            };
+
+            vector<thread> threads;
+            for (unsigned t = 1 ; t < n_threads ; ++t)
+                threads.emplace_back(work, t);
+            work(0);
+            for (auto & th : threads)
+                th.join();
+
+            // only anything left behind by a timeout
+            report(true);
+
+            if (first_solution) {
+                common_result.mapping = move(first_solution_result.mapping);
+                for (auto & x : first_solution_result.extra_stats)
+                    common_result.extra_stats.push_back(x);
+            }
+            common_result.complete = first_solution.has_value() || ! aborted;
+
+            common_result.extra_stats.emplace_back("subtrees = " + to_string(subtrees_searched));
+            common_result.extra_stats.emplace_back("search_time = " + to_string(
+                        duration_cast<milliseconds>(steady_clock::now() - search_start_time).count()));
+
+            return common_result;
+        }
+    };
+
+    auto solve_homomorphism_problem_using(
+            const InputGraph & pattern,
+            const InputGraph & target,
+            const PreparedTarget * prepared_target,
+            const HomomorphismParams & params) -> HomomorphismResult
+    {
+        // start by setting up proof logging, if necessary
+        if (params.proof) {
+            // proof logging is currently incompatible with a whole load of "extra" features,
+            // but can be adapted to support most of them
+            if (1 != params.n_threads)
+                throw UnsupportedConfiguration{ "Proof logging cannot yet be used with threads" };
+            if (params.deterministic)
+                throw UnsupportedConfiguration{ "Proof logging cannot yet be used with deterministic search" };
+            if (params.clique_detection)
+                throw UnsupportedConfiguration{ "Proof logging cannot yet be used with clique detection" };
+            if (params.lackey)
+                throw UnsupportedConfiguration{ "Proof logging cannot yet be used with a lackey" };
+            if (! params.pattern_less_constraints.empty() || ! params.target_occur_less_constraints.empty())
+                throw UnsupportedConfiguration{ "Proof logging cannot yet be used with less-constraints" };
+            if (params.injectivity != Injectivity::Injective)
+                throw UnsupportedConfiguration{ "Proof logging can currently only be used with injectivity" };
+            if (params.induced)
+                throw UnsupportedConfiguration{ "Proof logging cannot yet be used for induced problems" };
+            if (pattern.has_vertex_labels() || pattern.has_edge_labels())
+                throw UnsupportedConfiguration{ "Proof logging cannot yet be used on labelled graphs" };
+
+            // set up our model file, with a set of OPB variables for each CP variable
+            for (int n = 0 ; n < pattern.size() ; ++n) {
+                params.proof->create_cp_variable(n, target.size(),
+                        [&] (int v) { return pattern.vertex_name(v); },
+                        [&] (int v) { return target.vertex_name(v); });
+            }
+
+            // generate constraints for injectivity
+            params.proof->create_injectivity_constraints(pattern.size(), target.size());
+
+            // generate edge constraints, and also handle loops here
+            for (int p = 0 ; p < pattern.size() ; ++p) {
+                for (int t = 0 ; t < target.size() ; ++t) {
+                    if (pattern.adjacent(p, p) && ! target.adjacent(t, t))
+                        params.proof->create_forbidden_assignment_constraint(p, t);
+
+                    // it's simpler to always have the adjacency constraints, even
+                    // if the assignment is forbidden
+                    params.proof->start_adjacency_constraints_for(p, t);
+
+                    // if p can be mapped to t, then each neighbour of p...
+                    for (int q = 0 ; q < pattern.size() ; ++q)
+                        if (q != p && pattern.adjacent(p, q)) {
+                            // ... must be mapped to a neighbour of t
+                            vector<int> permitted;
+                            for (int u = 0 ; u < target.size() ; ++u)
+                                if (t != u && target.adjacent(t, u))
+                                    permitted.push_back(u);
+                            params.proof->create_adjacency_constraint(p, q, t, permitted);
+                        }
+                }
+            }
+
+            // output the model file
+            params.proof->finalise_model();
+        }
+
+        // first sanity check: if we're finding an injective mapping, and there
+        // aren't enough vertices, fail immediately.
+        if (is_nonshrinking(params) && (pattern.size() > target.size())) {
+            if (params.proof) {
+                params.proof->failure_due_to_pattern_bigger_than_target();
                 params.proof->finish_unsat_proof();
-            return result;
+            }
+
+            return HomomorphismResult{ };
         }
 
-        HomomorphismResult result;
-        if (1 == params.n_threads) {
-            SequentialSolver solver(model, params);
-            result = solver.solve();
+        // is the pattern a clique? if so, use a clique algorithm instead
+        if (can_use_clique(params) && is_simple_clique(pattern)) {
+            CliqueParams clique_params;
+            clique_params.timeout = params.timeout;
+            clique_params.start_time = params.start_time;
+            clique_params.decide = make_optional(pattern.size());
+            clique_params.restarts_schedule = make_unique<NoRestartsSchedule>();
+            auto clique_result = solve_clique_problem(target, clique_params);
+
+            // now translate the result back into what we expect
+            HomomorphismResult result;
+            int v = 0;
+            for (auto & m : clique_result.clique) {
+                result.mapping.emplace(v++, m);
+                // the clique solver can find a bigger clique than we ask for
+                if (v >= pattern.size())
+                    break;
+            }
+            result.nodes = clique_result.nodes;
+            result.extra_stats = move(clique_result.extra_stats);
+            result.extra_stats.emplace_back("used_clique_solver = true");
+            result.complete = clique_result.complete;
+
+            return result;
         }
         else {
-            if (! params.restarts_schedule->might_restart())
-                throw UnsupportedConfiguration{ "Threaded search requires restarts" };
+            // just solve the problem, preparing the target first if nobody
+            // else has
+            optional<PreparedTarget> our_prepared_target;
+            if (! prepared_target)
+                prepared_target = &our_prepared_target.emplace(target, params);
 
-            unsigned n_threads = how_many_threads(params.n_threads);
-            ThreadedSolver solver(model, params, n_threads);
-            result = solver.solve();
-        }
+            HomomorphismModel model(*prepared_target, pattern, params);
+
+            if (! model.prepare()) {
+                HomomorphismResult result;
+                result.extra_stats.emplace_back("model_consistent = false");
+                result.complete = true;
+                if (params.proof)
+                    params.proof->finish_unsat_proof();
+                return result;
+            }
+
+            auto allocations_before_search = SVOBitset::allocation_stats();
+
+            if (params.work_stealing && params.restarts_schedule->might_restart())
+                throw UnsupportedConfiguration{ "Work stealing cannot be used with restarts" };
 
-        if (params.proof && result.complete && result.mapping.empty())
-            params.proof->finish_unsat_proof();
+            HomomorphismResult result;
+            if (params.deterministic) {
+                if (params.restarts_schedule->might_restart())
+                    throw UnsupportedConfiguration{ "Deterministic search cannot be used with restarts" };
 
-        return result;
+                unsigned n_threads = how_many_threads(params.n_threads);
+                DeterministicSolver solver(model, params, n_threads);
+                result = solver.solve();
+            }
+            else if (1 == params.n_threads) {
+                SequentialSolver solver(model, params);
+                result = solver.solve();
+            }
+            else if (params.work_stealing || ! params.restarts_schedule->might_restart()) {
+                unsigned n_threads = how_many_threads(params.n_threads);
+                WorkStealingSolver solver(model, params, n_threads);
+                result = solver.solve();
+            }
+            else {
+                unsigned n_threads = how_many_threads(params.n_threads);
+                ThreadedSolver solver(model, params, n_threads);
+                result = solver.solve();
+            }
+
+            auto allocations_after_search = SVOBitset::allocation_stats();
+            result.extra_stats.emplace_back("search_bitset_allocations = " + to_string(
+                        allocations_after_search.fresh_allocations - allocations_before_search.fresh_allocations));
+            result.extra_stats.emplace_back("search_bitset_pool_reuses = " + to_string(
+                        allocations_after_search.pool_reuses - allocations_before_search.pool_reuses));
+
+            if (params.proof && result.complete && result.mapping.empty())
+                params.proof->finish_unsat_proof();
+
+            return result;
+        }
     }
 }
 
+auto solve_homomorphism_problem(
+        const InputGraph & pattern,
+        const InputGraph & target,
+        const HomomorphismParams & params) -> HomomorphismResult
+{
+    return solve_homomorphism_problem_using(pattern, target, nullptr, params);
+}
+
+auto solve_homomorphism_problem(
+        const InputGraph & pattern,
+        const InputGraph & target,
+        const PreparedTarget & prepared_target,
+        const HomomorphismParams & params) -> HomomorphismResult
+{
+    return solve_homomorphism_problem_using(pattern, target, &prepared_target, params);
+}
@@ -17,6 +17,8 @@
 #include <memory>
 #include <string>
 
+class PreparedTarget;
+
 enum class Injectivity
 {
     Injective,
@@ -24,6 +26,13 @@ enum class Injectivity
     NonInjective
 };
 
+enum class TargetRepresentation
+{
+    Auto,
+    Dense,
+    Sparse
+};
+
 enum class PropagateUsingLackey
 {
     Never,
@@ -32,14 +41,13 @@ enum class PropagateUsingLackey
     RootAndBackjump
 };
 
-struct HomomorphismParams
+/**
+ * The parameters which are plain values, and so which can be copied, for
+ * example to give every pattern in a batch the same settings. New settings
+ * should go here if they can be copied.
+ */
+struct HomomorphismSettings
 {
-    /// Timeout handler
-    std::shared_ptr<Timeout> timeout;
-
-    /// The start time of the algorithm.
-    std::chrono::time_point<std::chrono::steady_clock> start_time;
-
     /// Induced?
     bool induced = false;
 
@@ -49,22 +57,25 @@ struct HomomorphismParams
     /// Enumerate?
     bool count_solutions = false;
 
-    /// Print solutions, for enumerating
-    std::function<auto (const VertexToVertexMapping &) -> void> enumerate_callback;
-
     /// Which value-ordering heuristic?
     ValueOrdering value_ordering_heuristic = ValueOrdering::Biased;
 
-    /// Restarts schedule
-    std::unique_ptr<RestartsSchedule> restarts_schedule;
-
     /// Largest size of nogood to store (0 disables nogoods)
     unsigned nogood_size_limit = std::numeric_limits<unsigned>::max();
 
-    /// How many threads to use (1 for sequential, 0 to auto-detect). Must be
-    /// used in conjunction with restarts.
+    /// How many threads to use (1 for sequential, 0 to auto-detect). Without
+    /// restarts, threads split the search tree between them.
     unsigned n_threads = 1;
 
+    /// Split the search tree between threads, even if we have restarts?
+    bool work_stealing = false;
+
+    /// Split the search tree in a way that does not depend upon timing, and
+    /// report results in search order, so that the solution, solution count
+    /// and node count don't depend upon the number of threads? Requires no
+    /// restarts.
+    bool deterministic = false;
+
     /// Do one restart before launching remaining threads?
     bool delay_thread_creation = false;
 
@@ -89,20 +100,48 @@ struct HomomorphismParams
     /// Disable neighbourhood degree sequence processing?
     bool no_nds = false;
 
+    /// Build supplemental target graph rows only when they are first needed?
+    bool lazy_supplementals = false;
+
+    /// Store target adjacency as bitset rows, or as sorted neighbour lists?
+    TargetRepresentation target_representation = TargetRepresentation::Auto;
+
     /// Less pattern constraints
     std::list<std::pair<std::string, std::string> > pattern_less_constraints;
 
     /// Occurs less target constraints
     std::list<std::pair<std::string, std::string> > target_occur_less_constraints;
 
-    /// Optional lackey, for external side constraints
-    std::unique_ptr<Lackey> lackey;
-
     /// Send partial solutions to the lackey?
     bool send_partials_to_lackey = false;
 
     /// Propagate using the lackey?
     PropagateUsingLackey propagate_using_lackey = PropagateUsingLackey::Never;
+};
+
+/**
+ * The settings, together with everything which belongs to a single run, or
+ * which can't simply be copied. Anything new added here rather than to
+ * HomomorphismSettings must also be handled by hand in
+ * params_for_batch_pattern in glasgow_subgraph_solver.cc.
+ */
+struct HomomorphismParams : HomomorphismSettings
+{
+    /// Timeout handler
+    std::shared_ptr<Timeout> timeout;
+
+    /// The start time of the algorithm.
+    std::chrono::time_point<std::chrono::steady_clock> start_time;
+
+    /// Print solutions, for enumerating. With threads, this can be called
+    /// from more than one thread at once.
+    std::function<auto (const VertexToVertexMapping &) -> void> enumerate_callback;
+
+    /// Restarts schedule
+    std::unique_ptr<RestartsSchedule> restarts_schedule;
+
+    /// Optional lackey, for external side constraints
+    std::unique_ptr<Lackey> lackey;
 
     /// Optional proof handler
     std::unique_ptr<Proof> proof;
@@ -134,4 +173,14 @@ auto solve_homomorphism_problem(
         const InputGraph & target,
         const HomomorphismParams & params) -> HomomorphismResult;
 
+/**
+ * As above, but reusing a target which has already been prepared, using
+ * compatible parameters.
+ */
+auto solve_homomorphism_problem(
+        const InputGraph & pattern,
+        const InputGraph & target,
+        const PreparedTarget & prepared_target,
+        const HomomorphismParams & params) -> HomomorphismResult;
+
 #endif
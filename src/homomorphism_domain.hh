@@ -19,6 +19,9 @@ struct HomomorphismDomain
 
     HomomorphismDomain(const HomomorphismDomain &) = default;
     HomomorphismDomain(HomomorphismDomain &&) = default;
+
+    auto operator= (const HomomorphismDomain &) -> HomomorphismDomain & = default;
+    auto operator= (HomomorphismDomain &&) -> HomomorphismDomain & = default;
 };
 
 #endif
@@ -3,22 +3,30 @@
 #include "homomorphism_model.hh"
 #include "homomorphism_traits.hh"
 #include "configuration.hh"
+#include "cpu_features.hh"
+#include "supplemental_graphs.hh"
+#include "thread_utils.hh"
 
+#include <algorithm>
+#include <atomic>
 #include <functional>
 #include <list>
-#include <map>
+#include <memory>
+#include <optional>
 #include <set>
 #include <string>
 #include <utility>
 #include <vector>
 
+using std::atomic;
+using std::function;
 using std::greater;
 using std::list;
-using std::map;
-using std::max;
+using std::nullopt;
 using std::optional;
 using std::pair;
 using std::set;
+using std::sort;
 using std::string;
 using std::string_view;
 using std::to_string;
@@ -26,62 +34,100 @@ using std::vector;
 
 namespace
 {
-    auto calculate_n_shape_graphs(const HomomorphismParams & params) -> unsigned
+    // Where, if anywhere, does a target neighbourhood degree sequence fail
+    // to dominate a pattern one? Returns n if it does dominate.
+    auto scalar_first_nds_violation(const unsigned * p, const unsigned * t, unsigned n, bool exact) -> unsigned
     {
-        return 1 +
-            (supports_exact_path_graphs(params) ? params.number_of_exact_path_graphs : 0) +
-            (supports_distance3_graphs(params) ? 1 : 0) +
-            (supports_k4_graphs(params) ? 1 : 0);
+        for (unsigned x = 0 ; x < n ; ++x)
+            if (t[x] < p[x] || (exact && t[x] != p[x]))
+                return x;
+        return n;
+    }
+
+#if defined(GLASGOW_SUBGRAPH_SOLVER_X86_KERNELS)
+    // Degrees always fit in an int, so a signed compare is fine.
+    __attribute__((target("avx2"))) auto avx2_first_nds_violation(const unsigned * p, const unsigned * t, unsigned n, bool exact) -> unsigned
+    {
+        unsigned x = 0;
+        for ( ; x + 8 <= n ; x += 8) {
+            __m256i pv = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + x));
+            __m256i tv = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(t + x));
+            __m256i bad = exact ?
+                _mm256_xor_si256(_mm256_cmpeq_epi32(pv, tv), _mm256_set1_epi32(-1)) :
+                _mm256_cmpgt_epi32(pv, tv);
+            int mask = _mm256_movemask_ps(_mm256_castsi256_ps(bad));
+            if (0 != mask)
+                return x + __builtin_ctz(mask);
+        }
+        return x + scalar_first_nds_violation(p + x, t + x, n - x, exact);
+    }
+#endif
+
+    using FirstNDSViolation = auto (*)(const unsigned *, const unsigned *, unsigned, bool) -> unsigned;
+
+    auto select_first_nds_violation() -> FirstNDSViolation
+    {
+#if defined(GLASGOW_SUBGRAPH_SOLVER_X86_KERNELS)
+        if (cpu_has_avx2())
+            return avx2_first_nds_violation;
+#endif
+        return scalar_first_nds_violation;
+    }
+
+    auto first_nds_violation(const unsigned * p, const unsigned * t, unsigned n, bool exact) -> unsigned
+    {
+        static const FirstNDSViolation selected = select_first_nds_violation();
+        return selected(p, t, n, exact);
     }
 }
 
 struct HomomorphismModel::Imp
 {
     const HomomorphismParams & params;
+    const PreparedTarget & target;
 
     vector<PatternAdjacencyBitsType> pattern_adjacencies_bits;
-    vector<SVOBitset> pattern_graph_rows;
-    vector<SVOBitset> target_graph_rows, forward_target_graph_rows, reverse_target_graph_rows;
+    SVOBitsetSlab pattern_graph_rows;
 
-    vector<vector<int> > patterns_degrees, targets_degrees;
-    int largest_target_degree = 0;
+    vector<vector<int> > patterns_degrees;
     bool has_less_thans = false, has_occur_less_thans = false, directed = false;
 
-    vector<int> pattern_vertex_labels, target_vertex_labels, pattern_edge_labels, target_edge_labels;
-    vector<int> pattern_loops, target_loops;
+    // labels use the target's numbering
+    vector<int> pattern_vertex_labels, pattern_edge_labels;
+    vector<int> pattern_loops;
 
-    vector<string> pattern_vertex_proof_names, target_vertex_proof_names;
+    vector<string> pattern_vertex_proof_names;
 
-    Imp(const HomomorphismParams & p) :
-        params(p)
+    Imp(const HomomorphismParams & p, const PreparedTarget & t) :
+        params(p),
+        target(t)
     {
     }
 };
 
-HomomorphismModel::HomomorphismModel(const InputGraph & target, const InputGraph & pattern, const HomomorphismParams & params) :
-    _imp(new Imp(params)),
+HomomorphismModel::HomomorphismModel(const PreparedTarget & target, const InputGraph & pattern, const HomomorphismParams & params) :
+    _imp(new Imp(params, target)),
     max_graphs(calculate_n_shape_graphs(params)),
     pattern_size(pattern.size()),
-    target_size(target.size())
+    target_size(target.size)
 {
+    if (! target.compatible_with(params))
+        throw UnsupportedConfiguration{ "Target was prepared using incompatible parameters" };
+
     _imp->patterns_degrees.resize(max_graphs);
-    _imp->targets_degrees.resize(max_graphs);
 
     if (max_graphs > 8 * sizeof(PatternAdjacencyBitsType))
         throw UnsupportedConfiguration{ "Supplemental graphs won't fit in the chosen bitset size" };
 
-    if (_imp->params.proof) {
+    if (_imp->params.proof)
         for (int v = 0 ; v < pattern.size() ; ++v)
             _imp->pattern_vertex_proof_names.push_back(pattern.vertex_name(v));
-        for (int v = 0 ; v < target.size() ; ++v)
-            _imp->target_vertex_proof_names.push_back(target.vertex_name(v));
-    }
 
     if (pattern.directed())
         _imp->directed = true;
 
     // recode pattern to a bit graph, and strip out loops
-    _imp->pattern_graph_rows.resize(pattern_size * max_graphs, SVOBitset(pattern_size, 0));
+    _imp->pattern_graph_rows = SVOBitsetSlab{ pattern_size * max_graphs, pattern_size };
     _imp->pattern_loops.resize(pattern_size);
     for (unsigned i = 0 ; i < pattern_size ; ++i) {
         for (unsigned j = 0 ; j < pattern_size ; ++j) {
@@ -94,79 +140,19 @@ HomomorphismModel::HomomorphismModel(const InputGraph & target, const InputGraph
         }
     }
 
-    // re-encode and store pattern labels
-    map<string, int> vertex_labels_map;
-    int next_vertex_label = 1;
+    // store pattern labels, using the target's numbering
     if (pattern.has_vertex_labels()) {
-        for (unsigned i = 0 ; i < pattern_size ; ++i) {
-            if (vertex_labels_map.emplace(pattern.vertex_label(i), next_vertex_label).second)
-                ++next_vertex_label;
-        }
-
         _imp->pattern_vertex_labels.resize(pattern_size);
         for (unsigned i = 0 ; i < pattern_size ; ++i)
-            _imp->pattern_vertex_labels[i] = vertex_labels_map.find(string{ pattern.vertex_label(i) })->second;
+            _imp->pattern_vertex_labels[i] = target.vertex_label_number(pattern.vertex_label(i));
     }
 
-    // re-encode and store edge labels
-    map<string, int> edge_labels_map;
-    int next_edge_label = 1;
     if (pattern.has_edge_labels()) {
         _imp->pattern_edge_labels.resize(pattern_size * pattern_size);
         for (unsigned i = 0 ; i < pattern_size ; ++i)
             for (unsigned j = 0 ; j < pattern_size ; ++j)
-                if (pattern.adjacent(i, j)) {
-                    auto r = edge_labels_map.emplace(pattern.edge_label(i, j), next_edge_label);
-                    if (r.second)
-                        ++next_edge_label;
-                    _imp->pattern_edge_labels[i * pattern_size + j] = r.first->second;
-                }
-    }
-
-    // recode target to a bit graph, and take out loops
-    _imp->target_graph_rows.resize(target_size * max_graphs, SVOBitset{ target_size, 0 });
-    _imp->target_loops.resize(target_size);
-    target.for_each_edge([&] (int f, int t, string_view) {
-        if (f == t)
-            _imp->target_loops[f] = 1;
-        else
-            _imp->target_graph_rows[f * max_graphs + 0].set(t);
-    });
-
-    // if directed, do both directions
-    if (pattern.directed()) {
-        _imp->forward_target_graph_rows.resize(target_size, SVOBitset{ target_size, 0 });
-        _imp->reverse_target_graph_rows.resize(target_size, SVOBitset{ target_size, 0 });
-        target.for_each_edge([&] (int f, int t, string_view l) {
-            if (f != t && l != "unlabelled") {
-                _imp->forward_target_graph_rows[f].set(t);
-                _imp->reverse_target_graph_rows[t].set(f);
-            }
-        });
-    }
-
-    // target vertex labels
-    if (pattern.has_vertex_labels()) {
-        for (unsigned i = 0 ; i < target_size ; ++i) {
-            if (vertex_labels_map.emplace(target.vertex_label(i), next_vertex_label).second)
-                ++next_vertex_label;
-        }
-
-        _imp->target_vertex_labels.resize(target_size);
-        for (unsigned i = 0 ; i < target_size ; ++i)
-            _imp->target_vertex_labels[i] = vertex_labels_map.find(string{ target.vertex_label(i) })->second;
-    }
-
-    // target edge labels
-    if (pattern.has_edge_labels()) {
-        _imp->target_edge_labels.resize(target_size * target_size);
-        target.for_each_edge([&] (int f, int t, string_view l) {
-            auto r = edge_labels_map.emplace(l, next_edge_label);
-            if (r.second)
-                ++next_edge_label;
-
-            _imp->target_edge_labels[f * target_size + t] = r.first->second;
-        });
+                if (pattern.adjacent(i, j))
+                    _imp->pattern_edge_labels[i * pattern_size + j] = target.edge_label_number(pattern.edge_label(i, j));
     }
 
     auto decode = [&] (const InputGraph & g, string_view s) -> int {
@@ -206,39 +192,32 @@ HomomorphismModel::HomomorphismModel(const InputGraph & target, const InputGraph
         }
     }
 
-    // target less than constraints
+    // target less than constraints were decoded when the target was prepared
     if (! _imp->params.target_occur_less_constraints.empty()) {
         _imp->has_occur_less_thans = true;
-        list<pair<unsigned, unsigned> > target_occur_less_thans_in_wrong_order;
-        for (auto & [ a, b ] : _imp->params.target_occur_less_constraints) {
-            auto a_decoded = decode(target, a), b_decoded = decode(target, b);
-            target_occur_less_thans_in_wrong_order.emplace_back(a_decoded, b_decoded);
-        }
-
-        // put them in a convenient order, so we don't need a propagation loop
-        while (! target_occur_less_thans_in_wrong_order.empty()) {
-            bool loop_detect = true;
-            set<unsigned> cannot_order_yet;
-            for (auto & [ _, b ] : target_occur_less_thans_in_wrong_order)
-                cannot_order_yet.emplace(b);
-            for (auto t = target_occur_less_thans_in_wrong_order.begin() ; t != target_occur_less_thans_in_wrong_order.end() ; ) {
-                if (cannot_order_yet.count(t->first))
-                    ++t;
-                else {
-                    loop_detect = false;
-                    target_occur_less_thans_in_convenient_order.push_back(*t);
-                    target_occur_less_thans_in_wrong_order.erase(t++);
-                }
-            }
-
-            if (loop_detect)
-                throw UnsupportedConfiguration{ "Target less than constraints form a loop" };
-        }
+        target_occur_less_thans_in_convenient_order = target.occur_less_thans_in_convenient_order();
     }
 }
 
 HomomorphismModel::~HomomorphismModel() = default;
 
+auto HomomorphismModel::_for_each_target_vertex_candidate(int p, const function<auto (int) -> void> & f) const -> void
+{
+    // only gives target vertices which pass the label and loop checks, and
+    // the degree check for the first graph, without looking at the others
+    optional<int> label = has_vertex_labels() ? optional<int>{ pattern_vertex_label(p) } : nullopt;
+    bool check_degree = degree_and_nds_are_preserved(_imp->params);
+    bool exact = check_degree && degree_and_nds_are_exact(_imp->params, pattern_size, target_size);
+    unsigned degree = check_degree ? pattern_degree(0, p) : 0;
+
+    for (bool loop : { false, true }) {
+        if ((pattern_has_loop(p) && ! loop) || (_imp->params.induced && pattern_has_loop(p) != loop))
+            continue;
+
+        _imp->target.for_each_vertex_with(label, loop, degree, exact, f);
+    }
+}
+
 auto HomomorphismModel::_check_label_compatibility(int p, int t) const -> bool
 {
     if (! has_vertex_labels())
@@ -261,8 +240,7 @@ auto HomomorphismModel::_check_degree_compatibility(
         int p,
         int t,
         unsigned graphs_to_consider,
-        vector<vector<vector<int> > > & patterns_ndss,
-        vector<vector<optional<vector<int> > > > & targets_ndss,
+        const vector<NeighbourhoodDegreeSequences> & patterns_ndss,
         bool do_not_do_nds_yet
         ) const -> bool
 {
@@ -281,11 +259,9 @@ auto HomomorphismModel::_check_degree_compatibility(
                     if (np.test(j))
                         n_p.push_back(j);
 
-                auto nt = target_graph_row(g, t);
-                for (auto j = nt.find_first() ; j != decltype(nt)::npos ; j = nt.find_first()) {
-                    nt.reset(j);
+                target_graph_row(g, t).for_each_set_bit([&] (unsigned j) {
                     n_t.push_back(j);
-                }
+                });
 
                 _imp->params.proof->incompatible_by_degrees(g, pattern_vertex_for_proof(p), n_p,
                         target_vertex_for_proof(t), n_t);
@@ -301,121 +277,146 @@ auto HomomorphismModel::_check_degree_compatibility(
     if (_imp->params.no_nds || do_not_do_nds_yet)
         return true;
 
-    // full compare of neighbourhood degree sequences
-    if (! targets_ndss.at(0).at(t)) {
-        for (unsigned g = 0 ; g < graphs_to_consider ; ++g) {
-            targets_ndss.at(g).at(t) = vector<int>{};
-            auto ni = target_graph_row(g, t);
-            for (auto j = ni.find_first() ; j != decltype(ni)::npos ; j = ni.find_first()) {
-                ni.reset(j);
-                targets_ndss.at(g).at(t)->push_back(target_degree(g, j));
+    // full compare of neighbourhood degree sequences. the degree checks
+    // above mean that t's sequences are at least as long as p's.
+    bool exact = degree_and_nds_are_exact(_imp->params, pattern_size, target_size);
+    for (unsigned g = 0 ; g < graphs_to_consider ; ++g) {
+        auto p_sequence = patterns_ndss[g].sequence(p), t_sequence = _imp->target.neighbourhood_degree_sequences(g).sequence(t);
+        unsigned n = patterns_ndss[g].length(p);
+        unsigned x = first_nds_violation(p_sequence, t_sequence, n, exact);
+        if (x != n) {
+            if (_imp->params.proof && t_sequence[x] < p_sequence[x]) {
+                vector<int> p_subsequence, t_subsequence, t_remaining;
+
+                // need to know the NDS together with the actual vertices
+                vector<pair<int, int> > p_nds, t_nds;
+
+                pattern_graph_row(g, p).for_each_set_bit([&] (unsigned w) {
+                    p_nds.emplace_back(w, pattern_graph_row(g, w).count());
+                });
+
+                target_graph_row(g, t).for_each_set_bit([&] (unsigned w) {
+                    t_nds.emplace_back(w, target_graph_row(g, w).count());
+                });
+
+                sort(p_nds.begin(), p_nds.end(), [] (const pair<int, int> & a, const pair<int, int> & b) {
+                        return a.second > b.second; });
+                sort(t_nds.begin(), t_nds.end(), [] (const pair<int, int> & a, const pair<int, int> & b) {
+                        return a.second > b.second; });
+
+                for (unsigned y = 0 ; y <= x ; ++y) {
+                    p_subsequence.push_back(p_nds[y].first);
+                    t_subsequence.push_back(t_nds[y].first);
+                }
+                for (unsigned y = x + 1 ; y < t_nds.size() ; ++y)
+                    t_remaining.push_back(t_nds[y].first);
+
+                _imp->params.proof->incompatible_by_nds(g, pattern_vertex_for_proof(p),
+                        target_vertex_for_proof(t), p_subsequence, t_subsequence, t_remaining);
             }
-            sort(targets_ndss.at(g).at(t)->begin(), targets_ndss.at(g).at(t)->end(), greater<int>());
+            return false;
         }
     }
 
-    for (unsigned g = 0 ; g < graphs_to_consider ; ++g) {
-        for (unsigned x = 0 ; x < patterns_ndss.at(g).at(p).size() ; ++x) {
-            if (targets_ndss.at(g).at(t)->at(x) < patterns_ndss.at(g).at(p).at(x)) {
-                if (_imp->params.proof) {
-                    vector<int> p_subsequence, t_subsequence, t_remaining;
-
-                    // need to know the NDS together with the actual vertices
-                    vector<pair<int, int> > p_nds, t_nds;
-
-                    auto np = pattern_graph_row(g, p);
-                    for (auto w = np.find_first() ; w != decltype(np)::npos ; w = np.find_first()) {
-                        np.reset(w);
-                        p_nds.emplace_back(w, pattern_graph_row(g, w).count());
-                    }
-
-                    auto nt = target_graph_row(g, t);
-                    for (auto w = nt.find_first() ; w != decltype(nt)::npos ; w = nt.find_first()) {
-                        nt.reset(w);
-                        t_nds.emplace_back(w, target_graph_row(g, w).count());
-                    }
+    return true;
+}
 
-                    sort(p_nds.begin(), p_nds.end(), [] (const pair<int, int> & a, const pair<int, int> & b) {
-                            return a.second > b.second; });
-                    sort(t_nds.begin(), t_nds.end(), [] (const pair<int, int> & a, const pair<int, int> & b) {
-                            return a.second > b.second; });
+auto HomomorphismModel::_build_neighbourhood_degree_sequences(int g) const -> NeighbourhoodDegreeSequences
+{
+    NeighbourhoodDegreeSequences result;
+    result.offsets.resize(pattern_size + 1, 0);
+    for (unsigned v = 0 ; v < pattern_size ; ++v)
+        result.offsets[v + 1] = result.offsets[v] + pattern_degree(g, v);
+    result.degrees.resize(result.offsets[pattern_size]);
 
-                    for (unsigned y = 0 ; y <= x ; ++y) {
-                        p_subsequence.push_back(p_nds[y].first);
-                        t_subsequence.push_back(t_nds[y].first);
-                    }
-                    for (unsigned y = x + 1 ; y < t_nds.size() ; ++y)
-                        t_remaining.push_back(t_nds[y].first);
+    for (unsigned v = 0 ; v < pattern_size ; ++v) {
+        unsigned * out = result.degrees.data() + result.offsets[v];
+        pattern_graph_row(g, v).for_each_set_bit([&] (unsigned w) {
+            *out++ = pattern_degree(g, w);
+        });
 
-                    _imp->params.proof->incompatible_by_nds(g, pattern_vertex_for_proof(p),
-                            target_vertex_for_proof(t), p_subsequence, t_subsequence, t_remaining);
-                }
-                return false;
-            }
-            else if (degree_and_nds_are_exact(_imp->params, pattern_size, target_size)
-                    && targets_ndss.at(g).at(t)->at(x) != patterns_ndss.at(g).at(p).at(x))
-                return false;
-        }
+        sort(result.degrees.data() + result.offsets[v], out, greater<unsigned>());
     }
 
-    return true;
+    return result;
 }
 
 auto HomomorphismModel::initialise_domains(vector<HomomorphismDomain> & domains) const -> bool
 {
-    unsigned graphs_to_consider = max_graphs;
+    // with lazy supplementals, we only look at supplemental degrees for
+    // values which survive everything else, and skip supplemental NDS
+    bool lazy_supplementals = _imp->params.lazy_supplementals && max_graphs > 1;
+    unsigned graphs_to_consider = lazy_supplementals ? 1 : max_graphs;
+
+    /* pattern neighbourhood degree sequences, the target's are prepared */
+    vector<NeighbourhoodDegreeSequences> patterns_ndss;
+    if (degree_and_nds_are_preserved(_imp->params) && ! _imp->params.no_nds)
+        for (unsigned g = 0 ; g < graphs_to_consider ; ++g)
+            patterns_ndss.push_back(_build_neighbourhood_degree_sequences(g));
+
+    // each pattern vertex's domain can be worked out independently, so we do
+    // them in parallel, giving up as soon as any of them is empty. proof
+    // logging always has just one thread, so the proof comes out in order.
+    atomic<bool> some_domain_is_empty{ false };
+    parallel_for_each_block(_imp->params.n_threads, pattern_size, 1, [&] (unsigned, unsigned first, unsigned last) {
+        for (unsigned i = first ; i < last && ! some_domain_is_empty.load() ; ++i) {
+            domains.at(i).v = i;
+            domains.at(i).values.reset();
 
-    /* pattern and target neighbourhood degree sequences */
-    vector<vector<vector<int> > > patterns_ndss(graphs_to_consider);
-    vector<vector<optional<vector<int> > > > targets_ndss(graphs_to_consider);
-
-    if (degree_and_nds_are_preserved(_imp->params) && ! _imp->params.no_nds) {
-        for (unsigned g = 0 ; g < graphs_to_consider ; ++g) {
-            patterns_ndss.at(g).resize(pattern_size);
-            targets_ndss.at(g).resize(target_size);
-        }
-
-        for (unsigned g = 0 ; g < graphs_to_consider ; ++g) {
-            for (unsigned i = 0 ; i < pattern_size ; ++i) {
-                auto ni = pattern_graph_row(g, i);
-                for (auto j = ni.find_first() ; j != decltype(ni)::npos ; j = ni.find_first()) {
-                    ni.reset(j);
-                    patterns_ndss.at(g).at(i).push_back(pattern_degree(g, j));
+            if (_imp->params.proof) {
+                // every value that is thrown out needs to be justified, so
+                // look at everything
+                for (unsigned j = 0 ; j < target_size ; ++j) {
+                    bool ok = true;
+
+                    if (! _check_label_compatibility(i, j))
+                        ok = false;
+                    else if (! _check_loop_compatibility(i, j))
+                        ok = false;
+                    else if (! _check_degree_compatibility(i, j, graphs_to_consider, patterns_ndss, true))
+                        ok = false;
+
+                    if (ok)
+                        domains.at(i).values.set(j);
                 }
-                sort(patterns_ndss.at(g).at(i).begin(), patterns_ndss.at(g).at(i).end(), greater<int>());
             }
-        }
-    }
-
-    for (unsigned i = 0 ; i < pattern_size ; ++i) {
-        domains.at(i).v = i;
-        domains.at(i).values.reset();
-
-        for (unsigned j = 0 ; j < target_size ; ++j) {
-            bool ok = true;
+            else {
+                _for_each_target_vertex_candidate(i, [&] (int j) {
+                    if (_check_degree_compatibility(i, j, graphs_to_consider, patterns_ndss, false))
+                        domains.at(i).values.set(j);
+                });
+            }
 
-            if (! _check_label_compatibility(i, j))
-                ok = false;
-            else if (! _check_loop_compatibility(i, j))
-                ok = false;
-            else if (! _check_degree_compatibility(i, j, graphs_to_consider, patterns_ndss, targets_ndss, _imp->params.proof.get()))
-                ok = false;
+            if (lazy_supplementals && degree_and_nds_are_preserved(_imp->params)) {
+                bool exact = degree_and_nds_are_exact(_imp->params, pattern_size, target_size);
+                domains.at(i).values.for_each_set_bit([&] (unsigned j) {
+                    for (unsigned g = 1 ; g < max_graphs ; ++g) {
+                        // don't build j's rows unless they might tell us something
+                        if (0 == pattern_degree(g, i) && ! exact)
+                            continue;
+                        if (target_degree(g, j) < pattern_degree(g, i) || (exact && target_degree(g, j) != pattern_degree(g, i))) {
+                            domains.at(i).values.reset(j);
+                            break;
+                        }
+                    }
+                });
+            }
 
-            if (ok)
-                domains.at(i).values.set(j);
+            domains.at(i).count = domains.at(i).values.count();
+            if (0 == domains.at(i).count)
+                some_domain_is_empty.store(true);
         }
+    });
 
-        domains.at(i).count = domains.at(i).values.count();
-        if (0 == domains.at(i).count)
-            return false;
-    }
+    if (some_domain_is_empty.load())
+        return false;
 
     // for proof logging, we need degree information before we can output nds proofs
     if (_imp->params.proof && degree_and_nds_are_preserved(_imp->params) && ! _imp->params.no_nds) {
         for (unsigned i = 0 ; i < pattern_size ; ++i) {
             for (unsigned j = 0 ; j < target_size ; ++j) {
                 if (domains.at(i).values.test(j) &&
-                        ! _check_degree_compatibility(i, j, graphs_to_consider, patterns_ndss, targets_ndss, false)) {
+                        ! _check_degree_compatibility(i, j, graphs_to_consider, patterns_ndss, false)) {
                     domains.at(i).values.reset(j);
                     if (0 == --domains.at(i).count)
                         return false;
@@ -436,11 +437,9 @@ auto HomomorphismModel::initialise_domains(vector<HomomorphismDomain> & domains)
                 vector<int> hall_lhs, hall_rhs;
                 for (auto & d : domains)
                     hall_lhs.push_back(d.v);
-                auto dd = domains_union;
-                for (auto v = dd.find_first() ; v != decltype(dd)::npos ; v = dd.find_first()) {
-                    dd.reset(v);
+                domains_union.for_each_set_bit([&] (unsigned v) {
                     hall_rhs.push_back(v);
-                }
+                });
                 _imp->params.proof->emit_hall_set_or_violator(hall_lhs, hall_rhs);
             }
             return false;
@@ -487,9 +486,7 @@ auto HomomorphismModel::pattern_vertex_for_proof(int v) const -> NamedVertex
 
 auto HomomorphismModel::target_vertex_for_proof(int v) const -> NamedVertex
 {
-    if (v < 0 || unsigned(v) >= _imp->target_vertex_proof_names.size())
-        throw ProofError{ "Oops, there's a bug: v out of range in target" };
-    return pair{ v, _imp->target_vertex_proof_names[v] };
+    return _imp->target.vertex_for_proof(v);
 }
 
 auto HomomorphismModel::prepare() -> bool
@@ -497,27 +494,19 @@ auto HomomorphismModel::prepare() -> bool
     if (is_nonshrinking(_imp->params) && (pattern_size > target_size))
         return false;
 
-    // pattern and target degrees, for the main graph
+    // pattern degrees, for the main graph
     _imp->patterns_degrees.at(0).resize(pattern_size);
-    _imp->targets_degrees.at(0).resize(target_size);
-
     for (unsigned i = 0 ; i < pattern_size ; ++i)
         _imp->patterns_degrees.at(0).at(i) = _imp->pattern_graph_rows[i * max_graphs + 0].count();
 
-    for (unsigned i = 0 ; i < target_size ; ++i)
-        _imp->targets_degrees.at(0).at(i) = _imp->target_graph_rows[i * max_graphs + 0].count();
-
     if (global_degree_is_preserved(_imp->params)) {
-        vector<pair<int, int> > p_gds, t_gds;
+        vector<pair<int, int> > p_gds;
         for (unsigned i = 0 ; i < pattern_size ; ++i)
             p_gds.emplace_back(i, _imp->patterns_degrees.at(0).at(i));
-        for (unsigned i = 0 ; i < target_size ; ++i)
-            t_gds.emplace_back(i, _imp->targets_degrees.at(0).at(i));
 
         sort(p_gds.begin(), p_gds.end(), [] (const pair<int, int> & a, const pair<int, int> & b) {
                 return a.second > b.second; });
-        sort(t_gds.begin(), t_gds.end(), [] (const pair<int, int> & a, const pair<int, int> & b) {
-                return a.second > b.second; });
+        auto & t_gds = _imp->target.degrees_in_decreasing_order();
 
         for (unsigned i = 0 ; i < p_gds.size() ; ++i)
             if (p_gds.at(i).second > t_gds.at(i).second) {
@@ -531,11 +520,9 @@ auto HomomorphismModel::prepare() -> bool
 
                         for (unsigned t = i ; t < t_gds.size() ; ++t) {
                             vector<int> n_t;
-                            auto nt = _imp->target_graph_rows[t_gds.at(t).first * max_graphs + 0];
-                            for (auto j = nt.find_first() ; j != decltype(nt)::npos ; j = nt.find_first()) {
-                                nt.reset(j);
+                            target_graph_row(0, t_gds.at(t).first).for_each_set_bit([&] (unsigned j) {
                                 n_t.push_back(j);
-                            }
+                            });
 
                             _imp->params.proof->incompatible_by_degrees(0,
                                     pattern_vertex_for_proof(p_gds.at(p).first), n_p,
@@ -555,11 +542,11 @@ auto HomomorphismModel::prepare() -> bool
             }
     }
 
-    unsigned next_pattern_supplemental = 1, next_target_supplemental = 1;
-    // build exact path graphs
+    // pattern supplemental graphs, the target's were built when it was prepared
+    unsigned next_pattern_supplemental = 1;
     if (supports_exact_path_graphs(_imp->params)) {
-        _build_exact_path_graphs(_imp->pattern_graph_rows, pattern_size, next_pattern_supplemental, _imp->params.number_of_exact_path_graphs, _imp->directed);
-        _build_exact_path_graphs(_imp->target_graph_rows, target_size, next_target_supplemental, _imp->params.number_of_exact_path_graphs, _imp->directed);
+        build_exact_path_graphs(_imp->pattern_graph_rows, pattern_size, max_graphs, next_pattern_supplemental,
+                _imp->params.number_of_exact_path_graphs, _imp->directed, _imp->params.n_threads);
 
         if (_imp->params.proof) {
             for (int g = 1 ; g <= _imp->params.number_of_exact_path_graphs ; ++g) {
@@ -574,42 +561,33 @@ auto HomomorphismModel::prepare() -> bool
                         auto n_p_q = _imp->pattern_graph_rows[p * max_graphs + 0];
                         n_p_q &= _imp->pattern_graph_rows[q * max_graphs + 0];
                         vector<NamedVertex> between_p_and_q;
-                        for (auto v = n_p_q.find_first() ; v != decltype(n_p_q)::npos ; v = n_p_q.find_first()) {
-                            n_p_q.reset(v);
+                        n_p_q.for_each_set_bit([&] (unsigned v) -> bool {
                             between_p_and_q.push_back(pattern_vertex_for_proof(v));
-                            if (between_p_and_q.size() >= unsigned(g))
-                                break;
-                        }
+                            return between_p_and_q.size() < unsigned(g);
+                        });
 
                         for (unsigned t = 0 ; t < target_size ; ++t) {
                             auto named_t = target_vertex_for_proof(t);
 
                             vector<NamedVertex> named_n_t, named_d_n_t;
                             vector<pair<NamedVertex, vector<NamedVertex> > > named_two_away_from_t;
-                            auto n_t = _imp->target_graph_rows[t * max_graphs + 0];
-                            for (auto w = n_t.find_first() ; w != decltype(n_t)::npos ; w = n_t.find_first()) {
-                                n_t.reset(w);
+                            target_graph_row(0, t).for_each_set_bit([&] (unsigned w) {
                                 named_n_t.push_back(target_vertex_for_proof(w));
-                            }
+                            });
 
-                            auto nd_t = _imp->target_graph_rows[t * max_graphs + g];
-                            for (auto w = nd_t.find_first() ; w != decltype(nd_t)::npos ; w = nd_t.find_first()) {
-                                nd_t.reset(w);
+                            target_graph_row(g, t).for_each_set_bit([&] (unsigned w) {
                                 named_d_n_t.push_back(target_vertex_for_proof(w));
-                            }
+                            });
 
-                            auto n2_t = _imp->target_graph_rows[t * max_graphs + 1];
-                            for (auto w = n2_t.find_first() ; w != decltype(n2_t)::npos ; w = n2_t.find_first()) {
-                                n2_t.reset(w);
-                                auto n_t_w = _imp->target_graph_rows[w * max_graphs + 0];
-                                n_t_w &= _imp->target_graph_rows[t * max_graphs + 0];
+                            target_graph_row(1, t).for_each_set_bit([&] (unsigned w) {
+                                auto n_t_w = target_graph_row(0, w);
+                                n_t_w &= target_graph_row(0, t);
                                 vector<NamedVertex> named_n_t_w;
-                                for (auto x = n_t_w.find_first() ; x != decltype(n_t_w)::npos ; x = n_t_w.find_first()) {
-                                    n_t_w.reset(x);
+                                n_t_w.for_each_set_bit([&] (unsigned x) {
                                     named_n_t_w.push_back(target_vertex_for_proof(x));
-                                }
+                                });
                                 named_two_away_from_t.emplace_back(target_vertex_for_proof(w), named_n_t_w);
-                            }
+                            });
 
                             _imp->params.proof->create_exact_path_graphs(g, named_p, named_q, between_p_and_q,
                                     named_t, named_n_t, named_two_away_from_t, named_d_n_t);
@@ -620,37 +598,23 @@ auto HomomorphismModel::prepare() -> bool
         }
     }
 
-    if (supports_distance3_graphs(_imp->params)) {
-        _build_distance3_graphs(_imp->pattern_graph_rows, pattern_size, next_pattern_supplemental);
-        _build_distance3_graphs(_imp->target_graph_rows, target_size, next_target_supplemental);
-    }
+    if (supports_distance3_graphs(_imp->params))
+        build_distance3_graphs(_imp->pattern_graph_rows, pattern_size, max_graphs, next_pattern_supplemental, _imp->params.n_threads);
 
-    if (supports_k4_graphs(_imp->params)) {
-        _build_k4_graphs(_imp->pattern_graph_rows, pattern_size, next_pattern_supplemental);
-        _build_k4_graphs(_imp->target_graph_rows, target_size, next_target_supplemental);
-    }
+    if (supports_k4_graphs(_imp->params))
+        build_k4_graphs(_imp->pattern_graph_rows, pattern_size, max_graphs, next_pattern_supplemental, _imp->params.n_threads);
 
-    if (next_pattern_supplemental != max_graphs || next_target_supplemental != max_graphs)
+    if (next_pattern_supplemental != max_graphs)
         throw UnsupportedConfiguration{ "something has gone wrong with supplemental graph indexing: " + to_string(next_pattern_supplemental)
-            + " " + to_string(next_target_supplemental) + " " + to_string(max_graphs) };
+            + " " + to_string(max_graphs) };
 
-    // pattern and target degrees, for supplemental graphs
+    // pattern degrees, for supplemental graphs
     for (unsigned g = 1 ; g < max_graphs ; ++g) {
         _imp->patterns_degrees.at(g).resize(pattern_size);
-        _imp->targets_degrees.at(g).resize(target_size);
-    }
-
-    for (unsigned g = 1 ; g < max_graphs ; ++g) {
         for (unsigned i = 0 ; i < pattern_size ; ++i)
             _imp->patterns_degrees.at(g).at(i) = _imp->pattern_graph_rows[i * max_graphs + g].count();
-
-        for (unsigned i = 0 ; i < target_size ; ++i)
-            _imp->targets_degrees.at(g).at(i) = _imp->target_graph_rows[i * max_graphs + g].count();
     }
 
-    for (unsigned i = 0 ; i < target_size ; ++i)
-        _imp->largest_target_degree = max(_imp->largest_target_degree, _imp->targets_degrees[0][i]);
-
     // pattern adjacencies, compressed
     _imp->pattern_adjacencies_bits.resize(pattern_size * pattern_size);
     for (unsigned g = 0 ; g < max_graphs ; ++g)
@@ -662,117 +626,49 @@ auto HomomorphismModel::prepare() -> bool
     return true;
 }
 
-auto HomomorphismModel::_build_exact_path_graphs(vector<SVOBitset> & graph_rows, unsigned size, unsigned & idx,
-        unsigned number_of_exact_path_graphs, bool directed) -> void
+auto HomomorphismModel::pattern_adjacency_bits(int p, int q) const -> PatternAdjacencyBitsType
 {
-    vector<vector<unsigned> > path_counts(size, vector<unsigned>(size, 0));
-
-    // count number of paths from w to v (unless directed, only w >= v, so not v to w)
-    for (unsigned v = 0 ; v < size ; ++v) {
-        auto nv = graph_rows[v * max_graphs + 0];
-        for (auto c = nv.find_first() ; c != decltype(nv)::npos ; c = nv.find_first()) {
-            nv.reset(c);
-            auto nc = graph_rows[c * max_graphs + 0];
-            for (auto w = nc.find_first() ; w != decltype(nc)::npos && (directed ? true : w <= v) ; w = nc.find_first()) {
-                nc.reset(w);
-                ++path_counts[v][w];
-            }
-        }
-    }
-
-    for (unsigned v = 0 ; v < size ; ++v) {
-        for (unsigned w = (directed ? 0 : v) ; w < size ; ++w) {
-            // unless directed, w to v, not v to w, see above
-            unsigned path_count = path_counts[w][v];
-            for (unsigned p = 1 ; p <= number_of_exact_path_graphs ; ++p) {
-                if (path_count >= p) {
-                    graph_rows[v * max_graphs + idx + p - 1].set(w);
-                    if (! directed)
-                        graph_rows[w * max_graphs + idx + p - 1].set(v);
-                }
-            }
-        }
-    }
-
-    idx += number_of_exact_path_graphs;
+    return _imp->pattern_adjacencies_bits[pattern_size * p + q];
 }
 
-auto HomomorphismModel::_build_distance3_graphs(vector<SVOBitset> & graph_rows, unsigned size, unsigned & idx) -> void
+auto HomomorphismModel::pattern_graph_row(int g, int p) const -> const SVOBitset &
 {
-    for (unsigned v = 0 ; v < size ; ++v) {
-        auto nv = graph_rows[v * max_graphs + 0];
-        for (auto c = nv.find_first() ; c != decltype(nv)::npos ; c = nv.find_first()) {
-            nv.reset(c);
-            auto nc = graph_rows[c * max_graphs + 0];
-            for (auto w = nc.find_first() ; w != decltype(nc)::npos ; w = nc.find_first()) {
-                nc.reset(w);
-                // v--c--w so v is within distance 3 of w's neighbours
-                graph_rows[v * max_graphs + idx] |= graph_rows[w * max_graphs + 0];
-            }
-        }
-    }
+    return _imp->pattern_graph_rows[p * max_graphs + g];
+}
 
-    ++idx;
-}
-
-auto HomomorphismModel::_build_k4_graphs(vector<SVOBitset> & graph_rows, unsigned size, unsigned & idx) -> void
-{
-    for (unsigned v = 0 ; v < size ; ++v) {
-        auto nv = graph_rows[v * max_graphs + 0];
-        for (unsigned w = 0 ; w < v ; ++w) {
-            if (nv.test(w)) {
-                // are there two common neighbours with an edge between them?
-                auto common_neighbours = graph_rows[w * max_graphs + 0];
-                common_neighbours &= nv;
-                common_neighbours.reset(v);
-                common_neighbours.reset(w);
-                auto count = common_neighbours.count();
-                if (count >= 2) {
-                    bool done = false;
-                    auto cn1 = common_neighbours;
-                    for (auto x = cn1.find_first() ; x != decltype(cn1)::npos && ! done ; x = cn1.find_first()) {
-                        cn1.reset(x);
-                        auto cn2 = common_neighbours;
-                        for (auto y = cn2.find_first() ; y != decltype(cn2)::npos && ! done ; y = cn2.find_first()) {
-                            cn2.reset(y);
-                            if (v != w && v != x && v != y && w != x && w != y && graph_rows[x * max_graphs + 0].test(y)) {
-                                graph_rows[v * max_graphs + idx].set(w);
-                                graph_rows[w * max_graphs + idx].set(v);
-                                done = true;
-                            }
-                        }
-                    }
-                }
-            }
-        }
-    }
+auto HomomorphismModel::target_graph_row(int g, int t) const -> const SVOBitset &
+{
+    return _imp->target.graph_row(g, t);
+}
 
-    ++idx;
+auto HomomorphismModel::forward_target_graph_row(int t) const -> const SVOBitset &
+{
+    return _imp->target.forward_graph_row(t);
 }
 
-auto HomomorphismModel::pattern_adjacency_bits(int p, int q) const -> PatternAdjacencyBitsType
+auto HomomorphismModel::reverse_target_graph_row(int t) const -> const SVOBitset &
 {
-    return _imp->pattern_adjacencies_bits[pattern_size * p + q];
+    return _imp->target.reverse_graph_row(t);
 }
 
-auto HomomorphismModel::pattern_graph_row(int g, int p) const -> const SVOBitset &
+auto HomomorphismModel::sparse_target() const -> bool
 {
-    return _imp->pattern_graph_rows[p * max_graphs + g];
+    return _imp->target.sparse();
 }
 
-auto HomomorphismModel::target_graph_row(int g, int t) const -> const SVOBitset &
+auto HomomorphismModel::sparse_target_graph_row(int g, int t) const -> SparseTargetRow
 {
-    return _imp->target_graph_rows[t * max_graphs + g];
+    return _imp->target.sparse_graph_row(g, t);
 }
 
-auto HomomorphismModel::forward_target_graph_row(int t) const -> const SVOBitset &
+auto HomomorphismModel::sparse_forward_target_graph_row(int t) const -> SparseTargetRow
 {
-    return _imp->forward_target_graph_rows[t];
+    return _imp->target.sparse_forward_graph_row(t);
 }
 
-auto HomomorphismModel::reverse_target_graph_row(int t) const -> const SVOBitset &
+auto HomomorphismModel::sparse_reverse_target_graph_row(int t) const -> SparseTargetRow
 {
-    return _imp->reverse_target_graph_rows[t];
+    return _imp->target.sparse_reverse_graph_row(t);
 }
 
 auto HomomorphismModel::pattern_degree(int g, int p) const -> unsigned
@@ -782,12 +678,12 @@ auto HomomorphismModel::pattern_degree(int g, int p) const -> unsigned
 
 auto HomomorphismModel::target_degree(int g, int t) const -> unsigned
 {
-    return _imp->targets_degrees[g][t];
+    return _imp->target.degree(g, t);
 }
 
 auto HomomorphismModel::largest_target_degree() const -> unsigned
 {
-    return _imp->largest_target_degree;
+    return _imp->target.largest_degree();
 }
 
 auto HomomorphismModel::has_vertex_labels() const -> bool
@@ -807,7 +703,7 @@ auto HomomorphismModel::pattern_vertex_label(int p) const -> int
 
 auto HomomorphismModel::target_vertex_label(int t) const -> int
 {
-    return _imp->target_vertex_labels[t];
+    return _imp->target.vertex_label(t);
 }
 
 auto HomomorphismModel::pattern_edge_label(int p, int q) const -> int
@@ -817,7 +713,7 @@ auto HomomorphismModel::pattern_edge_label(int p, int q) const -> int
 
 auto HomomorphismModel::target_edge_label(int t, int u) const -> int
 {
-    return _imp->target_edge_labels[t * target_size + u];
+    return _imp->target.edge_label(t, u);
 }
 
 auto HomomorphismModel::pattern_has_loop(int p) const -> bool
@@ -827,7 +723,7 @@ auto HomomorphismModel::pattern_has_loop(int p) const -> bool
 
 auto HomomorphismModel::target_has_loop(int t) const -> bool
 {
-    return _imp->target_loops[t];
+    return _imp->target.has_loop(t);
 }
 
 auto HomomorphismModel::has_less_thans() const -> bool
@@ -844,4 +740,3 @@ auto HomomorphismModel::directed() const -> bool
 {
     return _imp->directed;
 }
-
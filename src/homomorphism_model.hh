@@ -7,6 +7,7 @@
 #include "svo_bitset.hh"
 #include "homomorphism.hh"
 #include "homomorphism_domain.hh"
+#include "prepared_target.hh"
 #include "proof.hh"
 
 #include <memory>
@@ -17,24 +18,20 @@ class HomomorphismModel
         struct Imp;
         std::unique_ptr<Imp> _imp;
 
-        auto _build_exact_path_graphs(std::vector<SVOBitset> & graph_rows, unsigned size, unsigned & idx,
-                unsigned number_of_exact_path_graphs, bool directed) -> void;
-
-        auto _build_distance3_graphs(std::vector<SVOBitset> & graph_rows, unsigned size, unsigned & idx) -> void;
-
-        auto _build_k4_graphs(std::vector<SVOBitset> & graph_rows, unsigned size, unsigned & idx) -> void;
+        auto _build_neighbourhood_degree_sequences(int g) const -> NeighbourhoodDegreeSequences;
 
         auto _check_degree_compatibility(
                 int p,
                 int t,
                 unsigned graphs_to_consider,
-                std::vector<std::vector<std::vector<int> > > & patterns_ndss,
-                std::vector<std::vector<std::optional<std::vector<int> > > > & targets_ndss,
+                const std::vector<NeighbourhoodDegreeSequences> & patterns_ndss,
                 bool do_not_do_nds_yet
                 ) const -> bool;
 
         auto _check_loop_compatibility(int p, int t) const -> bool;
 
+        auto _for_each_target_vertex_candidate(int p, const std::function<auto (int) -> void> & f) const -> void;
+
         auto _check_label_compatibility(int p, int t) const -> bool;
 
     public:
@@ -47,7 +44,11 @@ class HomomorphismModel
         auto has_occur_less_thans() const -> bool;
         std::vector<std::pair<unsigned, unsigned> > pattern_less_thans_in_convenient_order, target_occur_less_thans_in_convenient_order;
 
-        HomomorphismModel(const InputGraph & target, const InputGraph & pattern, const HomomorphismParams & params);
+        /**
+         * The target must have been prepared using compatible parameters,
+         * and must outlive the model.
+         */
+        HomomorphismModel(const PreparedTarget & target, const InputGraph & pattern, const HomomorphismParams & params);
         ~HomomorphismModel();
 
         auto pattern_vertex_for_proof(int v) const -> NamedVertex;
@@ -62,6 +63,17 @@ class HomomorphismModel
         auto forward_target_graph_row(int t) const -> const SVOBitset &;
         auto reverse_target_graph_row(int t) const -> const SVOBitset &;
 
+        /**
+         * Are target rows stored as sorted neighbour lists? If so, the
+         * sparse_*_row() functions must be used instead of the
+         * *_graph_row() functions for the target.
+         */
+        auto sparse_target() const -> bool;
+
+        auto sparse_target_graph_row(int g, int t) const -> SparseTargetRow;
+        auto sparse_forward_target_graph_row(int t) const -> SparseTargetRow;
+        auto sparse_reverse_target_graph_row(int t) const -> SparseTargetRow;
+
         auto pattern_degree(int g, int p) const -> unsigned;
         auto target_degree(int g, int t) const -> unsigned;
         auto largest_target_degree() const -> unsigned;
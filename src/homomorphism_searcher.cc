@@ -18,11 +18,37 @@ using std::to_string;
 using std::uniform_int_distribution;
 using std::vector;
 
+namespace
+{
+    auto intersect_with_row(SVOBitset & values, const SVOBitset & row) -> unsigned
+    {
+        return values.intersect_and_count(row);
+    }
+
+    auto intersect_with_row(SVOBitset & values, const SparseTargetRow & row) -> unsigned
+    {
+        values.intersect_with_sorted_indices(row.first, row.last);
+        return values.count();
+    }
+
+    auto intersect_with_complement_of_row(SVOBitset & values, const SVOBitset & row) -> unsigned
+    {
+        return values.intersect_with_complement_and_count(row);
+    }
+
+    auto intersect_with_complement_of_row(SVOBitset & values, const SparseTargetRow & row) -> unsigned
+    {
+        values.intersect_with_complement_of_indices(row.first, row.last);
+        return values.count();
+    }
+}
+
 HomomorphismSearcher::HomomorphismSearcher(const HomomorphismModel & m, const HomomorphismParams & p,
         const DuplicateSolutionFilterer & d) :
     model(m),
     params(p),
-    _duplicate_solution_filterer(d)
+    _duplicate_solution_filterer(d),
+    storage_at_depth(model.pattern_size + 1)
 {
     if (might_have_watches(params)) {
         watches.table.target_size = model.target_size;
@@ -76,7 +102,7 @@ auto HomomorphismSearcher::restarting_search(
         int depth,
         RestartsSchedule & restarts_schedule) -> SearchResult
 {
-    if (params.timeout->should_abort())
+    if (params.timeout->should_abort() || (_work_donation && _work_donation->abandon && _work_donation->abandon()))
         return SearchResult::Aborted;
 
     ++nodes;
@@ -106,10 +132,11 @@ auto HomomorphismSearcher::restarting_search(
             // we could be finding duplicate solutions, in threaded search
             if (_duplicate_solution_filterer(assignments)) {
                 ++solution_count;
-                if (params.enumerate_callback) {
+                auto & enumerate = (_work_donation && _work_donation->enumerate) ? _work_donation->enumerate : params.enumerate_callback;
+                if (enumerate) {
                     VertexToVertexMapping mapping;
                     expand_to_full_result(assignments, mapping);
-                    params.enumerate_callback(mapping);
+                    enumerate(mapping);
                 }
             }
 
@@ -120,15 +147,14 @@ auto HomomorphismSearcher::restarting_search(
     }
 
     // pull out the remaining values in this domain for branching
-    auto remaining = branch_domain->values;
-
-    vector<int> branch_v(model.target_size);
+    auto & storage = storage_at_depth[depth];
+    auto & branch_v = storage.branch_v;
+    branch_v.resize(model.target_size);
 
     unsigned branch_v_end = 0;
-    for (auto f_v = remaining.find_first() ; f_v != decltype(remaining)::npos ; f_v = remaining.find_first()) {
-        remaining.reset(f_v);
+    branch_domain->values.for_each_set_bit([&] (unsigned f_v) {
         branch_v[branch_v_end++] = f_v;
-    }
+    });
 
     switch (params.value_ordering_heuristic) {
         case ValueOrdering::Degree:
@@ -154,8 +180,23 @@ auto HomomorphismSearcher::restarting_search(
     // override whether we use the lackey for propagation, in case we are inside a backjump
     bool use_lackey_for_propagation = false;
 
+    auto give_away = [&] (auto first, auto last, int first_discrepancy_count) {
+        vector<HomomorphismAssignmentInformation> values;
+        for (auto d = first ; d != last ; ++d)
+            values.push_back({ { branch_domain->v, unsigned(*d) }, true, first_discrepancy_count + int(d - first), int(branch_v_end) });
+        _work_donation->donate(assignments, values);
+    };
+
     // for each value remaining...
     for (auto f_v = branch_v.begin(), f_end = branch_v.begin() + branch_v_end ; f_v != f_end ; ++f_v) {
+        // if another thread is idle, give it the values we haven't tried yet
+        if (_work_donation && depth < _work_donation->max_depth && f_v + 1 != f_end && _work_donation->wanted()) {
+            give_away(f_v + 1, f_end, discrepancy_count + 1);
+            f_end = f_v + 1;
+            if (_work_donation->in_search_order)
+                _give_away_above_depth = max(_give_away_above_depth, depth);
+        }
+
         if (params.proof)
             params.proof->guessing(depth, model.pattern_vertex_for_proof(branch_domain->v), model.target_vertex_for_proof(*f_v));
 
@@ -166,7 +207,8 @@ auto HomomorphismSearcher::restarting_search(
         assignments.values.push_back({ { branch_domain->v, unsigned(*f_v) }, true, discrepancy_count, int(branch_v_end) });
 
         // set up new domains
-        Domains new_domains = copy_nonfixed_domains_and_make_assignment(domains, branch_domain->v, *f_v);
+        auto & new_domains = storage.domains;
+        copy_nonfixed_domains_and_make_assignment(domains, branch_domain->v, *f_v, new_domains);
 
         // propagate
         ++propagations;
@@ -237,6 +279,12 @@ auto HomomorphismSearcher::restarting_search(
         }
 
         ++discrepancy_count;
+
+        // something deeper was given away, so everything after it must be too
+        if (depth < _give_away_above_depth && f_v + 1 != f_end) {
+            give_away(f_v + 1, f_end, discrepancy_count);
+            f_end = f_v + 1;
+        }
     }
 
     // no values remaining, backtrack, or possibly kick off a restart
@@ -256,6 +304,29 @@ auto HomomorphismSearcher::restarting_search(
         return use_lackey_for_propagation ? SearchResult::UnsatisfiableAndBackjumpUsingLackey : SearchResult::Unsatisfiable;
 }
 
+auto HomomorphismSearcher::replay(
+        const vector<HomomorphismAssignmentInformation> & decisions,
+        Domains & domains,
+        HomomorphismAssignments & assignments,
+        unsigned long long & propagations) -> bool
+{
+    _give_away_above_depth = -1;
+
+    Domains new_domains;
+    for (auto & d : decisions) {
+        assignments.values.push_back(d);
+        copy_nonfixed_domains_and_make_assignment(domains, d.assignment.pattern_vertex, d.assignment.target_vertex, new_domains);
+
+        ++propagations;
+        if (! propagate(new_domains, assignments, params.propagate_using_lackey == PropagateUsingLackey::Always))
+            return false;
+
+        swap(domains, new_domains);
+    }
+
+    return true;
+}
+
 auto HomomorphismSearcher::degree_sort(
         vector<int> & branch_v,
         unsigned branch_v_end,
@@ -327,22 +398,32 @@ auto HomomorphismSearcher::post_nogood(const HomomorphismAssignments & assignmen
 auto HomomorphismSearcher::copy_nonfixed_domains_and_make_assignment(
         const Domains & domains,
         unsigned branch_v,
-        unsigned f_v) -> Domains
+        unsigned f_v,
+        Domains & new_domains) -> void
 {
-    Domains new_domains;
-    new_domains.reserve(domains.size());
+    // assign over whatever is already in new_domains where we can, so that
+    // bitsets reuse their existing storage
+    unsigned n = 0;
     for (auto & d : domains) {
         if (d.fixed)
             continue;
 
-        new_domains.push_back(d);
+        if (n < new_domains.size())
+            new_domains[n] = d;
+        else
+            new_domains.push_back(d);
+
         if (d.v == branch_v) {
-            new_domains.back().values.reset();
-            new_domains.back().values.set(f_v);
-            new_domains.back().count = 1;
+            new_domains[n].values.reset();
+            new_domains[n].values.set(f_v);
+            new_domains[n].count = 1;
         }
+
+        ++n;
     }
-    return new_domains;
+
+    if (n < new_domains.size())
+        new_domains.erase(new_domains.begin() + n, new_domains.end());
 }
 
 auto HomomorphismSearcher::find_branch_domain(const Domains & domains) -> const HomomorphismDomain *
@@ -357,21 +438,45 @@ auto HomomorphismSearcher::find_branch_domain(const Domains & domains) -> const
     return result;
 }
 
-template <bool directed_, bool has_edge_labels_, bool induced_>
+template <bool directed_, bool has_edge_labels_, bool induced_, bool sparse_>
 auto HomomorphismSearcher::propagate_adjacency_constraints(HomomorphismDomain & d, const HomomorphismAssignment & current_assignment) -> void
 {
     const auto & graph_pairs_to_consider = model.pattern_adjacency_bits(current_assignment.pattern_vertex, d.v);
 
+    auto target_graph_row = [&] (int g) -> decltype(auto) {
+        if constexpr (sparse_)
+            return model.sparse_target_graph_row(g, current_assignment.target_vertex);
+        else
+            return model.target_graph_row(g, current_assignment.target_vertex);
+    };
+
+    auto forward_target_graph_row = [&] () -> decltype(auto) {
+        if constexpr (sparse_)
+            return model.sparse_forward_target_graph_row(current_assignment.target_vertex);
+        else
+            return model.forward_target_graph_row(current_assignment.target_vertex);
+    };
+
+    auto reverse_target_graph_row = [&] () -> decltype(auto) {
+        if constexpr (sparse_)
+            return model.sparse_reverse_target_graph_row(current_assignment.target_vertex);
+        else
+            return model.reverse_target_graph_row(current_assignment.target_vertex);
+    };
+
+    // intersecting also counts, otherwise d.count is already correct
+    optional<unsigned> new_count;
+
     if constexpr (! directed_) {
         // for the original graph pair, if we're adjacent...
         if (graph_pairs_to_consider & (1u << 0)) {
             // ...then we can only be mapped to adjacent vertices
-            d.values &= model.target_graph_row(0, current_assignment.target_vertex);
+            new_count = intersect_with_row(d.values, target_graph_row(0));
         }
         else {
             if constexpr (induced_) {
                 // ...otherwise we can only be mapped to adjacent vertices
-                d.values.intersect_with_complement(model.target_graph_row(0, current_assignment.target_vertex));
+                new_count = intersect_with_complement_of_row(d.values, target_graph_row(0));
             }
         }
     }
@@ -379,12 +484,12 @@ auto HomomorphismSearcher::propagate_adjacency_constraints(HomomorphismDomain &
         // both forward and reverse edges to consider
         if (graph_pairs_to_consider & (1u << 0)) {
             // ...then we can only be mapped to adjacent vertices
-            d.values &= model.forward_target_graph_row(current_assignment.target_vertex);
+            new_count = intersect_with_row(d.values, forward_target_graph_row());
         }
         else {
             if constexpr (induced_) {
                 // ...otherwise we can only be mapped to adjacent vertices
-                d.values.intersect_with_complement(model.forward_target_graph_row(current_assignment.target_vertex));
+                new_count = intersect_with_complement_of_row(d.values, forward_target_graph_row());
             }
         }
 
@@ -392,12 +497,12 @@ auto HomomorphismSearcher::propagate_adjacency_constraints(HomomorphismDomain &
 
         if (reverse_edge_graph_pairs_to_consider & (1u << 0)) {
             // ...then we can only be mapped to adjacent vertices
-            d.values &= model.reverse_target_graph_row(current_assignment.target_vertex);
+            new_count = intersect_with_row(d.values, reverse_target_graph_row());
         }
         else {
             if constexpr (induced_) {
                 // ...otherwise we can only be mapped to adjacent vertices
-                d.values.intersect_with_complement(model.reverse_target_graph_row(current_assignment.target_vertex));
+                new_count = intersect_with_complement_of_row(d.values, reverse_target_graph_row());
             }
         }
     }
@@ -407,41 +512,66 @@ auto HomomorphismSearcher::propagate_adjacency_constraints(HomomorphismDomain &
         // if we're adjacent...
         if (graph_pairs_to_consider & (1u << g)) {
             // ...then we can only be mapped to adjacent vertices
-            d.values &= model.target_graph_row(g, current_assignment.target_vertex);
+            new_count = intersect_with_row(d.values, target_graph_row(g));
         }
     }
 
+    if (new_count)
+        d.count = *new_count;
+
     if constexpr (has_edge_labels_) {
         // if we're adjacent in the original graph, additionally the edge labels need to match up
         if (graph_pairs_to_consider & (1u << 0)) {
-            auto check_d_values = d.values;
-
             auto want_forward_label = model.pattern_edge_label(current_assignment.pattern_vertex, d.v);
-            for (auto c = check_d_values.find_first() ; c != decltype(check_d_values)::npos ; c = check_d_values.find_first()) {
-                check_d_values.reset(c);
-
+            d.values.for_each_set_bit([&] (unsigned c) {
                 auto got_forward_label = model.target_edge_label(current_assignment.target_vertex, c);
-                if (got_forward_label != want_forward_label)
+                if (got_forward_label != want_forward_label) {
                     d.values.reset(c);
-            }
+                    --d.count;
+                }
+            });
         }
 
         const auto & reverse_edge_graph_pairs_to_consider = model.pattern_adjacency_bits(d.v, current_assignment.pattern_vertex);
         if (reverse_edge_graph_pairs_to_consider & (1u << 0)) {
-            auto check_d_values = d.values;
-
             auto want_reverse_label = model.pattern_edge_label(d.v, current_assignment.pattern_vertex);
-            for (auto c = check_d_values.find_first() ; c != decltype(check_d_values)::npos ; c = check_d_values.find_first()) {
-                check_d_values.reset(c);
-
+            d.values.for_each_set_bit([&] (unsigned c) {
                 auto got_reverse_label = model.target_edge_label(c, current_assignment.target_vertex);
-                if (got_reverse_label != want_reverse_label)
+                if (got_reverse_label != want_reverse_label) {
                     d.values.reset(c);
-            }
+                    --d.count;
+                }
+            });
         }
     }
 }
 
+template <bool sparse_>
+auto HomomorphismSearcher::propagate_adjacency_constraints_for_representation(HomomorphismDomain & d, const HomomorphismAssignment & current_assignment) -> void
+{
+    if (! model.has_edge_labels()) {
+        if (params.induced) {
+            if (model.directed())
+                propagate_adjacency_constraints<true, false, true, sparse_>(d, current_assignment);
+            else
+                propagate_adjacency_constraints<false, false, true, sparse_>(d, current_assignment);
+        }
+        else {
+            if (model.directed())
+                propagate_adjacency_constraints<true, false, false, sparse_>(d, current_assignment);
+            else
+                propagate_adjacency_constraints<false, false, false, sparse_>(d, current_assignment);
+        }
+    }
+    else {
+        // edge labels are always directed
+        if (params.induced)
+            propagate_adjacency_constraints<true, true, true, sparse_>(d, current_assignment);
+        else
+            propagate_adjacency_constraints<true, true, false, sparse_>(d, current_assignment);
+    }
+}
+
 auto HomomorphismSearcher::both_in_the_neighbourhood_of_some_vertex(unsigned v, unsigned w) -> bool
 {
     auto i = model.pattern_graph_row(0, v);
@@ -459,41 +589,25 @@ auto HomomorphismSearcher::propagate_simple_constraints(Domains & new_domains, c
         // injectivity
         switch (params.injectivity) {
             case Injectivity::Injective:
-                d.values.reset(current_assignment.target_vertex);
+                if (d.values.reset(current_assignment.target_vertex))
+                    --d.count;
                 break;
             case Injectivity::LocallyInjective:
                 if (both_in_the_neighbourhood_of_some_vertex(current_assignment.pattern_vertex, d.v))
-                    d.values.reset(current_assignment.target_vertex);
+                    if (d.values.reset(current_assignment.target_vertex))
+                        --d.count;
                 break;
             case Injectivity::NonInjective:
                 break;
         }
 
         // adjacency
-        if (! model.has_edge_labels()) {
-            if (params.induced) {
-                if (model.directed())
-                    propagate_adjacency_constraints<true, false, true>(d, current_assignment);
-                else
-                    propagate_adjacency_constraints<false, false, true>(d, current_assignment);
-            }
-            else {
-                if (model.directed())
-                    propagate_adjacency_constraints<true, false, false>(d, current_assignment);
-                else
-                    propagate_adjacency_constraints<false, false, false>(d, current_assignment);
-            }
-        }
-        else {
-            // edge labels are always directed
-            if (params.induced)
-                propagate_adjacency_constraints<true, true, true>(d, current_assignment);
-            else
-                propagate_adjacency_constraints<true, true, false>(d, current_assignment);
-        }
+        if (model.sparse_target())
+            propagate_adjacency_constraints_for_representation<true>(d, current_assignment);
+        else
+            propagate_adjacency_constraints_for_representation<false>(d, current_assignment);
 
-        // we might have removed values
-        d.count = d.values.count();
+        // we might have removed values, and adjacency will have updated the count
         if (0 == d.count)
             return false;
     }
@@ -523,14 +637,15 @@ auto HomomorphismSearcher::propagate_less_thans(Domains & new_domains) -> bool
        if (first_allowed_b >= model.target_size)
            return false;
 
-       for (auto v = b_domain.values.find_first() ; v != decltype(b_domain.values)::npos ; v = b_domain.values.find_first()) {
+       b_domain.values.for_each_set_bit([&] (unsigned v) -> bool {
            if (v >= first_allowed_b)
-               break;
+               return false;
            b_domain.values.reset(v);
-       }
+           --b_domain.count;
+           return true;
+       });
 
        // b might have shrunk (and detect empty before the next bit to make life easier)
-       b_domain.count = b_domain.values.count();
        if (0 == b_domain.count)
            return false;
     }
@@ -542,26 +657,20 @@ auto HomomorphismSearcher::propagate_less_thans(Domains & new_domains) -> bool
         auto & b_domain = new_domains[find_domain[b]];
 
         // last value of a must be at least one before the last possible value of b
-        auto b_values_copy = b_domain.values;
-        auto last_b = b_domain.values.find_first();
-        for (auto v = last_b ; v != decltype(b_values_copy)::npos ; v = b_values_copy.find_first()) {
-            b_values_copy.reset(v);
-            last_b = v;
-        }
+        auto last_b = b_domain.values.find_last();
 
         if (last_b == 0)
             return false;
         auto last_allowed_a = last_b - 1;
 
-        auto a_values_copy = a_domain.values;
-        for (auto v = a_values_copy.find_first() ; v != decltype(a_values_copy)::npos ; v = a_values_copy.find_first()) {
-            a_values_copy.reset(v);
-            if (v > last_allowed_a)
+        a_domain.values.for_each_set_bit([&] (unsigned v) {
+            if (v > last_allowed_a) {
                 a_domain.values.reset(v);
-        }
+                --a_domain.count;
+            }
+        });
 
         // a might have shrunk
-        a_domain.count = a_domain.values.count();
         if (0 == a_domain.count)
             return false;
     }
@@ -696,7 +805,8 @@ auto HomomorphismSearcher::propagate(Domains & new_domains, HomomorphismAssignme
                                         continue;
 
                                     if (d.v == a.pattern_vertex) {
-                                        d.values.reset(a.target_vertex);
+                                        if (d.values.reset(a.target_vertex))
+                                            --d.count;
                                         break;
                                     }
                                 }
@@ -758,6 +868,11 @@ auto HomomorphismSearcher::propagate(Domains & new_domains, HomomorphismAssignme
     return true;
 }
 
+auto HomomorphismSearcher::set_work_donation(const HomomorphismWorkDonation * donation) -> void
+{
+    _work_donation = donation;
+}
+
 auto HomomorphismSearcher::set_seed(int t) -> void
 {
     global_rand.seed(t);
@@ -73,6 +73,33 @@ struct HomomorphismAssignments
 
 using DuplicateSolutionFilterer = const std::function<auto (const HomomorphismAssignments &) -> bool>;
 
+/**
+ * Lets a parallel search take unexplored subtrees away from a searcher.
+ */
+struct HomomorphismWorkDonation
+{
+    /// Only give away subtrees at less than this depth
+    int max_depth;
+
+    /// Is another thread waiting for work?
+    std::function<auto () -> bool> wanted;
+
+    /// Take the subtrees reached by making the decisions in these
+    /// assignments, and then any one of these values, which are best first
+    std::function<auto (const HomomorphismAssignments &, const std::vector<HomomorphismAssignmentInformation> &) -> void> donate;
+
+    /// Once something has been given away, also give away the untried values
+    /// of every shallower branch as we get back to it, so that everything we
+    /// search ourselves comes before everything we donated
+    bool in_search_order = false;
+
+    /// If set, give up early when this returns true
+    std::function<auto () -> bool> abandon;
+
+    /// If set, solutions go here rather than to the enumerate callback
+    std::function<auto (const VertexToVertexMapping &) -> void> enumerate;
+};
+
 class HomomorphismSearcher
 {
     private:
@@ -84,13 +111,29 @@ class HomomorphismSearcher
 
         std::mt19937 global_rand;
 
+        const HomomorphismWorkDonation * _work_donation = nullptr;
+        int _give_away_above_depth = -1;
+
+        // Storage for each depth of search, reused by sibling nodes so that
+        // we don't allocate domains for every branch.
+        struct SearchDepthStorage
+        {
+            Domains domains;
+            std::vector<int> branch_v;
+        };
+
+        std::vector<SearchDepthStorage> storage_at_depth;
+
         auto assignments_as_proof_decisions(const HomomorphismAssignments & assignments) const -> std::vector<std::pair<int, int> >;
 
         auto solution_in_proof_form(const HomomorphismAssignments & assignments) const -> std::vector<std::pair<NamedVertex, NamedVertex> >;
 
-        template <bool directed_, bool has_edge_labels_, bool induced_>
+        template <bool directed_, bool has_edge_labels_, bool induced_, bool sparse_>
         auto propagate_adjacency_constraints(HomomorphismDomain & d, const HomomorphismAssignment & current_assignment) -> void;
 
+        template <bool sparse_>
+        auto propagate_adjacency_constraints_for_representation(HomomorphismDomain & d, const HomomorphismAssignment & current_assignment) -> void;
+
         auto both_in_the_neighbourhood_of_some_vertex(unsigned v, unsigned w) -> bool;
 
         auto propagate_simple_constraints(Domains & new_domains, const HomomorphismAssignment & current_assignment) -> bool;
@@ -104,7 +147,8 @@ class HomomorphismSearcher
         auto copy_nonfixed_domains_and_make_assignment(
                 const Domains & domains,
                 unsigned branch_v,
-                unsigned f_v) -> Domains;
+                unsigned f_v,
+                Domains & new_domains) -> void;
 
         auto post_nogood(
                 const HomomorphismAssignments & assignments) -> void;
@@ -137,10 +181,28 @@ class HomomorphismSearcher
                 int depth,
                 RestartsSchedule & restarts_schedule) -> SearchResult;
 
+        /**
+         * Rebuild the domains and assignments for a subtree, by making each
+         * decision in turn, starting from the root domains and assignments,
+         * ready to search it. Returns false if propagation fails along the
+         * way.
+         */
+        auto replay(
+                const std::vector<HomomorphismAssignmentInformation> & decisions,
+                Domains & domains,
+                HomomorphismAssignments & assignments,
+                unsigned long long & propagations) -> bool;
+
         auto save_result(const HomomorphismAssignments & assignments, HomomorphismResult & result) -> void;
 
         auto set_seed(int n) -> void;
 
+        /**
+         * Offer untried values to the donation when it wants them. The
+         * donation must outlive the search.
+         */
+        auto set_work_donation(const HomomorphismWorkDonation * donation) -> void;
+
         Watches<HomomorphismAssignment, HomomorphismAssignmentWatchTable> watches;
 };
 
@@ -17,6 +17,14 @@ auto supports_distance3_graphs(const HomomorphismParams & params) -> bool
     return (! params.no_supplementals) && params.distance3 && (params.injectivity == Injectivity::Injective);
 }
 
+auto calculate_n_shape_graphs(const HomomorphismParams & params) -> unsigned
+{
+    return 1 +
+        (supports_exact_path_graphs(params) ? params.number_of_exact_path_graphs : 0) +
+        (supports_distance3_graphs(params) ? 1 : 0) +
+        (supports_k4_graphs(params) ? 1 : 0);
+}
+
 auto might_have_watches(const HomomorphismParams & params) -> bool
 {
     return params.restarts_schedule->might_restart();
@@ -11,6 +11,8 @@ auto supports_k4_graphs(const HomomorphismParams & params) -> bool;
 
 auto supports_distance3_graphs(const HomomorphismParams & params) -> bool;
 
+auto calculate_n_shape_graphs(const HomomorphismParams & params) -> unsigned;
+
 auto might_have_watches(const HomomorphismParams & params) -> bool;
 
 auto is_nonshrinking(const HomomorphismParams & params) -> bool;
@@ -0,0 +1,1312 @@
+/* vim: set sw=4 sts=4 et foldmethod=syntax : */
+
+#include "prepared_target.hh"
+#include "homomorphism_traits.hh"
+#include "configuration.hh"
+#include "formats/graph_file_error.hh"
+#include "supplemental_graphs.hh"
+#include "thread_utils.hh"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <list>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::all_of;
+using std::call_once;
+using std::enable_if_t;
+using std::function;
+using std::greater;
+using std::hex;
+using std::ifstream;
+using std::iota;
+using std::is_sorted;
+using std::is_trivially_copyable_v;
+using std::less;
+using std::list;
+using std::lower_bound;
+using std::make_unique;
+using std::map;
+using std::max;
+using std::memcpy;
+using std::move;
+using std::ofstream;
+using std::once_flag;
+using std::optional;
+using std::ostream;
+using std::ostringstream;
+using std::pair;
+using std::partial_sum;
+using std::set;
+using std::setfill;
+using std::setw;
+using std::sort;
+using std::stable_sort;
+using std::string;
+using std::string_view;
+using std::tie;
+using std::to_string;
+using std::tuple;
+using std::unique_ptr;
+using std::vector;
+
+using boost::iostreams::mapped_file_source;
+
+namespace
+{
+    // Automatically switch to a sparse target representation only if dense
+    // rows would take up at least this much space, and if the target has
+    // at most this proportion of all possible edges.
+    constexpr unsigned long long sparse_target_minimum_dense_bytes = 256ull << 20;
+    constexpr double sparse_target_maximum_density = 0.01;
+
+    auto can_use_sparse_target(const HomomorphismParams & params) -> bool
+    {
+        return (! params.proof) && (! supports_distance3_graphs(params)) && (! supports_k4_graphs(params))
+            && (! params.lazy_supplementals);
+    }
+
+    auto use_lazy_supplementals(const HomomorphismParams & params, unsigned max_graphs) -> bool
+    {
+        if (! params.lazy_supplementals || 1 == max_graphs)
+            return false;
+
+        if (params.proof)
+            throw UnsupportedConfiguration{ "Lazy supplemental graphs cannot be used with proof logging" };
+
+        return true;
+    }
+
+    auto use_sparse_target(const HomomorphismParams & params, const InputGraph & target, unsigned max_graphs) -> bool
+    {
+        switch (params.target_representation) {
+            case TargetRepresentation::Dense:
+                return false;
+
+            case TargetRepresentation::Sparse:
+                if (! can_use_sparse_target(params))
+                    throw UnsupportedConfiguration{ "Sparse target representation cannot be used with proof logging, distance3, k4 or lazy supplementals" };
+                return true;
+
+            case TargetRepresentation::Auto:
+                break;
+        }
+
+        if (! can_use_sparse_target(params))
+            return false;
+
+        double size = target.size();
+        return (size * size * max_graphs / 8 >= sparse_target_minimum_dense_bytes)
+            && (target.number_of_directed_edges() <= sparse_target_maximum_density * size * size);
+    }
+
+    // Everything in the parameters that affects what we build.
+    struct Settings
+    {
+        unsigned max_graphs;
+        bool exact_path_graphs, distance3, k4, nds, proof;
+        int number_of_exact_path_graphs;
+        bool lazy_supplementals;
+        TargetRepresentation target_representation;
+        list<pair<string, string> > target_occur_less_constraints;
+
+        explicit Settings(const HomomorphismParams & params) :
+            max_graphs(calculate_n_shape_graphs(params)),
+            exact_path_graphs(supports_exact_path_graphs(params)),
+            distance3(supports_distance3_graphs(params)),
+            k4(supports_k4_graphs(params)),
+            nds(degree_and_nds_are_preserved(params) && ! params.no_nds),
+            proof(bool(params.proof)),
+            number_of_exact_path_graphs(exact_path_graphs ? params.number_of_exact_path_graphs : 0),
+            lazy_supplementals(params.lazy_supplementals),
+            target_representation(params.target_representation),
+            target_occur_less_constraints(params.target_occur_less_constraints)
+        {
+        }
+
+        auto operator== (const Settings & other) const -> bool
+        {
+            return tie(max_graphs, exact_path_graphs, distance3, k4, nds, proof, number_of_exact_path_graphs,
+                    lazy_supplementals, target_representation, target_occur_less_constraints) ==
+                tie(other.max_graphs, other.exact_path_graphs, other.distance3, other.k4, other.nds, other.proof,
+                        other.number_of_exact_path_graphs, other.lazy_supplementals, other.target_representation,
+                        other.target_occur_less_constraints);
+        }
+
+        // Identifies these settings in a saved prepared target.
+        auto key() const -> string
+        {
+            string result = to_string(max_graphs) + " " + to_string(exact_path_graphs) + " " + to_string(distance3)
+                + " " + to_string(k4) + " " + to_string(nds) + " " + to_string(proof) + " "
+                + to_string(number_of_exact_path_graphs) + " " + to_string(lazy_supplementals) + " "
+                + to_string(int(target_representation));
+            for (auto & [ a, b ] : target_occur_less_constraints)
+                result += " " + a + "<" + b;
+            return result;
+        }
+    };
+
+    // Do these offsets split n values into size rows, in order?
+    auto valid_offsets(const vector<unsigned long long> & offsets, unsigned size, unsigned long long n) -> bool
+    {
+        return offsets.size() == size + 1ull && 0 == offsets.front() && n == offsets.back()
+            && is_sorted(offsets.begin(), offsets.end());
+    }
+
+    auto valid_vertices(const vector<unsigned> & vertices, unsigned size) -> bool
+    {
+        return all_of(vertices.begin(), vertices.end(), [&] (unsigned v) { return v < size; });
+    }
+
+    // Compressed sparse rows, with neighbours in increasing order.
+    struct SparseRows
+    {
+        vector<unsigned long long> offsets;
+        vector<unsigned> neighbours;
+
+        // either built for this many vertices, or not built at all
+        auto valid(unsigned size, bool built) const -> bool
+        {
+            if (! built)
+                return offsets.empty() && neighbours.empty();
+            return valid_offsets(offsets, size, neighbours.size()) && valid_vertices(neighbours, size);
+        }
+
+        auto row(int v) const -> SparseTargetRow
+        {
+            return SparseTargetRow{ neighbours.data() + offsets[v], neighbours.data() + offsets[v + 1] };
+        }
+
+        auto row_size(int v) const -> unsigned
+        {
+            return offsets[v + 1] - offsets[v];
+        }
+    };
+
+    auto build_sparse_rows(unsigned size, vector<pair<unsigned, unsigned> > & edges) -> SparseRows
+    {
+        sort(edges.begin(), edges.end());
+
+        SparseRows result;
+        result.offsets.resize(size + 1, 0);
+        for (auto & [ f, _ ] : edges)
+            ++result.offsets[f + 1];
+        partial_sum(result.offsets.begin(), result.offsets.end(), result.offsets.begin());
+
+        result.neighbours.reserve(edges.size());
+        for (auto & [ _, t ] : edges)
+            result.neighbours.push_back(t);
+
+        return result;
+    }
+
+    // Supplemental rows and degrees, built one vertex at a time, the first
+    // time anything asks for them.
+    struct LazyRows
+    {
+        std::unique_ptr<once_flag[]> built;
+        vector<SVOBitset> rows;
+        vector<unsigned> degrees;
+        SVOBitsetSlab predecessor_rows;
+    };
+
+    // Vertices, grouped into buckets of vertices with the same label, loop
+    // and degree. Buckets are ordered by label, then loop, then decreasing
+    // degree, so all the buckets a pattern vertex can use are together.
+    struct VertexBucket
+    {
+        int label;
+        int loop;
+        unsigned degree;
+        unsigned long long first, last;
+    };
+
+    struct VertexBuckets
+    {
+        vector<VertexBucket> buckets;
+        vector<unsigned> vertices;
+    };
+
+    // Saved prepared targets start with this, which must change whenever the
+    // layout does. Arrays start on a cache line, so that once the file is
+    // memory mapped, dense rows can be used where they are.
+    constexpr char prepared_target_magic[8] = { 'G', 'S', 'S', 'P', 'T', 'G', 'T', '2' };
+    constexpr unsigned long long prepared_target_alignment = 64;
+
+    class PreparedTargetWriter
+    {
+        private:
+            ostream & _out;
+            unsigned long long _position = 0;
+
+            auto _bytes(const void * data, unsigned long long n) -> void
+            {
+                _out.write(static_cast<const char *>(data), n);
+                _position += n;
+            }
+
+            auto _align() -> void
+            {
+                static const char zeros[prepared_target_alignment] = { };
+                _bytes(zeros, (prepared_target_alignment - _position % prepared_target_alignment) % prepared_target_alignment);
+            }
+
+        public:
+            explicit PreparedTargetWriter(ostream & out) :
+                _out(out)
+            {
+            }
+
+            template <typename T_>
+            auto operator() (const T_ & value) -> enable_if_t<is_trivially_copyable_v<T_> >
+            {
+                _bytes(&value, sizeof(T_));
+            }
+
+            template <typename T_>
+            auto operator() (const vector<T_> & values) -> void
+            {
+                (*this)(static_cast<unsigned long long>(values.size()));
+                if constexpr (is_trivially_copyable_v<T_>) {
+                    _align();
+                    _bytes(values.data(), sizeof(T_) * values.size());
+                }
+                else
+                    for (auto & v : values)
+                        (*this)(v);
+            }
+
+            template <typename A_, typename B_>
+            auto operator() (const pair<A_, B_> & value) -> void
+            {
+                (*this)(value.first);
+                (*this)(value.second);
+            }
+
+            auto operator() (const string & value) -> void
+            {
+                (*this)(static_cast<unsigned long long>(value.size()));
+                _bytes(value.data(), value.size());
+            }
+
+            auto operator() (const map<string, int, less<> > & values) -> void
+            {
+                (*this)(static_cast<unsigned long long>(values.size()));
+                for (auto & [ k, v ] : values) {
+                    (*this)(k);
+                    (*this)(v);
+                }
+            }
+
+            auto operator() (const SVOBitsetSlab & slab) -> void
+            {
+                (*this)(static_cast<unsigned long long>(slab.size()));
+                _align();
+                slab.save_words([&] (const unsigned long long * words, std::size_t n) {
+                    _bytes(words, n * sizeof(unsigned long long));
+                });
+            }
+
+            auto operator() (const SparseRows & rows) -> void
+            {
+                (*this)(rows.offsets);
+                (*this)(rows.neighbours);
+            }
+
+            auto operator() (const NeighbourhoodDegreeSequences & ndss) -> void
+            {
+                (*this)(ndss.offsets);
+                (*this)(ndss.degrees);
+            }
+
+            auto operator() (const VertexBuckets & buckets) -> void
+            {
+                (*this)(buckets.buckets);
+                (*this)(buckets.vertices);
+            }
+    };
+
+    // Thrown if a saved prepared target is truncated.
+    struct PreparedTargetIsTruncated
+    {
+    };
+
+    class PreparedTargetReader
+    {
+        private:
+            const char * _data;
+            unsigned long long _size, _position = 0;
+            unsigned _row_size = 0;
+
+            auto _bytes(unsigned long long n) -> const char *
+            {
+                if (n > _size - _position)
+                    throw PreparedTargetIsTruncated{ };
+                auto result = _data + _position;
+                _position += n;
+                return result;
+            }
+
+            auto _align() -> void
+            {
+                _bytes((prepared_target_alignment - _position % prepared_target_alignment) % prepared_target_alignment);
+            }
+
+        public:
+            PreparedTargetReader(const char * data, unsigned long long size) :
+                _data(data),
+                _size(size)
+            {
+            }
+
+            /// Every slab has rows of this many bits.
+            auto set_row_size(unsigned row_size) -> void
+            {
+                _row_size = row_size;
+            }
+
+            template <typename T_>
+            auto operator() (T_ & value) -> enable_if_t<is_trivially_copyable_v<T_> >
+            {
+                memcpy(&value, _bytes(sizeof(T_)), sizeof(T_));
+            }
+
+            template <typename T_>
+            auto operator() (vector<T_> & values) -> void
+            {
+                unsigned long long n;
+                (*this)(n);
+                if (n > _size - _position)
+                    throw PreparedTargetIsTruncated{ };
+
+                values.resize(n);
+                if constexpr (is_trivially_copyable_v<T_>) {
+                    _align();
+                    memcpy(values.data(), _bytes(sizeof(T_) * n), sizeof(T_) * n);
+                }
+                else
+                    for (auto & v : values)
+                        (*this)(v);
+            }
+
+            template <typename A_, typename B_>
+            auto operator() (pair<A_, B_> & value) -> void
+            {
+                (*this)(value.first);
+                (*this)(value.second);
+            }
+
+            auto operator() (string & value) -> void
+            {
+                unsigned long long n;
+                (*this)(n);
+                auto data = _bytes(n);
+                value.assign(data, n);
+            }
+
+            auto operator() (map<string, int, less<> > & values) -> void
+            {
+                unsigned long long n;
+                (*this)(n);
+                for (unsigned long long i = 0 ; i < n ; ++i) {
+                    string k;
+                    int v;
+                    (*this)(k);
+                    (*this)(v);
+                    values.emplace(k, v);
+                }
+            }
+
+            auto operator() (SVOBitsetSlab & slab) -> void
+            {
+                unsigned long long n_rows;
+                (*this)(n_rows);
+                _align();
+
+                // divide rather than multiply, so a bad n_rows can't overflow
+                unsigned long long bytes_per_row = SVOBitsetSlab::words_per_row(_row_size) * sizeof(unsigned long long);
+                if (n_rows > (0 == bytes_per_row ? 0 : (_size - _position) / bytes_per_row))
+                    throw PreparedTargetIsTruncated{ };
+
+                auto words = _bytes(n_rows * bytes_per_row);
+                slab = SVOBitsetSlab::borrowing_read_only(n_rows, _row_size, reinterpret_cast<const unsigned long long *>(words));
+            }
+
+            auto operator() (SparseRows & rows) -> void
+            {
+                (*this)(rows.offsets);
+                (*this)(rows.neighbours);
+            }
+
+            auto operator() (NeighbourhoodDegreeSequences & ndss) -> void
+            {
+                (*this)(ndss.offsets);
+                (*this)(ndss.degrees);
+            }
+
+            auto operator() (VertexBuckets & buckets) -> void
+            {
+                (*this)(buckets.buckets);
+                (*this)(buckets.vertices);
+            }
+    };
+
+    // FNV-1a, which is simple, and is the same everywhere.
+    auto hash_bytes(unsigned long long hash, const char * data, unsigned long long n) -> unsigned long long
+    {
+        for (unsigned long long i = 0 ; i < n ; ++i) {
+            hash ^= static_cast<unsigned char>(data[i]);
+            hash *= 0x100000001b3ull;
+        }
+        return hash;
+    }
+}
+
+struct PreparedTarget::Imp
+{
+    Settings settings;
+    unsigned n_threads;
+
+    SVOBitsetSlab graph_rows, forward_graph_rows, reverse_graph_rows;
+
+    // graph_rows only holds the first graph if supplementals are lazy
+    bool lazy_supplementals = false;
+    unsigned rows_per_vertex = 0;
+    LazyRows lazy_rows;
+
+    VertexBuckets vertex_buckets;
+
+    bool sparse = false;
+    vector<SparseRows> sparse_graph_rows;
+    SparseRows sparse_forward_graph_rows, sparse_reverse_graph_rows, sparse_edge_label_rows;
+    vector<int> sparse_edge_labels;
+
+    vector<vector<int> > degrees;
+    int largest_degree = 0;
+    vector<pair<int, int> > degrees_in_decreasing_order;
+    vector<NeighbourhoodDegreeSequences> ndss;
+    bool directed = false, has_edge_labels = false;
+
+    // what we were prepared from, so a cached copy can be checked
+    unsigned directed_edges = 0;
+
+    map<string, int, std::less<> > vertex_label_numbers, edge_label_numbers;
+    vector<int> vertex_labels, edge_labels;
+    vector<int> loops;
+
+    vector<string> vertex_proof_names;
+
+    vector<pair<unsigned, unsigned> > occur_less_thans_in_convenient_order;
+
+    // if we were loaded, dense rows live here
+    mapped_file_source mapping;
+
+    Imp(const HomomorphismParams & p) :
+        settings(p),
+        n_threads(p.n_threads)
+    {
+    }
+
+    // Everything which save() writes and load() reads, in order. Lazy rows
+    // themselves are not saved, they are built again as they are needed.
+    template <typename Imp_, typename Archive_>
+    static auto transfer(Imp_ & imp, Archive_ & archive) -> void
+    {
+        archive(imp.lazy_supplementals);
+        archive(imp.rows_per_vertex);
+        archive(imp.sparse);
+        archive(imp.directed);
+        archive(imp.has_edge_labels);
+        archive(imp.largest_degree);
+        archive(imp.graph_rows);
+        archive(imp.forward_graph_rows);
+        archive(imp.reverse_graph_rows);
+        archive(imp.lazy_rows.predecessor_rows);
+        archive(imp.vertex_buckets);
+        archive(imp.sparse_graph_rows);
+        archive(imp.sparse_forward_graph_rows);
+        archive(imp.sparse_reverse_graph_rows);
+        archive(imp.sparse_edge_label_rows);
+        archive(imp.sparse_edge_labels);
+        archive(imp.degrees);
+        archive(imp.degrees_in_decreasing_order);
+        archive(imp.ndss);
+        archive(imp.vertex_label_numbers);
+        archive(imp.edge_label_numbers);
+        archive(imp.vertex_labels);
+        archive(imp.edge_labels);
+        archive(imp.loops);
+        archive(imp.vertex_proof_names);
+        archive(imp.occur_less_thans_in_convenient_order);
+    }
+
+    // After a load, is everything the size that the constructor would have
+    // made it? Anything else means the file is damaged, and indexing by
+    // vertex could go past the end of the mapping.
+    auto valid(const HomomorphismParams & params, unsigned max_graphs, unsigned size) const -> bool
+    {
+        if (max_graphs != calculate_n_shape_graphs(params) || lazy_supplementals != use_lazy_supplementals(params, max_graphs)
+                || rows_per_vertex != (lazy_supplementals ? 1 : max_graphs))
+            return false;
+
+        bool directed_predecessors = lazy_supplementals && directed && supports_exact_path_graphs(params);
+        if (graph_rows.size() != (sparse ? 0 : size * rows_per_vertex)
+                || forward_graph_rows.size() != (directed && ! sparse ? size : 0)
+                || reverse_graph_rows.size() != (directed && ! sparse ? size : 0)
+                || lazy_rows.predecessor_rows.size() != (directed_predecessors ? size : 0))
+            return false;
+
+        if (sparse_graph_rows.size() != (sparse ? max_graphs : 0)
+                || ! all_of(sparse_graph_rows.begin(), sparse_graph_rows.end(), [&] (const SparseRows & r) { return r.valid(size, true); })
+                || ! sparse_forward_graph_rows.valid(size, sparse && directed)
+                || ! sparse_reverse_graph_rows.valid(size, sparse && directed)
+                || ! sparse_edge_label_rows.valid(size, sparse && has_edge_labels)
+                || sparse_edge_labels.size() != sparse_edge_label_rows.neighbours.size())
+            return false;
+
+        if (degrees.size() != rows_per_vertex
+                || ! all_of(degrees.begin(), degrees.end(), [&] (const vector<int> & d) { return d.size() == size; })
+                || degrees_in_decreasing_order.size() != size
+                || ! all_of(degrees_in_decreasing_order.begin(), degrees_in_decreasing_order.end(),
+                    [&] (const pair<int, int> & d) { return unsigned(d.first) < size; }))
+            return false;
+
+        if (ndss.size() != (settings.nds ? rows_per_vertex : 0)
+                || ! all_of(ndss.begin(), ndss.end(), [&] (const NeighbourhoodDegreeSequences & n) {
+                    return valid_offsets(n.offsets, size, n.degrees.size()); }))
+            return false;
+
+        if (vertex_buckets.vertices.size() != size || ! valid_vertices(vertex_buckets.vertices, size)
+                || ! all_of(vertex_buckets.buckets.begin(), vertex_buckets.buckets.end(), [&] (const VertexBucket & b) {
+                    return b.first <= b.last && b.last <= size; }))
+            return false;
+
+        if (loops.size() != size || vertex_labels.size() != size
+                || edge_labels.size() != (has_edge_labels && ! sparse ? size_t(size) * size : 0)
+                || vertex_proof_names.size() != (params.proof ? size : 0)
+                || ! all_of(occur_less_thans_in_convenient_order.begin(), occur_less_thans_in_convenient_order.end(),
+                    [&] (const pair<unsigned, unsigned> & o) { return o.first < size && o.second < size; }))
+            return false;
+
+        return true;
+    }
+};
+
+PreparedTarget::PreparedTarget(const InputGraph & target, const HomomorphismParams & params) :
+    _imp(new Imp(params)),
+    max_graphs(calculate_n_shape_graphs(params)),
+    size(target.size())
+{
+    _imp->sparse = use_sparse_target(params, target, max_graphs);
+    _imp->lazy_supplementals = use_lazy_supplementals(params, max_graphs);
+    _imp->rows_per_vertex = _imp->lazy_supplementals ? 1 : max_graphs;
+    _imp->directed = target.directed();
+    _imp->directed_edges = target.number_of_directed_edges();
+
+    if (params.proof)
+        for (int v = 0 ; v < target.size() ; ++v)
+            _imp->vertex_proof_names.push_back(target.vertex_name(v));
+
+    // recode to a bit graph (or to neighbour lists, if it is big and
+    // sparse), and take out loops
+    _imp->loops.resize(size);
+    if (_imp->sparse) {
+        vector<pair<unsigned, unsigned> > edges;
+        target.for_each_edge([&] (int f, int t, string_view) {
+            if (f == t)
+                _imp->loops[f] = 1;
+            else
+                edges.emplace_back(f, t);
+        });
+
+        _imp->sparse_graph_rows.resize(max_graphs);
+        _imp->sparse_graph_rows[0] = build_sparse_rows(size, edges);
+    }
+    else {
+        // all of a vertex's rows are next to each other, since we use them together
+        _imp->graph_rows = SVOBitsetSlab{ size * _imp->rows_per_vertex, size };
+        target.for_each_edge([&] (int f, int t, string_view) {
+            if (f == t)
+                _imp->loops[f] = 1;
+            else
+                _imp->graph_rows[f * _imp->rows_per_vertex + 0].set(t);
+        });
+    }
+
+    // if directed, do both directions
+    if (_imp->directed) {
+        if (_imp->sparse) {
+            vector<pair<unsigned, unsigned> > forward_edges, reverse_edges;
+            target.for_each_edge([&] (int f, int t, string_view l) {
+                if (f != t && l != "unlabelled") {
+                    forward_edges.emplace_back(f, t);
+                    reverse_edges.emplace_back(t, f);
+                }
+            });
+
+            _imp->sparse_forward_graph_rows = build_sparse_rows(size, forward_edges);
+            _imp->sparse_reverse_graph_rows = build_sparse_rows(size, reverse_edges);
+        }
+        else {
+            _imp->forward_graph_rows = SVOBitsetSlab{ size, size };
+            _imp->reverse_graph_rows = SVOBitsetSlab{ size, size };
+            target.for_each_edge([&] (int f, int t, string_view l) {
+                if (f != t && l != "unlabelled") {
+                    _imp->forward_graph_rows[f].set(t);
+                    _imp->reverse_graph_rows[t].set(f);
+                }
+            });
+        }
+    }
+
+    // vertex labels, numbered in order of first appearance
+    int next_vertex_label = 1;
+    _imp->vertex_labels.resize(size);
+    for (unsigned i = 0 ; i < size ; ++i) {
+        auto r = _imp->vertex_label_numbers.emplace(target.vertex_label(i), next_vertex_label);
+        if (r.second)
+            ++next_vertex_label;
+        _imp->vertex_labels[i] = r.first->second;
+    }
+
+    // edge labels, likewise
+    _imp->has_edge_labels = target.has_edge_labels();
+    if (_imp->has_edge_labels) {
+        int next_edge_label = 1;
+        auto number = [&] (string_view l) -> int {
+            auto r = _imp->edge_label_numbers.emplace(l, next_edge_label);
+            if (r.second)
+                ++next_edge_label;
+            return r.first->second;
+        };
+
+        if (_imp->sparse) {
+            vector<tuple<unsigned, unsigned, int> > labelled_edges;
+            target.for_each_edge([&] (int f, int t, string_view l) {
+                labelled_edges.emplace_back(f, t, number(l));
+            });
+
+            sort(labelled_edges.begin(), labelled_edges.end());
+            vector<pair<unsigned, unsigned> > edges;
+            for (auto & [ f, t, l ] : labelled_edges) {
+                edges.emplace_back(f, t);
+                _imp->sparse_edge_labels.push_back(l);
+            }
+            _imp->sparse_edge_label_rows = build_sparse_rows(size, edges);
+        }
+        else {
+            _imp->edge_labels.resize(size * size);
+            target.for_each_edge([&] (int f, int t, string_view l) {
+                _imp->edge_labels[f * size + t] = number(l);
+            });
+        }
+    }
+    else
+        _imp->edge_label_numbers.emplace("", 0);
+
+    // occurs less than constraints
+    if (! params.target_occur_less_constraints.empty()) {
+        list<pair<unsigned, unsigned> > occur_less_thans_in_wrong_order;
+        for (auto & [ a, b ] : params.target_occur_less_constraints) {
+            auto a_decoded = target.vertex_from_name(a), b_decoded = target.vertex_from_name(b);
+            if (! a_decoded)
+                throw UnsupportedConfiguration{ "No vertex named '" + a + "'" };
+            if (! b_decoded)
+                throw UnsupportedConfiguration{ "No vertex named '" + b + "'" };
+            occur_less_thans_in_wrong_order.emplace_back(*a_decoded, *b_decoded);
+        }
+
+        // put them in a convenient order, so we don't need a propagation loop
+        while (! occur_less_thans_in_wrong_order.empty()) {
+            bool loop_detect = true;
+            set<unsigned> cannot_order_yet;
+            for (auto & [ _, b ] : occur_less_thans_in_wrong_order)
+                cannot_order_yet.emplace(b);
+            for (auto t = occur_less_thans_in_wrong_order.begin() ; t != occur_less_thans_in_wrong_order.end() ; ) {
+                if (cannot_order_yet.count(t->first))
+                    ++t;
+                else {
+                    loop_detect = false;
+                    _imp->occur_less_thans_in_convenient_order.push_back(*t);
+                    occur_less_thans_in_wrong_order.erase(t++);
+                }
+            }
+
+            if (loop_detect)
+                throw UnsupportedConfiguration{ "Target less than constraints form a loop" };
+        }
+    }
+
+    // supplemental graphs
+    unsigned next_supplemental = 1;
+    if (supports_exact_path_graphs(params)) {
+        if (_imp->lazy_supplementals)
+            next_supplemental += params.number_of_exact_path_graphs;
+        else if (_imp->sparse)
+            _build_sparse_exact_path_graphs(next_supplemental, params.number_of_exact_path_graphs);
+        else
+            build_exact_path_graphs(_imp->graph_rows, size, max_graphs, next_supplemental, params.number_of_exact_path_graphs,
+                    _imp->directed, _imp->n_threads);
+    }
+
+    if (supports_distance3_graphs(params)) {
+        if (_imp->lazy_supplementals)
+            ++next_supplemental;
+        else
+            build_distance3_graphs(_imp->graph_rows, size, max_graphs, next_supplemental, _imp->n_threads);
+    }
+
+    if (supports_k4_graphs(params)) {
+        if (_imp->lazy_supplementals)
+            ++next_supplemental;
+        else
+            build_k4_graphs(_imp->graph_rows, size, max_graphs, next_supplemental, _imp->n_threads);
+    }
+
+    if (next_supplemental != max_graphs)
+        throw UnsupportedConfiguration{ "something has gone wrong with supplemental graph indexing: " + to_string(next_supplemental)
+            + " " + to_string(max_graphs) };
+
+    // lazy rows are built, and their degrees counted, as they are used
+    if (_imp->lazy_supplementals) {
+        auto & lazy = _imp->lazy_rows;
+        lazy.built = make_unique<once_flag[]>(size);
+        lazy.rows.resize(size * (max_graphs - 1));
+        lazy.degrees.resize(size * (max_graphs - 1));
+
+        // exact path rows count paths w -> c -> t, so we need to be able to
+        // go backwards along edges
+        if (_imp->directed && supports_exact_path_graphs(params)) {
+            lazy.predecessor_rows = SVOBitsetSlab{ size, size };
+            for (unsigned v = 0 ; v < size ; ++v)
+                _imp->graph_rows[v].for_each_set_bit([&] (unsigned w) {
+                    lazy.predecessor_rows[w].set(v);
+                });
+        }
+    }
+
+    // degrees
+    _imp->degrees.resize(_imp->rows_per_vertex);
+    for (unsigned g = 0 ; g < _imp->rows_per_vertex ; ++g) {
+        _imp->degrees[g].resize(size);
+        for (unsigned i = 0 ; i < size ; ++i)
+            _imp->degrees[g][i] = _imp->sparse ?
+                _imp->sparse_graph_rows[g].row_size(i) :
+                _imp->graph_rows[i * _imp->rows_per_vertex + g].count();
+    }
+
+    for (unsigned i = 0 ; i < size ; ++i) {
+        _imp->largest_degree = max(_imp->largest_degree, _imp->degrees[0][i]);
+        _imp->degrees_in_decreasing_order.emplace_back(i, _imp->degrees[0][i]);
+    }
+
+    sort(_imp->degrees_in_decreasing_order.begin(), _imp->degrees_in_decreasing_order.end(),
+            [] (const pair<int, int> & a, const pair<int, int> & b) { return a.second > b.second; });
+
+    _build_vertex_buckets();
+
+    if (_imp->settings.nds)
+        for (unsigned g = 0 ; g < _imp->rows_per_vertex ; ++g)
+            _imp->ndss.push_back(_build_neighbourhood_degree_sequences(g));
+}
+
+PreparedTarget::PreparedTarget(unique_ptr<Imp> && imp, unsigned m, unsigned s) :
+    _imp(move(imp)),
+    max_graphs(m),
+    size(s)
+{
+}
+
+PreparedTarget::~PreparedTarget() = default;
+
+auto PreparedTarget::compatible_with(const HomomorphismParams & params) const -> bool
+{
+    return _imp->settings == Settings{ params };
+}
+
+auto PreparedTarget::settings_key(const HomomorphismParams & params) -> string
+{
+    return Settings{ params }.key();
+}
+
+auto PreparedTarget::save(const string & filename) const -> void
+{
+    ofstream out{ filename, std::ios::binary };
+    if (! out)
+        throw GraphFileError{ filename, "unable to open prepared target file for writing", false };
+
+    PreparedTargetWriter writer{ out };
+    for (auto c : prepared_target_magic)
+        writer(c);
+    writer(_imp->settings.key());
+    writer(max_graphs);
+    writer(size);
+    writer(_imp->directed_edges);
+    Imp::transfer(*_imp, writer);
+
+    out.flush();
+    if (! out)
+        throw GraphFileError{ filename, "error writing prepared target file", false };
+}
+
+auto PreparedTarget::load(const string & filename, const InputGraph & target, const HomomorphismParams & params) -> unique_ptr<PreparedTarget>
+{
+    if (! ifstream{ filename })
+        return nullptr;
+
+    auto imp = make_unique<Imp>(params);
+    try {
+        imp->mapping.open(filename);
+        PreparedTargetReader reader{ imp->mapping.data(), imp->mapping.size() };
+
+        for (auto c : prepared_target_magic) {
+            char d;
+            reader(d);
+            if (c != d)
+                return nullptr;
+        }
+
+        string key;
+        reader(key);
+        if (key != imp->settings.key())
+            return nullptr;
+
+        unsigned max_graphs, size;
+        reader(max_graphs);
+        reader(size);
+        reader(imp->directed_edges);
+        if (size != unsigned(target.size()) || imp->directed_edges != unsigned(target.number_of_directed_edges()))
+            return nullptr;
+
+        reader.set_row_size(size);
+        Imp::transfer(*imp, reader);
+        if (! imp->valid(params, max_graphs, size))
+            return nullptr;
+
+        if (imp->lazy_supplementals) {
+            imp->lazy_rows.built = make_unique<once_flag[]>(size);
+            imp->lazy_rows.rows.resize(size * (max_graphs - 1));
+            imp->lazy_rows.degrees.resize(size * (max_graphs - 1));
+        }
+
+        return unique_ptr<PreparedTarget>{ new PreparedTarget{ move(imp), max_graphs, size } };
+    }
+    catch (const PreparedTargetIsTruncated &) {
+        return nullptr;
+    }
+    catch (const std::ios_base::failure &) {
+        // can't be mapped, for example because it is empty
+        return nullptr;
+    }
+}
+
+auto PreparedTarget::_build_sparse_exact_path_graphs(unsigned & idx, unsigned number_of_exact_path_graphs) -> void
+{
+    auto & rows = _imp->sparse_graph_rows;
+
+    // we build the row for v by counting paths w -> c -> v, so we need to be
+    // able to go backwards along edges
+    SparseRows transposed;
+    if (_imp->directed) {
+        vector<pair<unsigned, unsigned> > reverse_edges;
+        for (unsigned v = 0 ; v < size ; ++v)
+            for (auto w : rows[0].row(v))
+                reverse_edges.emplace_back(w, v);
+        transposed = build_sparse_rows(size, reverse_edges);
+    }
+    const SparseRows & predecessors = _imp->directed ? transposed : rows[0];
+
+    // each block of vertices gets its own piece of each row, with offsets
+    // relative to that piece and without the leading zero, and the pieces
+    // are joined up in order afterwards
+    unsigned n_blocks = (size + supplemental_graphs_block_size - 1) / supplemental_graphs_block_size;
+    vector<vector<SparseRows> > pieces(n_blocks, vector<SparseRows>(number_of_exact_path_graphs));
+
+    unsigned n_threads = threads_for_blocks(_imp->n_threads, size, supplemental_graphs_block_size);
+    vector<vector<unsigned> > path_counts(n_threads), reached(n_threads);
+    parallel_for_each_block(n_threads, size, supplemental_graphs_block_size, [&] (unsigned thread, unsigned first, unsigned last) {
+        auto & counts = path_counts[thread];
+        counts.resize(size, 0);
+        auto & piece = pieces[first / supplemental_graphs_block_size];
+
+        for (unsigned v = first ; v < last ; ++v) {
+            reached[thread].clear();
+            for (auto c : predecessors.row(v))
+                for (auto w : predecessors.row(c))
+                    if (0 == counts[w]++)
+                        reached[thread].push_back(w);
+
+            sort(reached[thread].begin(), reached[thread].end());
+            for (unsigned p = 1 ; p <= number_of_exact_path_graphs ; ++p) {
+                auto & graph = piece[p - 1];
+                for (auto w : reached[thread])
+                    if (counts[w] >= p)
+                        graph.neighbours.push_back(w);
+                graph.offsets.push_back(graph.neighbours.size());
+            }
+
+            for (auto w : reached[thread])
+                counts[w] = 0;
+        }
+    });
+
+    for (unsigned p = 1 ; p <= number_of_exact_path_graphs ; ++p) {
+        auto & graph = rows[idx + p - 1];
+        graph.offsets.assign(1, 0);
+        graph.offsets.reserve(size + 1);
+        graph.neighbours.clear();
+        for (auto & piece : pieces) {
+            unsigned long long base = graph.neighbours.size();
+            for (auto o : piece[p - 1].offsets)
+                graph.offsets.push_back(base + o);
+            graph.neighbours.insert(graph.neighbours.end(), piece[p - 1].neighbours.begin(), piece[p - 1].neighbours.end());
+            piece[p - 1] = SparseRows{ };
+        }
+    }
+
+    idx += number_of_exact_path_graphs;
+}
+
+auto PreparedTarget::_lazy_row_index(int g, int t) const -> unsigned
+{
+    call_once(_imp->lazy_rows.built[t], [&] { _build_lazy_rows(t); });
+    return t * (max_graphs - 1) + g - 1;
+}
+
+auto PreparedTarget::_build_lazy_rows(int t) const -> void
+{
+    // as for the eager builders, but just for t's rows, so exact path rows
+    // count paths into t, and k4 rows check every neighbour of t
+    auto & lazy = _imp->lazy_rows;
+    SVOBitset * rows = &lazy.rows[t * (max_graphs - 1)];
+    for (unsigned g = 1 ; g < max_graphs ; ++g)
+        rows[g - 1] = SVOBitset{ size, 0 };
+
+    auto neighbours = [&] (unsigned v) -> const SVOBitset & {
+        return _imp->graph_rows[v];
+    };
+
+    unsigned idx = 0;
+    if (_imp->settings.exact_path_graphs) {
+        auto predecessors = [&] (unsigned v) -> const SVOBitset & {
+            return _imp->directed ? lazy.predecessor_rows[v] : neighbours(v);
+        };
+
+        thread_local vector<unsigned> path_counts, reached;
+        path_counts.resize(size, 0);
+        reached.clear();
+        predecessors(t).for_each_set_bit([&] (unsigned c) {
+            predecessors(c).for_each_set_bit([&] (unsigned w) {
+                if (0 == path_counts[w]++)
+                    reached.push_back(w);
+            });
+        });
+
+        for (auto w : reached) {
+            for (unsigned p = 1 ; p <= unsigned(_imp->settings.number_of_exact_path_graphs) && p <= path_counts[w] ; ++p)
+                rows[idx + p - 1].set(w);
+            path_counts[w] = 0;
+        }
+
+        idx += _imp->settings.number_of_exact_path_graphs;
+    }
+
+    if (_imp->settings.distance3) {
+        neighbours(t).for_each_set_bit([&] (unsigned c) {
+            neighbours(c).for_each_set_bit([&] (unsigned w) {
+                rows[idx] |= neighbours(w);
+            });
+        });
+
+        ++idx;
+    }
+
+    if (_imp->settings.k4) {
+        auto & nt = neighbours(t);
+        nt.for_each_set_bit([&] (unsigned w) {
+            auto common_neighbours = neighbours(w);
+            common_neighbours &= nt;
+            common_neighbours.reset(t);
+            common_neighbours.reset(w);
+            if (unsigned(t) != w && common_neighbours.count() >= 2) {
+                bool done = false;
+                common_neighbours.for_each_set_bit([&] (unsigned x) -> bool {
+                    common_neighbours.for_each_set_bit([&] (unsigned y) -> bool {
+                        if (x != y && neighbours(x).test(y)) {
+                            rows[idx].set(w);
+                            done = true;
+                        }
+                        return ! done;
+                    });
+                    return ! done;
+                });
+            }
+        });
+
+        ++idx;
+    }
+
+    for (unsigned g = 1 ; g < max_graphs ; ++g)
+        lazy.degrees[t * (max_graphs - 1) + g - 1] = rows[g - 1].count();
+}
+
+auto PreparedTarget::_build_neighbourhood_degree_sequences(int g) const -> NeighbourhoodDegreeSequences
+{
+    NeighbourhoodDegreeSequences result;
+    result.offsets.resize(size + 1, 0);
+    for (unsigned v = 0 ; v < size ; ++v)
+        result.offsets[v + 1] = result.offsets[v] + degree(g, v);
+    result.degrees.resize(result.offsets[size]);
+
+    // each vertex has its own part of the array
+    parallel_for_each_block(_imp->n_threads, size, supplemental_graphs_block_size, [&] (unsigned, unsigned first, unsigned last) {
+        for (unsigned v = first ; v < last ; ++v) {
+            unsigned * out = result.degrees.data() + result.offsets[v];
+            auto add = [&] (unsigned w) {
+                *out++ = degree(g, w);
+            };
+
+            if (_imp->sparse)
+                for (auto w : sparse_graph_row(g, v))
+                    add(w);
+            else
+                graph_row(g, v).for_each_set_bit(add);
+
+            sort(result.degrees.data() + result.offsets[v], out, greater<unsigned>());
+        }
+    });
+
+    return result;
+}
+
+auto PreparedTarget::_build_vertex_buckets() -> void
+{
+    auto & index = _imp->vertex_buckets;
+    auto key = [&] (unsigned t) {
+        return tuple{ vertex_label(t), _imp->loops[t], -int(degree(0, t)) };
+    };
+
+    index.vertices.resize(size);
+    iota(index.vertices.begin(), index.vertices.end(), 0);
+    stable_sort(index.vertices.begin(), index.vertices.end(), [&] (unsigned a, unsigned b) {
+            return key(a) < key(b); });
+
+    for (unsigned long long i = 0 ; i < index.vertices.size() ; ++i) {
+        unsigned t = index.vertices[i];
+        if (index.buckets.empty() || key(index.vertices[index.buckets.back().first]) != key(t))
+            index.buckets.push_back(VertexBucket{ vertex_label(t), _imp->loops[t], degree(0, t), i, i });
+        ++index.buckets.back().last;
+    }
+}
+
+auto PreparedTarget::for_each_vertex_with(optional<int> label, bool loop, unsigned degree, bool exact,
+        const function<auto (int) -> void> & f) const -> void
+{
+    auto & buckets = _imp->vertex_buckets.buckets;
+    auto by_label_and_loop = [] (const VertexBucket & a, const pair<int, int> & k) {
+        return pair{ a.label, a.loop } < k;
+    };
+
+    // without a label, go through each label's buckets in turn
+    for (auto b = buckets.begin() ; b != buckets.end() ; ) {
+        int l = label ? *label : b->label;
+        b = lower_bound(b, buckets.end(), pair{ l, int(loop) }, by_label_and_loop);
+        for ( ; b != buckets.end() && b->label == l && b->loop == int(loop) ; ++b) {
+            if (b->degree < degree)
+                break;
+            if (exact && b->degree != degree)
+                continue;
+            for (auto i = b->first ; i != b->last ; ++i)
+                f(_imp->vertex_buckets.vertices[i]);
+        }
+
+        if (label)
+            break;
+        b = lower_bound(b, buckets.end(), pair{ l + 1, 0 }, by_label_and_loop);
+    }
+}
+
+auto PreparedTarget::vertex_for_proof(int v) const -> NamedVertex
+{
+    if (v < 0 || unsigned(v) >= _imp->vertex_proof_names.size())
+        throw ProofError{ "Oops, there's a bug: v out of range in target" };
+    return pair{ v, _imp->vertex_proof_names[v] };
+}
+
+auto PreparedTarget::graph_row(int g, int t) const -> const SVOBitset &
+{
+    if (0 != g && _imp->lazy_supplementals)
+        return _imp->lazy_rows.rows[_lazy_row_index(g, t)];
+    else
+        return _imp->graph_rows[t * _imp->rows_per_vertex + g];
+}
+
+auto PreparedTarget::forward_graph_row(int t) const -> const SVOBitset &
+{
+    return _imp->directed ? _imp->forward_graph_rows[t] : graph_row(0, t);
+}
+
+auto PreparedTarget::reverse_graph_row(int t) const -> const SVOBitset &
+{
+    return _imp->directed ? _imp->reverse_graph_rows[t] : graph_row(0, t);
+}
+
+auto PreparedTarget::sparse() const -> bool
+{
+    return _imp->sparse;
+}
+
+auto PreparedTarget::sparse_graph_row(int g, int t) const -> SparseTargetRow
+{
+    return _imp->sparse_graph_rows[g].row(t);
+}
+
+auto PreparedTarget::sparse_forward_graph_row(int t) const -> SparseTargetRow
+{
+    return _imp->directed ? _imp->sparse_forward_graph_rows.row(t) : sparse_graph_row(0, t);
+}
+
+auto PreparedTarget::sparse_reverse_graph_row(int t) const -> SparseTargetRow
+{
+    return _imp->directed ? _imp->sparse_reverse_graph_rows.row(t) : sparse_graph_row(0, t);
+}
+
+auto PreparedTarget::degree(int g, int t) const -> unsigned
+{
+    if (0 != g && _imp->lazy_supplementals)
+        return _imp->lazy_rows.degrees[_lazy_row_index(g, t)];
+    else
+        return _imp->degrees[g][t];
+}
+
+auto PreparedTarget::largest_degree() const -> unsigned
+{
+    return _imp->largest_degree;
+}
+
+auto PreparedTarget::degrees_in_decreasing_order() const -> const vector<pair<int, int> > &
+{
+    return _imp->degrees_in_decreasing_order;
+}
+
+auto PreparedTarget::neighbourhood_degree_sequences(int g) const -> const NeighbourhoodDegreeSequences &
+{
+    return _imp->ndss[g];
+}
+
+auto PreparedTarget::directed() const -> bool
+{
+    return _imp->directed;
+}
+
+auto PreparedTarget::has_loop(int t) const -> bool
+{
+    return _imp->loops[t];
+}
+
+auto PreparedTarget::vertex_label(int t) const -> int
+{
+    return _imp->vertex_labels[t];
+}
+
+auto PreparedTarget::vertex_label_number(string_view label) const -> int
+{
+    auto l = _imp->vertex_label_numbers.find(label);
+    return l == _imp->vertex_label_numbers.end() ? -1 : l->second;
+}
+
+auto PreparedTarget::edge_label(int t, int u) const -> int
+{
+    if (! _imp->has_edge_labels)
+        return 0;
+    else if (_imp->sparse) {
+        auto row = _imp->sparse_edge_label_rows.row(t);
+        auto e = lower_bound(row.begin(), row.end(), unsigned(u));
+        if (e == row.end() || *e != unsigned(u))
+            return 0;
+        return _imp->sparse_edge_labels[e - _imp->sparse_edge_label_rows.neighbours.data()];
+    }
+    else
+        return _imp->edge_labels[t * size + u];
+}
+
+auto PreparedTarget::edge_label_number(string_view label) const -> int
+{
+    auto l = _imp->edge_label_numbers.find(label);
+    return l == _imp->edge_label_numbers.end() ? -1 : l->second;
+}
+
+auto PreparedTarget::occur_less_thans_in_convenient_order() const -> const vector<pair<unsigned, unsigned> > &
+{
+    return _imp->occur_less_thans_in_convenient_order;
+}
+
+auto prepare_target_using_cache(
+        const string & cache_directory,
+        const string & target_filename,
+        const string & target_format_name,
+        const InputGraph & target,
+        const HomomorphismParams & params) -> pair<unique_ptr<PreparedTarget>, bool>
+{
+    // a pipe has already been read, so we can't see what was in it, and
+    // mustn't cache it
+    struct stat target_stat;
+    if (0 != ::stat(target_filename.c_str(), &target_stat) || ! S_ISREG(target_stat.st_mode))
+        return pair{ make_unique<PreparedTarget>(target, params), false };
+
+    unsigned long long hash = 0xcbf29ce484222325ull;
+    {
+        mapped_file_source target_file;
+        try {
+            target_file.open(target_filename);
+            hash = hash_bytes(hash, target_file.data(), target_file.size());
+        }
+        catch (const std::ios_base::failure &) {
+            // empty files can't be mapped, but we still know what is in them
+        }
+    }
+
+    for (auto & s : { target_format_name, Settings{ params }.key() })
+        hash = hash_bytes(hash_bytes(hash, s.data(), s.size()), "", 1);
+
+    ostringstream filename;
+    filename << cache_directory << "/" << hex << setw(16) << setfill('0') << hash << ".prepared";
+
+    if (auto loaded = PreparedTarget::load(filename.str(), target, params))
+        return pair{ move(loaded), true };
+
+    // write somewhere private to this thread and then rename, so nobody sees
+    // a partial file. The cache is only an optimisation, so if we can't add
+    // to it, we carry on with what we have prepared.
+    auto prepared = make_unique<PreparedTarget>(target, params);
+    ostringstream temporary_filename;
+    temporary_filename << filename.str() << "." << getpid() << "." << std::this_thread::get_id() << ".tmp";
+    try {
+        prepared->save(temporary_filename.str());
+    }
+    catch (const GraphFileError &) {
+        std::remove(temporary_filename.str().c_str());
+        return pair{ move(prepared), false };
+    }
+
+    if (0 != std::rename(temporary_filename.str().c_str(), filename.str().c_str()))
+        std::remove(temporary_filename.str().c_str());
+
+    return pair{ move(prepared), false };
+}
@@ -0,0 +1,197 @@
+/* vim: set sw=4 sts=4 et foldmethod=syntax : */
+
+#ifndef GLASGOW_SUBGRAPH_SOLVER_GUARD_SRC_PREPARED_TARGET_HH
+#define GLASGOW_SUBGRAPH_SOLVER_GUARD_SRC_PREPARED_TARGET_HH 1
+
+#include "formats/input_graph.hh"
+#include "svo_bitset.hh"
+#include "homomorphism.hh"
+#include "proof.hh"
+
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/**
+ * The neighbours of a target vertex, in increasing order, when the target is
+ * stored using a sparse representation.
+ */
+struct SparseTargetRow
+{
+    const unsigned * first;
+    const unsigned * last;
+
+    auto begin() const -> const unsigned *
+    {
+        return first;
+    }
+
+    auto end() const -> const unsigned *
+    {
+        return last;
+    }
+};
+
+/**
+ * The neighbourhood degree sequence of every vertex in one graph, each sorted
+ * into decreasing order, stored one after another.
+ */
+struct NeighbourhoodDegreeSequences
+{
+    std::vector<unsigned long long> offsets;
+    std::vector<unsigned> degrees;
+
+    auto sequence(int v) const -> const unsigned *
+    {
+        return degrees.data() + offsets[v];
+    }
+
+    auto length(int v) const -> unsigned
+    {
+        return offsets[v + 1] - offsets[v];
+    }
+};
+
+/**
+ * Everything about a target graph that does not depend upon the pattern:
+ * its rows, supplemental graphs, degrees, neighbourhood degree sequences,
+ * labels, and an index for finding initial domain candidates. Building this
+ * is usually the expensive part of setting up a model, so one prepared
+ * target can be shared between any number of HomomorphismModel instances,
+ * including concurrently, so long as their parameters are compatible.
+ */
+class PreparedTarget
+{
+    private:
+        struct Imp;
+        std::unique_ptr<Imp> _imp;
+
+        auto _build_sparse_exact_path_graphs(unsigned & idx, unsigned number_of_exact_path_graphs) -> void;
+
+        auto _build_lazy_rows(int t) const -> void;
+        auto _lazy_row_index(int g, int t) const -> unsigned;
+
+        auto _build_neighbourhood_degree_sequences(int g) const -> NeighbourhoodDegreeSequences;
+
+        auto _build_vertex_buckets() -> void;
+
+        PreparedTarget(std::unique_ptr<Imp> &&, unsigned max_graphs, unsigned size);
+
+    public:
+        const unsigned max_graphs;
+        const unsigned size;
+
+        PreparedTarget(const InputGraph & target, const HomomorphismParams & params);
+        ~PreparedTarget();
+
+        PreparedTarget(const PreparedTarget &) = delete;
+        PreparedTarget & operator= (const PreparedTarget &) = delete;
+
+        /**
+         * Was this built using the same target-side settings as these
+         * parameters would use?
+         */
+        auto compatible_with(const HomomorphismParams & params) const -> bool;
+
+        /**
+         * Parameters with the same key can share a prepared target, so this
+         * can be used to find one before it has finished being built.
+         */
+        static auto settings_key(const HomomorphismParams & params) -> std::string;
+
+        /**
+         * Save to a file, which can later be memory mapped using load().
+         */
+        auto save(const std::string & filename) const -> void;
+
+        /**
+         * Memory map a prepared target which was written using save(). Dense
+         * rows are used directly from the mapping, rather than being copied.
+         * Returns null if the file does not exist, is not a prepared target,
+         * was prepared using incompatible parameters, or was prepared from a
+         * target with a different number of vertices or edges.
+         */
+        static auto load(const std::string & filename, const InputGraph & target,
+                const HomomorphismParams & params) -> std::unique_ptr<PreparedTarget>;
+
+        auto vertex_for_proof(int v) const -> NamedVertex;
+
+        auto graph_row(int g, int t) const -> const SVOBitset &;
+
+        /**
+         * For an undirected target, these are the same as graph_row(0, t).
+         */
+        auto forward_graph_row(int t) const -> const SVOBitset &;
+        auto reverse_graph_row(int t) const -> const SVOBitset &;
+
+        /**
+         * Are rows stored as sorted neighbour lists? If so, the sparse_*_row()
+         * functions must be used instead of the *_graph_row() functions.
+         */
+        auto sparse() const -> bool;
+
+        auto sparse_graph_row(int g, int t) const -> SparseTargetRow;
+        auto sparse_forward_graph_row(int t) const -> SparseTargetRow;
+        auto sparse_reverse_graph_row(int t) const -> SparseTargetRow;
+
+        auto degree(int g, int t) const -> unsigned;
+        auto largest_degree() const -> unsigned;
+
+        /**
+         * Every vertex, paired with its degree in the first graph, sorted
+         * by decreasing degree.
+         */
+        auto degrees_in_decreasing_order() const -> const std::vector<std::pair<int, int> > &;
+
+        /**
+         * Only available if degrees and neighbourhood degree sequences are
+         * preserved, and for the first graph only if supplementals are lazy.
+         */
+        auto neighbourhood_degree_sequences(int g) const -> const NeighbourhoodDegreeSequences &;
+
+        auto directed() const -> bool;
+        auto has_loop(int t) const -> bool;
+
+        /**
+         * Labels are numbered from 1, with -1 for a label that does not
+         * appear in the target. If the target has no edge labels, every edge
+         * has the label "", which is numbered 0.
+         */
+        auto vertex_label(int t) const -> int;
+        auto vertex_label_number(std::string_view label) const -> int;
+        auto edge_label(int t, int u) const -> int;
+        auto edge_label_number(std::string_view label) const -> int;
+
+        /**
+         * Call f for every vertex with the given label (or with any label, if
+         * none is given) and loop, whose degree in the first graph is at
+         * least the given degree, or exactly the given degree if exact is
+         * true.
+         */
+        auto for_each_vertex_with(std::optional<int> label, bool loop, unsigned degree, bool exact,
+                const std::function<auto (int) -> void> & f) const -> void;
+
+        auto occur_less_thans_in_convenient_order() const -> const std::vector<std::pair<unsigned, unsigned> > &;
+};
+
+/**
+ * Load a prepared target from a cache directory, keyed by the contents and
+ * format of the file the target was read from, and by the parameters which
+ * affect preparation. If it is not there, prepare it and add it. Entries
+ * are added atomically, so concurrently running processes can share a cache
+ * directory. The second value says whether the cache already had the target.
+ * Targets which are not read from regular files, such as pipes, are prepared
+ * without using the cache, and failing to write to the cache is not an error.
+ */
+auto prepare_target_using_cache(
+        const std::string & cache_directory,
+        const std::string & target_filename,
+        const std::string & target_format_name,
+        const InputGraph & target,
+        const HomomorphismParams & params) -> std::pair<std::unique_ptr<PreparedTarget>, bool>;
+
+#endif
@@ -0,0 +1,97 @@
+/* vim: set sw=4 sts=4 et foldmethod=syntax : */
+
+#include "formats/read_file_format.hh"
+#include "formats/binary.hh"
+
+#include <boost/program_options.hpp>
+
+#include <fstream>
+#include <iostream>
+#include <unistd.h>
+
+namespace po = boost::program_options;
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::exception;
+using std::ios;
+using std::ofstream;
+using std::string;
+
+auto main(int argc, char * argv[]) -> int
+{
+    try {
+        po::options_description display_options{ "Program options" };
+        display_options.add_options()
+            ("help",                                         "Display help information")
+            ("format",             po::value<string>(),      "Specify input file format (auto, lad, vertexlabelledlad, labelledlad, dimacs, binary)")
+            ;
+
+        po::options_description all_options{ "All options" };
+        all_options.add_options()
+            ("graph-file", "Specify the graph file")
+            ("output-file", "Specify the binary file to write")
+            ;
+        all_options.add(display_options);
+
+        po::positional_options_description positional_options;
+        positional_options
+            .add("graph-file", 1)
+            .add("output-file", 1)
+            ;
+
+        po::variables_map options_vars;
+        po::store(po::command_line_parser(argc, argv)
+                .options(all_options)
+                .positional(positional_options)
+                .run(), options_vars);
+        po::notify(options_vars);
+
+        /* --help? Show a message, and exit. */
+        if (options_vars.count("help")) {
+            cout << "Usage: " << argv[0] << " [options] file output-file" << endl;
+            cout << endl;
+            cout << display_options << endl;
+            return EXIT_SUCCESS;
+        }
+
+        /* No input or output file specified? Show a message and exit. */
+        if (! options_vars.count("graph-file") || ! options_vars.count("output-file")) {
+            cout << "Usage: " << argv[0] << " [options] file output-file" << endl;
+            return EXIT_FAILURE;
+        }
+
+        /* Read in the graphs */
+        string default_format_name = options_vars.count("format") ? options_vars["format"].as<string>() : "auto";
+        auto graph = read_file_format(default_format_name, options_vars["graph-file"].as<string>());
+
+        auto output_file_name = options_vars["output-file"].as<string>();
+        ofstream output{ output_file_name, ios::binary };
+        write_binary_graph(output, graph);
+        output.close();
+        if (! output) {
+            cerr << "Error: could not write to " << output_file_name << endl;
+            return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+    }
+    catch (const GraphFileError & e) {
+        cerr << "Error: " << e.what() << endl;
+        if (e.file_at_least_existed())
+            cerr << "Maybe try specifying --format?" << endl;
+        return EXIT_FAILURE;
+    }
+    catch (const po::error & e) {
+        cerr << "Error: " << e.what() << endl;
+        cerr << "Try " << argv[0] << " --help" << endl;
+        return EXIT_FAILURE;
+    }
+    catch (const exception & e) {
+        cerr << "Error: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+}
+
+
@@ -0,0 +1,12 @@
+TARGET := sip_to_binary
+
+SOURCES := \
+    sip_to_binary.cc
+
+TGT_PREREQS := libcommon.a
+ifeq ($(shell uname -s), Linux)
+TGT_LDLIBS := libcommon.a $(boost_ldlibs) -lstdc++fs
+else
+TGT_LDLIBS := libcommon.a $(boost_ldlibs)
+endif
+
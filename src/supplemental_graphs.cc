@@ -0,0 +1,121 @@
+/* vim: set sw=4 sts=4 et foldmethod=syntax : */
+
+#include "supplemental_graphs.hh"
+#include "thread_utils.hh"
+
+#include <utility>
+#include <vector>
+
+using std::pair;
+using std::vector;
+
+auto build_exact_path_graphs(SVOBitsetSlab & graph_rows, unsigned size, unsigned max_graphs, unsigned & idx,
+        unsigned number_of_exact_path_graphs, bool directed, unsigned n_threads) -> void
+{
+    // we build the row for v by counting paths w -> c -> v, so we need to be
+    // able to go backwards along edges
+    SVOBitsetSlab transposed;
+    if (directed) {
+        transposed = SVOBitsetSlab{ size, size };
+        for (unsigned v = 0 ; v < size ; ++v)
+            graph_rows[v * max_graphs + 0].for_each_set_bit([&] (unsigned w) {
+                transposed[w].set(v);
+            });
+    }
+
+    auto predecessors = [&] (unsigned v) -> const SVOBitset & {
+        return directed ? transposed[v] : graph_rows[v * max_graphs + 0];
+    };
+
+    // each thread only writes to the rows of its own vertices
+    n_threads = threads_for_blocks(n_threads, size, supplemental_graphs_block_size);
+    vector<vector<unsigned> > path_counts(n_threads), reached(n_threads);
+    parallel_for_each_block(n_threads, size, supplemental_graphs_block_size, [&] (unsigned thread, unsigned first, unsigned last) {
+        auto & counts = path_counts[thread];
+        counts.resize(size, 0);
+
+        for (unsigned v = first ; v < last ; ++v) {
+            reached[thread].clear();
+            predecessors(v).for_each_set_bit([&] (unsigned c) {
+                predecessors(c).for_each_set_bit([&] (unsigned w) {
+                    if (0 == counts[w]++)
+                        reached[thread].push_back(w);
+                });
+            });
+
+            for (auto w : reached[thread]) {
+                for (unsigned p = 1 ; p <= number_of_exact_path_graphs && p <= counts[w] ; ++p)
+                    graph_rows[v * max_graphs + idx + p - 1].set(w);
+                counts[w] = 0;
+            }
+        }
+    });
+
+    idx += number_of_exact_path_graphs;
+}
+
+auto build_distance3_graphs(SVOBitsetSlab & graph_rows, unsigned size, unsigned max_graphs, unsigned & idx,
+        unsigned n_threads) -> void
+{
+    // each thread only writes to the rows of its own vertices
+    parallel_for_each_block(n_threads, size, supplemental_graphs_block_size, [&] (unsigned, unsigned first, unsigned last) {
+        for (unsigned v = first ; v < last ; ++v) {
+            graph_rows[v * max_graphs + 0].for_each_set_bit([&] (unsigned c) {
+                graph_rows[c * max_graphs + 0].for_each_set_bit([&] (unsigned w) {
+                    // v--c--w so v is within distance 3 of w's neighbours
+                    graph_rows[v * max_graphs + idx] |= graph_rows[w * max_graphs + 0];
+                });
+            });
+        }
+    });
+
+    ++idx;
+}
+
+auto build_k4_graphs(SVOBitsetSlab & graph_rows, unsigned size, unsigned max_graphs, unsigned & idx,
+        unsigned n_threads) -> void
+{
+    // an edge can end up in two vertices' rows, so threads just collect the
+    // edges they find, and we set the bits afterwards
+    n_threads = threads_for_blocks(n_threads, size, supplemental_graphs_block_size);
+    vector<vector<pair<unsigned, unsigned> > > k4_edges(n_threads);
+    parallel_for_each_block(n_threads, size, supplemental_graphs_block_size, [&] (unsigned thread, unsigned first, unsigned last) {
+        for (unsigned v = first ; v < last ; ++v) {
+            auto & nv = graph_rows[v * max_graphs + 0];
+            nv.for_each_set_bit([&] (unsigned w) -> bool {
+                if (w >= v)
+                    return false;
+
+                // are there two common neighbours with an edge between them?
+                auto common_neighbours = graph_rows[w * max_graphs + 0];
+                common_neighbours &= nv;
+                common_neighbours.reset(v);
+                common_neighbours.reset(w);
+                auto count = common_neighbours.count();
+                if (count >= 2) {
+                    bool done = false;
+                    common_neighbours.for_each_set_bit([&] (unsigned x) -> bool {
+                        common_neighbours.for_each_set_bit([&] (unsigned y) -> bool {
+                            if (v != w && v != x && v != y && w != x && w != y && graph_rows[x * max_graphs + 0].test(y)) {
+                                k4_edges[thread].emplace_back(v, w);
+                                done = true;
+                            }
+                            return ! done;
+                        });
+                        return ! done;
+                    });
+                }
+
+                return true;
+            });
+        }
+    });
+
+    for (auto & edges : k4_edges)
+        for (auto & [ v, w ] : edges) {
+            graph_rows[v * max_graphs + idx].set(w);
+            graph_rows[w * max_graphs + idx].set(v);
+        }
+
+    ++idx;
+}
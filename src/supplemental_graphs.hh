@@ -0,0 +1,32 @@
+/* vim: set sw=4 sts=4 et foldmethod=syntax : */
+
+#ifndef GLASGOW_SUBGRAPH_SOLVER_GUARD_SRC_SUPPLEMENTAL_GRAPHS_HH
+#define GLASGOW_SUBGRAPH_SOLVER_GUARD_SRC_SUPPLEMENTAL_GRAPHS_HH 1
+
+#include "svo_bitset.hh"
+
+// Supplemental graphs are built in parallel, handing out this many
+// vertices at a time to each thread.
+constexpr unsigned supplemental_graphs_block_size = 64;
+
+/**
+ * Build number_of_exact_path_graphs exact path graphs, using rows idx
+ * onwards of a slab which holds max_graphs rows for each vertex, and which
+ * already has the first graph filled in. Increments idx.
+ */
+auto build_exact_path_graphs(SVOBitsetSlab & graph_rows, unsigned size, unsigned max_graphs, unsigned & idx,
+        unsigned number_of_exact_path_graphs, bool directed, unsigned n_threads) -> void;
+
+/**
+ * Build the distance 3 graph, as for build_exact_path_graphs().
+ */
+auto build_distance3_graphs(SVOBitsetSlab & graph_rows, unsigned size, unsigned max_graphs, unsigned & idx,
+        unsigned n_threads) -> void;
+
+/**
+ * Build the k4 graph, as for build_exact_path_graphs().
+ */
+auto build_k4_graphs(SVOBitsetSlab & graph_rows, unsigned size, unsigned max_graphs, unsigned & idx,
+        unsigned n_threads) -> void;
+
+#endif
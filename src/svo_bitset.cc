@@ -1,22 +1,571 @@
 /* vim: set sw=4 sts=4 et foldmethod=syntax : */
 
 #include "svo_bitset.hh"
+#include "cpu_features.hh"
 
 #include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <utility>
+#include <vector>
 
+using std::aligned_alloc;
+using std::atomic;
+using std::bad_alloc;
 using std::copy;
+using std::fill;
+using std::free;
+using std::function;
+using std::move;
+using std::vector;
+
+namespace
+{
+    using BitWord = unsigned long long;
+
+    // Kernels for long bitsets. We pick the best ones the CPU we are actually
+    // running on supports, rather than the one we were compiled on.
+    struct Kernels
+    {
+        auto (* and_words)(BitWord *, const BitWord *, unsigned) -> void;
+        auto (* or_words)(BitWord *, const BitWord *, unsigned) -> void;
+        auto (* and_not_words)(BitWord *, const BitWord *, unsigned) -> void;
+        auto (* and_words_and_count)(BitWord *, const BitWord *, unsigned) -> unsigned;
+        auto (* and_not_words_and_count)(BitWord *, const BitWord *, unsigned) -> unsigned;
+        auto (* or_words_and_count)(BitWord *, const BitWord *, unsigned) -> unsigned;
+        auto (* count_words)(const BitWord *, unsigned) -> unsigned;
+    };
+
+    auto scalar_and_words(BitWord * a, const BitWord * b, unsigned n) -> void
+    {
+        for (unsigned i = 0 ; i < n ; ++i)
+            a[i] &= b[i];
+    }
+
+    auto scalar_or_words(BitWord * a, const BitWord * b, unsigned n) -> void
+    {
+        for (unsigned i = 0 ; i < n ; ++i)
+            a[i] |= b[i];
+    }
+
+    auto scalar_and_not_words(BitWord * a, const BitWord * b, unsigned n) -> void
+    {
+        for (unsigned i = 0 ; i < n ; ++i)
+            a[i] &= ~b[i];
+    }
+
+    auto scalar_and_words_and_count(BitWord * a, const BitWord * b, unsigned n) -> unsigned
+    {
+        unsigned result = 0;
+        for (unsigned i = 0 ; i < n ; ++i) {
+            a[i] &= b[i];
+            result += __builtin_popcountll(a[i]);
+        }
+        return result;
+    }
+
+    auto scalar_and_not_words_and_count(BitWord * a, const BitWord * b, unsigned n) -> unsigned
+    {
+        unsigned result = 0;
+        for (unsigned i = 0 ; i < n ; ++i) {
+            a[i] &= ~b[i];
+            result += __builtin_popcountll(a[i]);
+        }
+        return result;
+    }
+
+    auto scalar_or_words_and_count(BitWord * a, const BitWord * b, unsigned n) -> unsigned
+    {
+        unsigned result = 0;
+        for (unsigned i = 0 ; i < n ; ++i) {
+            a[i] |= b[i];
+            result += __builtin_popcountll(a[i]);
+        }
+        return result;
+    }
+
+    auto scalar_count_words(const BitWord * a, unsigned n) -> unsigned
+    {
+        unsigned result = 0;
+        for (unsigned i = 0 ; i < n ; ++i)
+            result += __builtin_popcountll(a[i]);
+        return result;
+    }
+
+
+#if defined(GLASGOW_SUBGRAPH_SOLVER_X86_KERNELS)
+    // AVX2 has no vector popcount, so we count nibbles using a shuffle
+    // lookup table, and sum bytes into 64-bit lanes.
+    __attribute__((target("avx2"))) inline auto avx2_popcount_lanes(__m256i v) -> __m256i
+    {
+        const __m256i lookup = _mm256_setr_epi8(
+                0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+        const __m256i low_mask = _mm256_set1_epi8(0x0f);
+        __m256i lo = _mm256_and_si256(v, low_mask);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+        __m256i counts = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo), _mm256_shuffle_epi8(lookup, hi));
+        return _mm256_sad_epu8(counts, _mm256_setzero_si256());
+    }
+
+    __attribute__((target("avx2"))) inline auto avx2_sum_lanes(__m256i v) -> unsigned
+    {
+        __m128i s = _mm_add_epi64(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+        return _mm_cvtsi128_si64(s) + _mm_extract_epi64(s, 1);
+    }
+
+    __attribute__((target("avx2"))) auto avx2_and_words(BitWord * a, const BitWord * b, unsigned n) -> void
+    {
+        unsigned i = 0;
+        for ( ; i + 4 <= n ; i += 4) {
+            __m256i v = _mm256_and_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i)),
+                    _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i)));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(a + i), v);
+        }
+        for ( ; i < n ; ++i)
+            a[i] &= b[i];
+    }
+
+    __attribute__((target("avx2"))) auto avx2_or_words(BitWord * a, const BitWord * b, unsigned n) -> void
+    {
+        unsigned i = 0;
+        for ( ; i + 4 <= n ; i += 4) {
+            __m256i v = _mm256_or_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i)),
+                    _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i)));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(a + i), v);
+        }
+        for ( ; i < n ; ++i)
+            a[i] |= b[i];
+    }
+
+    __attribute__((target("avx2"))) auto avx2_and_not_words(BitWord * a, const BitWord * b, unsigned n) -> void
+    {
+        unsigned i = 0;
+        for ( ; i + 4 <= n ; i += 4) {
+            __m256i v = _mm256_andnot_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i)),
+                    _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i)));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(a + i), v);
+        }
+        for ( ; i < n ; ++i)
+            a[i] &= ~b[i];
+    }
+
+    __attribute__((target("avx2"))) auto avx2_and_words_and_count(BitWord * a, const BitWord * b, unsigned n) -> unsigned
+    {
+        __m256i counts = _mm256_setzero_si256();
+        unsigned i = 0;
+        for ( ; i + 4 <= n ; i += 4) {
+            __m256i v = _mm256_and_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i)),
+                    _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i)));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(a + i), v);
+            counts = _mm256_add_epi64(counts, avx2_popcount_lanes(v));
+        }
+        unsigned result = avx2_sum_lanes(counts);
+        for ( ; i < n ; ++i) {
+            a[i] &= b[i];
+            result += __builtin_popcountll(a[i]);
+        }
+        return result;
+    }
+
+    __attribute__((target("avx2"))) auto avx2_and_not_words_and_count(BitWord * a, const BitWord * b, unsigned n) -> unsigned
+    {
+        __m256i counts = _mm256_setzero_si256();
+        unsigned i = 0;
+        for ( ; i + 4 <= n ; i += 4) {
+            __m256i v = _mm256_andnot_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i)),
+                    _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i)));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(a + i), v);
+            counts = _mm256_add_epi64(counts, avx2_popcount_lanes(v));
+        }
+        unsigned result = avx2_sum_lanes(counts);
+        for ( ; i < n ; ++i) {
+            a[i] &= ~b[i];
+            result += __builtin_popcountll(a[i]);
+        }
+        return result;
+    }
+
+    __attribute__((target("avx2"))) auto avx2_or_words_and_count(BitWord * a, const BitWord * b, unsigned n) -> unsigned
+    {
+        __m256i counts = _mm256_setzero_si256();
+        unsigned i = 0;
+        for ( ; i + 4 <= n ; i += 4) {
+            __m256i v = _mm256_or_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i)),
+                    _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i)));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(a + i), v);
+            counts = _mm256_add_epi64(counts, avx2_popcount_lanes(v));
+        }
+        unsigned result = avx2_sum_lanes(counts);
+        for ( ; i < n ; ++i) {
+            a[i] |= b[i];
+            result += __builtin_popcountll(a[i]);
+        }
+        return result;
+    }
+
+    __attribute__((target("avx2"))) auto avx2_count_words(const BitWord * a, unsigned n) -> unsigned
+    {
+        __m256i counts = _mm256_setzero_si256();
+        unsigned i = 0;
+        for ( ; i + 4 <= n ; i += 4)
+            counts = _mm256_add_epi64(counts, avx2_popcount_lanes(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i))));
+        unsigned result = avx2_sum_lanes(counts);
+        for ( ; i < n ; ++i)
+            result += __builtin_popcountll(a[i]);
+        return result;
+    }
+
+
+    // With AVX-512, masked loads and stores deal with the tail, and we have
+    // a proper vector popcount. Some GCC versions warn about their own
+    // _mm512_undefined intrinsics, which we can't do anything about.
+#  pragma GCC diagnostic push
+#  pragma GCC diagnostic ignored "-Wuninitialized"
+#  pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+    __attribute__((target("avx512f"))) inline auto avx512_tail_mask(unsigned remaining) -> __mmask8
+    {
+        return (remaining >= 8) ? 0xff : __mmask8((1u << remaining) - 1);
+    }
+
+    __attribute__((target("avx512f"))) auto avx512_and_words(BitWord * a, const BitWord * b, unsigned n) -> void
+    {
+        for (unsigned i = 0 ; i < n ; i += 8) {
+            __mmask8 m = avx512_tail_mask(n - i);
+            __m512i v = _mm512_and_si512(_mm512_maskz_loadu_epi64(m, a + i), _mm512_maskz_loadu_epi64(m, b + i));
+            _mm512_mask_storeu_epi64(a + i, m, v);
+        }
+    }
+
+    __attribute__((target("avx512f"))) auto avx512_or_words(BitWord * a, const BitWord * b, unsigned n) -> void
+    {
+        for (unsigned i = 0 ; i < n ; i += 8) {
+            __mmask8 m = avx512_tail_mask(n - i);
+            __m512i v = _mm512_or_si512(_mm512_maskz_loadu_epi64(m, a + i), _mm512_maskz_loadu_epi64(m, b + i));
+            _mm512_mask_storeu_epi64(a + i, m, v);
+        }
+    }
+
+    __attribute__((target("avx512f"))) auto avx512_and_not_words(BitWord * a, const BitWord * b, unsigned n) -> void
+    {
+        for (unsigned i = 0 ; i < n ; i += 8) {
+            __mmask8 m = avx512_tail_mask(n - i);
+            __m512i v = _mm512_andnot_si512(_mm512_maskz_loadu_epi64(m, b + i), _mm512_maskz_loadu_epi64(m, a + i));
+            _mm512_mask_storeu_epi64(a + i, m, v);
+        }
+    }
+
+    __attribute__((target("avx512f,avx512vpopcntdq"))) auto avx512_and_words_and_count(BitWord * a, const BitWord * b, unsigned n) -> unsigned
+    {
+        __m512i counts = _mm512_setzero_si512();
+        for (unsigned i = 0 ; i < n ; i += 8) {
+            __mmask8 m = avx512_tail_mask(n - i);
+            __m512i v = _mm512_and_si512(_mm512_maskz_loadu_epi64(m, a + i), _mm512_maskz_loadu_epi64(m, b + i));
+            _mm512_mask_storeu_epi64(a + i, m, v);
+            counts = _mm512_add_epi64(counts, _mm512_popcnt_epi64(v));
+        }
+        return _mm512_reduce_add_epi64(counts);
+    }
+
+    __attribute__((target("avx512f,avx512vpopcntdq"))) auto avx512_and_not_words_and_count(BitWord * a, const BitWord * b, unsigned n) -> unsigned
+    {
+        __m512i counts = _mm512_setzero_si512();
+        for (unsigned i = 0 ; i < n ; i += 8) {
+            __mmask8 m = avx512_tail_mask(n - i);
+            __m512i v = _mm512_andnot_si512(_mm512_maskz_loadu_epi64(m, b + i), _mm512_maskz_loadu_epi64(m, a + i));
+            _mm512_mask_storeu_epi64(a + i, m, v);
+            counts = _mm512_add_epi64(counts, _mm512_popcnt_epi64(v));
+        }
+        return _mm512_reduce_add_epi64(counts);
+    }
+
+    __attribute__((target("avx512f,avx512vpopcntdq"))) auto avx512_or_words_and_count(BitWord * a, const BitWord * b, unsigned n) -> unsigned
+    {
+        __m512i counts = _mm512_setzero_si512();
+        for (unsigned i = 0 ; i < n ; i += 8) {
+            __mmask8 m = avx512_tail_mask(n - i);
+            __m512i v = _mm512_or_si512(_mm512_maskz_loadu_epi64(m, a + i), _mm512_maskz_loadu_epi64(m, b + i));
+            _mm512_mask_storeu_epi64(a + i, m, v);
+            counts = _mm512_add_epi64(counts, _mm512_popcnt_epi64(v));
+        }
+        return _mm512_reduce_add_epi64(counts);
+    }
+
+    __attribute__((target("avx512f,avx512vpopcntdq"))) auto avx512_count_words(const BitWord * a, unsigned n) -> unsigned
+    {
+        __m512i counts = _mm512_setzero_si512();
+        for (unsigned i = 0 ; i < n ; i += 8)
+            counts = _mm512_add_epi64(counts, _mm512_popcnt_epi64(_mm512_maskz_loadu_epi64(avx512_tail_mask(n - i), a + i)));
+        return _mm512_reduce_add_epi64(counts);
+    }
+
+#  pragma GCC diagnostic pop
+#endif
+
+    auto select_kernels() -> Kernels
+    {
+#if defined(GLASGOW_SUBGRAPH_SOLVER_X86_KERNELS)
+        if (cpu_has_avx512_popcount())
+            return Kernels{ avx512_and_words, avx512_or_words, avx512_and_not_words,
+                avx512_and_words_and_count, avx512_and_not_words_and_count, avx512_or_words_and_count,
+                avx512_count_words };
+        else if (cpu_has_avx2())
+            return Kernels{ avx2_and_words, avx2_or_words, avx2_and_not_words,
+                avx2_and_words_and_count, avx2_and_not_words_and_count, avx2_or_words_and_count,
+                avx2_count_words };
+#endif
+
+        return Kernels{ scalar_and_words, scalar_or_words, scalar_and_not_words,
+            scalar_and_words_and_count, scalar_and_not_words_and_count, scalar_or_words_and_count,
+            scalar_count_words };
+    }
+
+    auto kernels() -> const Kernels &
+    {
+        static const Kernels selected = select_kernels();
+        return selected;
+    }
+
+    // Freed long storage is kept for reuse, per thread and per size. Almost
+    // every long bitset in a run has the same size, so a short list of sizes
+    // is enough. We keep a bounded number of blocks of each size, so freeing
+    // a big graph's rows does not pin all of its memory.
+    constexpr const unsigned max_pooled_blocks_per_size = 256;
+
+    struct PooledSize
+    {
+        unsigned n_words;
+        vector<BitWord *> blocks;
+    };
+
+    atomic<unsigned long long> retired_fresh_allocations{ 0 }, retired_pool_reuses{ 0 };
+
+    struct Pool
+    {
+        vector<PooledSize> sizes;
+        unsigned long long fresh_allocations = 0, pool_reuses = 0;
+
+        ~Pool();
+
+        auto blocks_for(unsigned n_words) -> vector<BitWord *> &
+        {
+            for (auto & s : sizes)
+                if (s.n_words == n_words)
+                    return s.blocks;
+            sizes.push_back(PooledSize{ n_words, { } });
+            sizes.back().blocks.reserve(max_pooled_blocks_per_size);
+            return sizes.back().blocks;
+        }
+    };
+
+    // Bitsets can outlive the pool during thread or program shutdown, in
+    // which case they just go back to the heap.
+    thread_local bool pool_destroyed = false;
+    thread_local Pool pool;
+
+    Pool::~Pool()
+    {
+        for (auto & s : sizes)
+            for (auto & b : s.blocks)
+                delete[] b;
+
+        retired_fresh_allocations += fresh_allocations;
+        retired_pool_reuses += pool_reuses;
+        pool_destroyed = true;
+    }
+}
 
 SVOBitset::SVOBitset(unsigned size, unsigned bits)
 {
     n_words = (size + bits_per_word - 1) / (bits_per_word);
     if (n_words <= svo_size) {
         for (unsigned i = 0 ; i < svo_size ; ++i)
-            _data.short_data[i] = bits;
+            _data.short_data[i] = (i < n_words) ? bits : 0;
     }
     else {
-        _data.long_data = new BitWord[size];
-        for (unsigned i = 0 ; i < size ; ++i)
-            _data.long_data[i] = bits;
+        _data.long_data.words = _allocate_long_words(n_words);
+        for (unsigned i = 0 ; i < n_words ; ++i)
+            _data.long_data.words[i] = bits;
+        _data.long_data.live_begin = 0;
+        _data.long_data.live_end = (0 == bits) ? 0 : n_words;
+        _data.long_data.borrowed = false;
+    }
+}
+
+auto SVOBitset::_allocate_long_words(unsigned n) -> BitWord *
+{
+    if (! pool_destroyed) {
+        auto & blocks = pool.blocks_for(n);
+        if (! blocks.empty()) {
+            auto result = blocks.back();
+            blocks.pop_back();
+            ++pool.pool_reuses;
+            return result;
+        }
+        ++pool.fresh_allocations;
+    }
+
+    return new BitWord[n];
+}
+
+auto SVOBitset::_free_long_words(BitWord * words, unsigned n) noexcept -> void
+{
+    if (! pool_destroyed) {
+        try {
+            auto & blocks = pool.blocks_for(n);
+            if (blocks.size() < max_pooled_blocks_per_size) {
+                blocks.push_back(words);
+                return;
+            }
+        }
+        catch (const bad_alloc &) {
+        }
+    }
+
+    delete[] words;
+}
+
+auto SVOBitset::_borrowing(unsigned size, BitWord * storage) -> SVOBitset
+{
+    SVOBitset result;
+    result.n_words = (size + bits_per_word - 1) / (bits_per_word);
+    if (result._is_long()) {
+        fill(storage, storage + result.n_words, 0);
+        result._data.long_data.words = storage;
+        result._data.long_data.live_begin = 0;
+        result._data.long_data.live_end = 0;
+        result._data.long_data.borrowed = true;
+    }
+    return result;
+}
+
+auto SVOBitset::allocation_stats() -> AllocationStats
+{
+    AllocationStats result;
+    result.fresh_allocations = retired_fresh_allocations;
+    result.pool_reuses = retired_pool_reuses;
+    if (! pool_destroyed) {
+        result.fresh_allocations += pool.fresh_allocations;
+        result.pool_reuses += pool.pool_reuses;
     }
+    return result;
+}
+
+auto SVOBitset::_long_and(BitWord * a, const BitWord * b, unsigned n) -> void
+{
+    kernels().and_words(a, b, n);
+}
+
+auto SVOBitset::_long_or(BitWord * a, const BitWord * b, unsigned n) -> void
+{
+    kernels().or_words(a, b, n);
 }
 
+auto SVOBitset::_long_and_not(BitWord * a, const BitWord * b, unsigned n) -> void
+{
+    kernels().and_not_words(a, b, n);
+}
+
+auto SVOBitset::_long_and_and_count(BitWord * a, const BitWord * b, unsigned n) -> unsigned
+{
+    return kernels().and_words_and_count(a, b, n);
+}
+
+auto SVOBitset::_long_and_not_and_count(BitWord * a, const BitWord * b, unsigned n) -> unsigned
+{
+    return kernels().and_not_words_and_count(a, b, n);
+}
+
+auto SVOBitset::_long_or_and_count(BitWord * a, const BitWord * b, unsigned n) -> unsigned
+{
+    return kernels().or_words_and_count(a, b, n);
+}
+
+auto SVOBitset::_long_count(const BitWord * a, unsigned n) -> unsigned
+{
+    return kernels().count_words(a, n);
+}
+
+auto SVOBitsetSlab::FreeStorage::operator() (SVOBitset::BitWord * p) const -> void
+{
+    free(p);
+}
+
+SVOBitsetSlab::SVOBitsetSlab(unsigned n_rows, unsigned size)
+{
+    using BitWord = SVOBitset::BitWord;
+
+    // each row starts on its own cache line
+    unsigned n_words = (size + SVOBitset::bits_per_word - 1) / SVOBitset::bits_per_word;
+    unsigned stride = words_per_row(size);
+
+    _rows.reserve(n_rows);
+    if (n_words > SVOBitset::svo_size && n_rows > 0) {
+        auto storage = static_cast<BitWord *>(aligned_alloc(64, sizeof(BitWord) * stride * n_rows));
+        if (! storage)
+            throw bad_alloc{ };
+        _storage.reset(storage);
+
+        for (unsigned r = 0 ; r < n_rows ; ++r)
+            _rows.push_back(SVOBitset::_borrowing(size, storage + std::size_t(r) * stride));
+    }
+    else {
+        for (unsigned r = 0 ; r < n_rows ; ++r)
+            _rows.emplace_back(size, 0);
+    }
+}
+
+auto SVOBitsetSlab::words_per_row(unsigned size) -> unsigned
+{
+    constexpr const unsigned words_per_line = 64 / sizeof(SVOBitset::BitWord);
+    unsigned n_words = (size + SVOBitset::bits_per_word - 1) / SVOBitset::bits_per_word;
+    return (n_words + words_per_line - 1) / words_per_line * words_per_line;
+}
+
+auto SVOBitsetSlab::save_words(const function<auto (const unsigned long long *, std::size_t) -> void> & write) const -> void
+{
+    using BitWord = SVOBitset::BitWord;
+
+    for (auto & row : _rows) {
+        // words past the end of a row, or outside its live range, are zero
+        const BitWord * words = row._is_long() ? row._data.long_data.words : row._data.short_data;
+        unsigned stride = words_per_row(row.n_words * SVOBitset::bits_per_word);
+        write(words, row.n_words);
+        for (unsigned w = row.n_words ; w < stride ; ++w) {
+            BitWord zero = 0;
+            write(&zero, 1);
+        }
+    }
+}
+
+auto SVOBitsetSlab::borrowing_read_only(unsigned n_rows, unsigned size, const unsigned long long * storage) -> SVOBitsetSlab
+{
+    using BitWord = SVOBitset::BitWord;
+
+    SVOBitsetSlab result;
+    unsigned stride = words_per_row(size);
+    result._rows.reserve(n_rows);
+    for (unsigned r = 0 ; r < n_rows ; ++r) {
+        const BitWord * words = storage + std::size_t(r) * stride;
+        SVOBitset row;
+        row.n_words = (size + SVOBitset::bits_per_word - 1) / SVOBitset::bits_per_word;
+        if (row._is_long()) {
+            // never written to, so never freed, and the const_cast is safe
+            row._data.long_data.words = const_cast<BitWord *>(words);
+            row._data.long_data.live_begin = 0;
+            row._data.long_data.live_end = row.n_words;
+            row._data.long_data.borrowed = true;
+            row._tighten_live_range();
+            if (row._data.long_data.live_begin == row._data.long_data.live_end)
+                row._data.long_data.live_begin = row._data.long_data.live_end = 0;
+        }
+        else
+            copy(words, words + row.n_words, &row._data.short_data[0]);
+
+        result._rows.push_back(move(row));
+    }
+
+    return result;
+}
@@ -6,7 +6,13 @@
 #include <algorithm>
 #include <array>
 #include <cstring>
+#include <functional>
 #include <limits>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+class SVOBitsetSlab;
 
 class SVOBitset
 {
@@ -15,10 +21,22 @@ class SVOBitset
         static const constexpr int bits_per_word = sizeof(BitWord) * 8;
         static const constexpr int svo_size = 16;
 
+        // For long bitsets, every word outside [live_begin, live_end) is
+        // zero, and if the range is non-empty then its first and last words
+        // are non-zero. This lets us skip over empty regions, which are
+        // common in domains deep in search. Borrowed words belong to an
+        // SVOBitsetSlab, and are not ours to free.
+        struct LongData
+        {
+            BitWord * words;
+            unsigned live_begin, live_end;
+            bool borrowed;
+        };
+
         union
         {
             BitWord short_data[svo_size];
-            BitWord * long_data;
+            LongData long_data;
         } _data;
 
         unsigned n_words;
@@ -28,12 +46,121 @@ class SVOBitset
             return n_words > svo_size;
         }
 
+        // Unused short words are always zero, so short operations can work on
+        // a power of two number of words that is known at compile time, and
+        // that the compiler can fully unroll.
+        template <typename F_>
+        auto _with_short_width(F_ && f) const -> decltype(auto)
+        {
+            if (n_words <= 1)
+                return f(std::integral_constant<unsigned, 1>{});
+            else if (n_words <= 2)
+                return f(std::integral_constant<unsigned, 2>{});
+            else if (n_words <= 4)
+                return f(std::integral_constant<unsigned, 4>{});
+            else if (n_words <= 8)
+                return f(std::integral_constant<unsigned, 8>{});
+            else
+                return f(std::integral_constant<unsigned, svo_size>{});
+        }
+
+        // Long bitsets use vectorised kernels, chosen at runtime.
+        static auto _long_and(BitWord *, const BitWord *, unsigned) -> void;
+        static auto _long_or(BitWord *, const BitWord *, unsigned) -> void;
+        static auto _long_and_not(BitWord *, const BitWord *, unsigned) -> void;
+        static auto _long_and_and_count(BitWord *, const BitWord *, unsigned) -> unsigned;
+        static auto _long_and_not_and_count(BitWord *, const BitWord *, unsigned) -> unsigned;
+        static auto _long_or_and_count(BitWord *, const BitWord *, unsigned) -> unsigned;
+        static auto _long_count(const BitWord *, unsigned) -> unsigned;
+
+        // Long storage comes from a per-thread pool of freed blocks, keyed
+        // by size, and only falls back to the heap when that is empty.
+        static auto _allocate_long_words(unsigned n) -> BitWord *;
+        static auto _free_long_words(BitWord *, unsigned n) noexcept -> void;
+
+        auto _release_long_words() noexcept -> void
+        {
+            if (! _data.long_data.borrowed)
+                _free_long_words(_data.long_data.words, n_words);
+        }
+
+        // A zeroed bitset, whose long storage (if any) is borrowed from a slab.
+        static auto _borrowing(unsigned size, BitWord * storage) -> SVOBitset;
+
+        friend class SVOBitsetSlab;
+
+        auto _zero_long_words(unsigned from, unsigned to) -> void
+        {
+            if (from < to)
+                std::fill(_data.long_data.words + from, _data.long_data.words + to, 0);
+        }
+
+        auto _count_long_words(unsigned from, unsigned to) const -> unsigned
+        {
+            return from < to ? _long_count(_data.long_data.words + from, to - from) : 0;
+        }
+
+        auto _tighten_live_range() -> void
+        {
+            auto & l = _data.long_data;
+            while (l.live_begin < l.live_end && 0 == l.words[l.live_begin])
+                ++l.live_begin;
+            while (l.live_end > l.live_begin && 0 == l.words[l.live_end - 1])
+                --l.live_end;
+        }
+
+        // Zero everything outside [begin, end), and make that the live range.
+        auto _restrict_live_range(unsigned begin, unsigned end) -> void
+        {
+            auto & l = _data.long_data;
+            if (begin >= end) {
+                _zero_long_words(l.live_begin, l.live_end);
+                l.live_begin = l.live_end = 0;
+            }
+            else {
+                _zero_long_words(l.live_begin, std::min(l.live_end, begin));
+                _zero_long_words(std::max(l.live_begin, end), l.live_end);
+                l.live_begin = begin;
+                l.live_end = end;
+            }
+        }
+
+        // Assumes we are long and of the same size as other.
+        auto _assign_long_words(const SVOBitset & other) -> void
+        {
+            auto & l = _data.long_data;
+            const auto & o = other._data.long_data;
+            _restrict_live_range(o.live_begin, o.live_end);
+            std::copy(o.words + o.live_begin, o.words + o.live_end, l.words + o.live_begin);
+        }
+
+        // Used to leave a moved-from long bitset holding no storage.
+        auto _become_empty_short() -> void
+        {
+            n_words = 0;
+            std::fill(&_data.short_data[0], &_data.short_data[svo_size], 0);
+        }
+
     public:
         static constexpr const unsigned npos = std::numeric_limits<unsigned>::max();
 
+        /**
+         * How long storage has been obtained: fresh from the heap, or reused
+         * from a pool. Counts from threads that are still running, other than
+         * the calling thread, are not included.
+         */
+        struct AllocationStats
+        {
+            unsigned long long fresh_allocations = 0;
+            unsigned long long pool_reuses = 0;
+        };
+
+        static auto allocation_stats() -> AllocationStats;
+
         SVOBitset()
         {
             n_words = 0;
+            std::fill(&_data.short_data[0], &_data.short_data[svo_size], 0);
         }
 
         SVOBitset(unsigned size, unsigned bits);
@@ -42,8 +169,12 @@ class SVOBitset
         {
             if (other._is_long()) {
                 n_words = other.n_words;
-                _data.long_data = new BitWord[n_words];
-                std::copy(other._data.long_data, other._data.long_data + other.n_words, _data.long_data);
+                _data.long_data.words = _allocate_long_words(n_words);
+                _data.long_data.live_begin = 0;
+                _data.long_data.live_end = 0;
+                _data.long_data.borrowed = false;
+                std::fill(_data.long_data.words, _data.long_data.words + n_words, 0);
+                _assign_long_words(other);
             }
             else {
                 n_words = other.n_words;
@@ -51,10 +182,21 @@ class SVOBitset
             }
         }
 
+        SVOBitset(SVOBitset && other) noexcept
+        {
+            n_words = other.n_words;
+            if (other._is_long()) {
+                _data.long_data = other._data.long_data;
+                other._become_empty_short();
+            }
+            else
+                std::copy(&other._data.short_data[0], &other._data.short_data[svo_size], &_data.short_data[0]);
+        }
+
         ~SVOBitset()
         {
             if (_is_long())
-                delete[] _data.long_data;
+                _release_long_words();
         }
 
         auto operator= (const SVOBitset & other) -> SVOBitset &
@@ -63,20 +205,23 @@ class SVOBitset
                 return *this;
 
             if (other._is_long()) {
-                if (! _is_long()) {
+                if ((! _is_long()) || n_words != other.n_words) {
+                    auto words = _allocate_long_words(other.n_words);
+                    if (_is_long())
+                        _release_long_words();
                     n_words = other.n_words;
-                    _data.long_data = new BitWord[n_words];
-                }
-                else if (n_words != other.n_words) {
-                    delete[] _data.long_data;
-                    _data.long_data = new BitWord[n_words];
+                    _data.long_data.words = words;
+                    _data.long_data.live_begin = 0;
+                    _data.long_data.live_end = 0;
+                    _data.long_data.borrowed = false;
+                    std::fill(_data.long_data.words, _data.long_data.words + n_words, 0);
                 }
 
-                std::copy(other._data.long_data, other._data.long_data + other.n_words, _data.long_data);
+                _assign_long_words(other);
             }
             else {
                 if (_is_long())
-                    delete[] _data.long_data;
+                    _release_long_words();
                 n_words = other.n_words;
                 std::copy(&other._data.short_data[0], &other._data.short_data[svo_size], &_data.short_data[0]);
             }
@@ -84,38 +229,52 @@ class SVOBitset
             return *this;
         }
 
-
-        auto any() const -> bool
+        auto operator= (SVOBitset && other) noexcept -> SVOBitset &
         {
-            if (! _is_long()) {
-                for (unsigned i = 0 ; i < n_words ; ++i)
-                    if (0 != _data.short_data[i])
-                        return true;
+            if (&other == this)
+                return *this;
+
+            if (_is_long())
+                _release_long_words();
 
-                return false;
+            n_words = other.n_words;
+            if (other._is_long()) {
+                _data.long_data = other._data.long_data;
+                other._become_empty_short();
             }
-            else {
-                for (unsigned i = 0, i_end = n_words ; i < i_end ; ++i)
-                    if (0 != _data.long_data[i])
-                        return true;
+            else
+                std::copy(&other._data.short_data[0], &other._data.short_data[svo_size], &_data.short_data[0]);
 
-                return false;
+            return *this;
+        }
+
+        auto any() const -> bool
+        {
+            if (! _is_long()) {
+                return _with_short_width([&] (auto width) {
+                    BitWord result = 0;
+                    for (unsigned i = 0 ; i < width ; ++i)
+                        result |= _data.short_data[i];
+                    return 0 != result;
+                });
             }
+            else
+                return _data.long_data.live_begin != _data.long_data.live_end;
         }
 
         auto find_first() const -> unsigned
         {
             if (! _is_long()) {
-                for (unsigned i = 0 ; i < n_words ; ++i) {
-                    int x = __builtin_ffsll(_data.short_data[i]);
-                    if (0 != x)
-                        return i * bits_per_word + x - 1;
-                }
-                return npos;
+                return _with_short_width([&] (auto width) {
+                    for (unsigned i = 0 ; i < width ; ++i)
+                        if (0 != _data.short_data[i])
+                            return i * bits_per_word + __builtin_ctzll(_data.short_data[i]);
+                    return npos;
+                });
             }
             else {
-                for (unsigned i = 0, i_end = n_words ; i < i_end ; ++i) {
-                    int x = __builtin_ffsll(_data.long_data[i]);
+                for (unsigned i = _data.long_data.live_begin, i_end = _data.long_data.live_end ; i < i_end ; ++i) {
+                    int x = __builtin_ffsll(_data.long_data.words[i]);
                     if (0 != x)
                         return i * bits_per_word + x - 1;
                 }
@@ -123,41 +282,117 @@ class SVOBitset
             }
         }
 
-        auto reset(int a) -> void
+        auto find_last() const -> unsigned
         {
-            BitWord * b = (_is_long() ? _data.long_data : _data.short_data);
-            b[a / bits_per_word] &= ~(BitWord{ 1 } << (a % bits_per_word));
+            const BitWord * b = (_is_long() ? _data.long_data.words : _data.short_data);
+            unsigned begin = _is_long() ? _data.long_data.live_begin : 0;
+            unsigned end = _is_long() ? _data.long_data.live_end : _with_short_width([] (auto width) { return unsigned(width); });
+            for (unsigned i = end ; i > begin ; --i)
+                if (0 != b[i - 1])
+                    return (i - 1) * bits_per_word + bits_per_word - 1 - __builtin_clzll(b[i - 1]);
+            return npos;
+        }
+
+        /**
+         * Call f with the index of each set bit, in increasing order, without
+         * modifying or copying the bitset. If f returns a bool, stop as soon
+         * as it returns false. It is safe for f to reset bits that it has
+         * already been given.
+         */
+        template <typename F_>
+        auto for_each_set_bit(F_ && f) const -> void
+        {
+            const BitWord * b = (_is_long() ? _data.long_data.words : _data.short_data);
+            unsigned begin = _is_long() ? _data.long_data.live_begin : 0;
+            unsigned end = _is_long() ? _data.long_data.live_end : _with_short_width([] (auto width) { return unsigned(width); });
+            for (unsigned i = begin ; i < end ; ++i) {
+                for (BitWord w = b[i] ; 0 != w ; w &= w - 1) {
+                    unsigned v = i * bits_per_word + __builtin_ctzll(w);
+                    if constexpr (std::is_same_v<std::invoke_result_t<F_, unsigned>, bool>) {
+                        if (! f(v))
+                            return;
+                    }
+                    else
+                        f(v);
+                }
+            }
+        }
+
+        /**
+         * Clear a bit, and return whether it was previously set.
+         */
+        auto reset(int a) -> bool
+        {
+            BitWord * b = (_is_long() ? _data.long_data.words : _data.short_data);
+            unsigned w = a / bits_per_word;
+            BitWord mask = BitWord{ 1 } << (a % bits_per_word);
+            bool was_set = b[w] & mask;
+            b[w] &= ~mask;
+
+            if (_is_long() && 0 == b[w] && (w == _data.long_data.live_begin || w + 1 == _data.long_data.live_end))
+                _tighten_live_range();
+
+            return was_set;
         }
 
         auto reset() -> void
         {
-            if (! _is_long())
-                std::fill(&_data.short_data[0], &_data.short_data[svo_size], 0);
+            if (! _is_long()) {
+                _with_short_width([&] (auto width) {
+                    for (unsigned i = 0 ; i < width ; ++i)
+                        _data.short_data[i] = 0;
+                });
+            }
             else
-                std::fill(_data.long_data, _data.long_data + n_words, 0);
+                _restrict_live_range(0, 0);
         }
 
-        auto set(int a) -> void
+        /**
+         * Set a bit, and return whether it was previously clear.
+         */
+        auto set(int a) -> bool
         {
-            BitWord * b = (_is_long() ? _data.long_data : _data.short_data);
-            b[a / bits_per_word] |= (BitWord{ 1 } << (a % bits_per_word));
+            BitWord * b = (_is_long() ? _data.long_data.words : _data.short_data);
+            unsigned w = a / bits_per_word;
+            BitWord mask = BitWord{ 1 } << (a % bits_per_word);
+            bool was_clear = ! (b[w] & mask);
+            b[w] |= mask;
+
+            if (_is_long()) {
+                auto & l = _data.long_data;
+                if (l.live_begin == l.live_end) {
+                    l.live_begin = w;
+                    l.live_end = w + 1;
+                }
+                else {
+                    l.live_begin = std::min(l.live_begin, w);
+                    l.live_end = std::max(l.live_end, w + 1);
+                }
+            }
+
+            return was_clear;
         }
 
         auto test(int a) const -> bool
         {
-            const BitWord * b = (_is_long() ? _data.long_data : _data.short_data);
+            const BitWord * b = (_is_long() ? _data.long_data.words : _data.short_data);
             return b[a / bits_per_word] & (BitWord{ 1 } << (a % bits_per_word));
         }
 
         auto operator&= (const SVOBitset & other) -> SVOBitset &
         {
             if (! _is_long()) {
-                for (unsigned i = 0 ; i < svo_size ; ++i)
-                    _data.short_data[i] &= other._data.short_data[i];
+                _with_short_width([&] (auto width) {
+                    for (unsigned i = 0 ; i < width ; ++i)
+                        _data.short_data[i] &= other._data.short_data[i];
+                });
             }
             else {
-                for (unsigned i = 0 ; i < n_words ; ++i)
-                    _data.long_data[i] &= other._data.long_data[i];
+                auto & l = _data.long_data;
+                const auto & o = other._data.long_data;
+                _restrict_live_range(std::max(l.live_begin, o.live_begin), std::min(l.live_end, o.live_end));
+                _long_and(l.words + l.live_begin, o.words + l.live_begin, l.live_end - l.live_begin);
+                _tighten_live_range();
             }
 
             return *this;
@@ -166,12 +401,25 @@ class SVOBitset
         auto operator|= (const SVOBitset & other) -> SVOBitset &
         {
             if (! _is_long()) {
-                for (unsigned i = 0 ; i < svo_size ; ++i)
-                    _data.short_data[i] |= other._data.short_data[i];
+                _with_short_width([&] (auto width) {
+                    for (unsigned i = 0 ; i < width ; ++i)
+                        _data.short_data[i] |= other._data.short_data[i];
+                });
             }
             else {
-                for (unsigned i = 0 ; i < n_words ; ++i)
-                    _data.long_data[i] |= other._data.long_data[i];
+                auto & l = _data.long_data;
+                const auto & o = other._data.long_data;
+                if (o.live_begin != o.live_end) {
+                    _long_or(l.words + o.live_begin, o.words + o.live_begin, o.live_end - o.live_begin);
+                    if (l.live_begin == l.live_end) {
+                        l.live_begin = o.live_begin;
+                        l.live_end = o.live_end;
+                    }
+                    else {
+                        l.live_begin = std::min(l.live_begin, o.live_begin);
+                        l.live_end = std::max(l.live_end, o.live_end);
+                    }
+                }
             }
 
             return *this;
@@ -180,24 +428,239 @@ class SVOBitset
         auto intersect_with_complement(const SVOBitset & other) -> void
         {
             if (! _is_long()) {
-                for (unsigned i = 0 ; i < svo_size ; ++i)
-                    _data.short_data[i] &= ~other._data.short_data[i];
+                _with_short_width([&] (auto width) {
+                    for (unsigned i = 0 ; i < width ; ++i)
+                        _data.short_data[i] &= ~other._data.short_data[i];
+                });
+            }
+            else {
+                auto & l = _data.long_data;
+                const auto & o = other._data.long_data;
+                unsigned begin = std::max(l.live_begin, o.live_begin), end = std::min(l.live_end, o.live_end);
+                if (begin < end) {
+                    _long_and_not(l.words + begin, o.words + begin, end - begin);
+                    _tighten_live_range();
+                }
+            }
+        }
+
+        /**
+         * Intersect with another bitset, and return how many bits are left.
+         */
+        auto intersect_and_count(const SVOBitset & other) -> unsigned
+        {
+            if (! _is_long()) {
+                return _with_short_width([&] (auto width) {
+                    unsigned result = 0;
+                    for (unsigned i = 0 ; i < width ; ++i) {
+                        _data.short_data[i] &= other._data.short_data[i];
+                        result += __builtin_popcountll(_data.short_data[i]);
+                    }
+                    return result;
+                });
             }
             else {
-                for (unsigned i = 0 ; i < n_words ; ++i)
-                    _data.long_data[i] &= ~other._data.long_data[i];
+                auto & l = _data.long_data;
+                const auto & o = other._data.long_data;
+                _restrict_live_range(std::max(l.live_begin, o.live_begin), std::min(l.live_end, o.live_end));
+                unsigned result = _long_and_and_count(l.words + l.live_begin, o.words + l.live_begin, l.live_end - l.live_begin);
+                if (0 == result)
+                    l.live_begin = l.live_end = 0;
+                else
+                    _tighten_live_range();
+                return result;
             }
         }
 
+        /**
+         * Intersect with the complement of another bitset, and return how
+         * many bits are left.
+         */
+        auto intersect_with_complement_and_count(const SVOBitset & other) -> unsigned
+        {
+            if (! _is_long()) {
+                return _with_short_width([&] (auto width) {
+                    unsigned result = 0;
+                    for (unsigned i = 0 ; i < width ; ++i) {
+                        _data.short_data[i] &= ~other._data.short_data[i];
+                        result += __builtin_popcountll(_data.short_data[i]);
+                    }
+                    return result;
+                });
+            }
+            else {
+                auto & l = _data.long_data;
+                const auto & o = other._data.long_data;
+                unsigned begin = std::max(l.live_begin, o.live_begin), end = std::min(l.live_end, o.live_end);
+                if (begin >= end)
+                    return count();
+
+                unsigned result = _count_long_words(l.live_begin, begin)
+                    + _long_and_not_and_count(l.words + begin, o.words + begin, end - begin)
+                    + _count_long_words(end, l.live_end);
+                if (0 == result)
+                    l.live_begin = l.live_end = 0;
+                else
+                    _tighten_live_range();
+                return result;
+            }
+        }
+
+        /**
+         * Union with another bitset, and return how many bits are now set.
+         */
+        auto unite_and_count(const SVOBitset & other) -> unsigned
+        {
+            if (! _is_long()) {
+                return _with_short_width([&] (auto width) {
+                    unsigned result = 0;
+                    for (unsigned i = 0 ; i < width ; ++i) {
+                        _data.short_data[i] |= other._data.short_data[i];
+                        result += __builtin_popcountll(_data.short_data[i]);
+                    }
+                    return result;
+                });
+            }
+            else {
+                auto & l = _data.long_data;
+                const auto & o = other._data.long_data;
+                if (o.live_begin == o.live_end)
+                    return count();
+
+                if (l.live_begin == l.live_end) {
+                    l.live_begin = o.live_begin;
+                    l.live_end = o.live_end;
+                }
+                else {
+                    l.live_begin = std::min(l.live_begin, o.live_begin);
+                    l.live_end = std::max(l.live_end, o.live_end);
+                }
+
+                return _count_long_words(l.live_begin, o.live_begin)
+                    + _long_or_and_count(l.words + o.live_begin, o.words + o.live_begin, o.live_end - o.live_begin)
+                    + _count_long_words(o.live_end, l.live_end);
+            }
+        }
+
+        /**
+         * Intersect with the set of bits given by a sorted range of indices.
+         */
+        auto intersect_with_sorted_indices(const unsigned * first, const unsigned * last) -> void
+        {
+            if (! _is_long()) {
+                for (unsigned i = 0 ; i < n_words ; ++i) {
+                    BitWord mask = 0;
+                    for ( ; first != last && *first / bits_per_word == i ; ++first)
+                        mask |= (BitWord{ 1 } << (*first % bits_per_word));
+                    _data.short_data[i] &= mask;
+                }
+            }
+            else {
+                auto & l = _data.long_data;
+                for ( ; first != last && *first / bits_per_word < l.live_begin ; ++first)
+                    ;
+                for (unsigned i = l.live_begin ; i < l.live_end ; ++i) {
+                    BitWord mask = 0;
+                    for ( ; first != last && *first / bits_per_word == i ; ++first)
+                        mask |= (BitWord{ 1 } << (*first % bits_per_word));
+                    l.words[i] &= mask;
+                }
+                _tighten_live_range();
+            }
+        }
+
+        /**
+         * Intersect with the complement of the set of bits given by a range of indices.
+         */
+        auto intersect_with_complement_of_indices(const unsigned * first, const unsigned * last) -> void
+        {
+            BitWord * b = (_is_long() ? _data.long_data.words : _data.short_data);
+            for ( ; first != last ; ++first)
+                b[*first / bits_per_word] &= ~(BitWord{ 1 } << (*first % bits_per_word));
+            if (_is_long())
+                _tighten_live_range();
+        }
+
         auto count() const -> unsigned
         {
-            unsigned result = 0;
-            const BitWord * b = (_is_long() ? _data.long_data : _data.short_data);
-            for (unsigned i = 0, i_end = n_words ; i < i_end ; ++i)
-                result += __builtin_popcountll(b[i]);
+            if (! _is_long()) {
+                return _with_short_width([&] (auto width) {
+                    unsigned result = 0;
+                    for (unsigned i = 0 ; i < width ; ++i)
+                        result += __builtin_popcountll(_data.short_data[i]);
+                    return result;
+                });
+            }
+            else
+                return _count_long_words(_data.long_data.live_begin, _data.long_data.live_end);
+        }
+};
+
+/**
+ * A fixed number of same-sized bitsets, whose long storage is carved out of
+ * a single 64-byte aligned allocation, with each row starting on a cache
+ * line. Used for graph rows, so that rows which are used together can be
+ * laid out next to each other in memory.
+ */
+class SVOBitsetSlab
+{
+    private:
+        struct FreeStorage
+        {
+            auto operator() (SVOBitset::BitWord * p) const -> void;
+        };
+
+        std::unique_ptr<SVOBitset::BitWord[], FreeStorage> _storage;
+        std::vector<SVOBitset> _rows;
+
+    public:
+        SVOBitsetSlab() = default;
+
+        /**
+         * Create n_rows empty bitsets, each of the given size.
+         */
+        SVOBitsetSlab(unsigned n_rows, unsigned size);
+
+        SVOBitsetSlab(const SVOBitsetSlab &) = delete;
+        auto operator= (const SVOBitsetSlab &) -> SVOBitsetSlab & = delete;
+
+        SVOBitsetSlab(SVOBitsetSlab &&) = default;
+        auto operator= (SVOBitsetSlab &&) -> SVOBitsetSlab & = default;
+
+        auto operator[] (unsigned i) -> SVOBitset &
+        {
+            return _rows[i];
+        }
 
-            return result;
+        auto operator[] (unsigned i) const -> const SVOBitset &
+        {
+            return _rows[i];
         }
+
+        auto size() const -> unsigned
+        {
+            return _rows.size();
+        }
+
+        /**
+         * How many words each row of this many bits takes up, in the layout
+         * used by save_words() and borrowing_read_only().
+         */
+        static auto words_per_row(unsigned size) -> unsigned;
+
+        /**
+         * Pass every row's words to write, in order, each padded out to
+         * words_per_row() words.
+         */
+        auto save_words(const std::function<auto (const unsigned long long *, std::size_t) -> void> & write) const -> void;
+
+        /**
+         * Create n_rows bitsets of the given size, reading their words from
+         * storage laid out as by save_words(). Long rows use the storage
+         * directly, rather than copying it, so it must be 64 byte aligned,
+         * must outlive the slab, and the rows must never be modified.
+         */
+        static auto borrowing_read_only(unsigned n_rows, unsigned size, const unsigned long long * storage) -> SVOBitsetSlab;
 };
 
 #endif
@@ -2,9 +2,16 @@
 
 #include "thread_utils.hh"
 
+#include <algorithm>
+#include <atomic>
 #include <thread>
+#include <vector>
 
+using std::atomic;
+using std::function;
+using std::min;
 using std::thread;
+using std::vector;
 
 auto how_many_threads(unsigned n) -> unsigned
 {
@@ -15,3 +22,38 @@ auto how_many_threads(unsigned n) -> unsigned
     return n;
 }
 
+auto threads_for_blocks(unsigned n_threads, unsigned size, unsigned block_size) -> unsigned
+{
+    unsigned n_blocks = (size + block_size - 1) / block_size;
+    return std::max(1u, min(how_many_threads(n_threads), n_blocks));
+}
+
+auto parallel_for_each_block(unsigned n_threads, unsigned size, unsigned block_size,
+        const function<auto (unsigned, unsigned, unsigned) -> void> & f) -> void
+{
+    unsigned n = threads_for_blocks(n_threads, size, block_size);
+    if (1 == n) {
+        if (0 != size)
+            f(0, 0, size);
+        return;
+    }
+
+    atomic<unsigned> next_block{ 0 };
+    auto work = [&] (unsigned t) {
+        while (true) {
+            unsigned first = next_block.fetch_add(1, std::memory_order_relaxed) * block_size;
+            if (first >= size)
+                break;
+            f(t, first, min(size, first + block_size));
+        }
+    };
+
+    vector<thread> threads;
+    threads.reserve(n - 1);
+    for (unsigned t = 1 ; t < n ; ++t)
+        threads.emplace_back(work, t);
+    work(0);
+
+    for (auto & th : threads)
+        th.join();
+}
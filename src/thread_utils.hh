@@ -3,6 +3,23 @@
 #ifndef GLASGOW_SUBGRAPH_SOLVER_GUARD_SRC_THREAD_UTILS_HH
 #define GLASGOW_SUBGRAPH_SOLVER_GUARD_SRC_THREAD_UTILS_HH 1
 
+#include <functional>
+
 auto how_many_threads(unsigned n) -> unsigned;
 
+/**
+ * Split [0, size) into consecutive blocks of block_size, and call f(thread,
+ * first, last) for each block, using up to how_many_threads(n_threads)
+ * threads. Blocks are handed out dynamically, so f must only use thread to
+ * pick per-thread scratch space. If there is only one block or one thread,
+ * everything runs on the calling thread, as a single call f(0, 0, size).
+ */
+auto parallel_for_each_block(unsigned n_threads, unsigned size, unsigned block_size,
+        const std::function<auto (unsigned, unsigned, unsigned) -> void> & f) -> void;
+
+/**
+ * How many threads will parallel_for_each_block use for this many items?
+ */
+auto threads_for_blocks(unsigned n_threads, unsigned size, unsigned block_size) -> unsigned;
+
 #endif